@@ -0,0 +1,55 @@
+/*
+ * ActivationArena.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "ActivationArena.h"
+#include "Logger.h"
+#include <cstdlib>
+#include <cstring>
+
+namespace clneural {
+
+size_t ActivationArena::reserve(size_t num_floats) {
+	if (data != nullptr) {
+		Logger::writeLine("ActivationArena::reserve(): Arena already allocated.");
+		return 0;
+	}
+	size_t alignment = ARENAALIGNMENT / sizeof(float);
+	size_t offset = size;
+	size += (num_floats + alignment - 1) / alignment * alignment;
+	return offset;
+}
+
+bool ActivationArena::allocate() {
+	if (data != nullptr) {
+		return true;
+	}
+	void *buffer = nullptr;
+	size_t bytes = (size > 0 ? size : 1) * sizeof(float);
+	if (posix_memalign(&buffer, ARENAALIGNMENT, bytes) != 0) {
+		Logger::writeLine("ActivationArena::allocate(): Unable to allocate " + std::to_string(bytes) + " bytes.");
+		return false;
+	}
+	memset(buffer, 0, bytes);
+	data = (float *) buffer;
+	return true;
+}
+
+float *ActivationArena::getRegion(size_t offset) const {
+	return data + offset;
+}
+
+size_t ActivationArena::getSize() const {
+	return size;
+}
+
+ActivationArena::~ActivationArena() {
+	if (data != nullptr) {
+		free(data);
+		data = nullptr;
+	}
+}
+
+} /* namespace clneural */
@@ -0,0 +1,50 @@
+/*
+ * ActivationArena.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef ACTIVATIONARENA_H_
+#define ACTIVATIONARENA_H_
+
+#include <cstddef>
+
+#define ARENAALIGNMENT 64
+
+namespace clneural {
+
+/* One aligned block holding the activations, netsums and errors of a chain of layers.
+ * Regions are reserved while planning and addressed by their offset once the block is allocated,
+ * so a forward or backward pass only writes to memory that already exists. */
+class ActivationArena {
+public:
+	/* Non-owning view of consecutive floats, valid until the arena is planned again. */
+	struct View {
+		const float *values = nullptr;
+		size_t num_values = 0;
+		const float *data() const { return values; }
+		size_t size() const { return num_values; }
+		const float *begin() const { return values; }
+		const float *end() const { return values + num_values; }
+		const float &operator[](size_t i) const { return values[i]; }
+	};
+private:
+	float *data = nullptr;
+	size_t size = 0; //floats reserved, every region starts at a multiple of ARENAALIGNMENT bytes
+public:
+	ActivationArena() = default;
+	ActivationArena(const ActivationArena &) = delete;
+	ActivationArena &operator=(const ActivationArena &) = delete;
+	/* Reserves a region of num_floats floats and returns its offset. Only possible before allocate(). */
+	size_t reserve(size_t num_floats);
+	/* Allocates all reserved regions zero-initialized, returns false if the allocation fails. */
+	bool allocate();
+	float *getRegion(size_t offset) const;
+	/* Floats reserved in total, including the alignment padding. */
+	size_t getSize() const;
+	virtual ~ActivationArena();
+};
+
+} /* namespace clneural */
+
+#endif /* ACTIVATIONARENA_H_ */
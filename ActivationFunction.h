@@ -21,6 +21,9 @@ public:
 	static std::shared_ptr<ActivationFunction> getObjectFromString(std::string name);
 	virtual std::string getCode() const = 0;
 	virtual std::string getDerivCode() const = 0;
+	/* Host versions of getCode() and getDerivCode() for the native backend. */
+	virtual float compute(float input) const = 0;
+	virtual float computeDerivative(float input) const = 0;
 	virtual std::string getName() const = 0;
 	virtual ~ActivationFunction();
 };
@@ -0,0 +1,336 @@
+/*
+ * AugmentationLayer.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "AugmentationLayer.h"
+#include "Logger.h"
+#include "ThreadPool.h"
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+
+#define ELASTIC_GRID 4 //control points of the elastic displacement field per axis
+
+namespace clneural {
+
+/* augmentHash() is the lowbias32 integer hash, three rounds of it turn (seed, sample, stream) into one random number. */
+const std::string AugmentationLayer::augmentclcode = "#define ELASTIC_GRID " + std::to_string(ELASTIC_GRID) + "\n"
+		"uint augmentHash(uint x) {\n"
+		"x ^= x >> 16;\n"
+		"x *= 0x7feb352dU;\n"
+		"x ^= x >> 15;\n"
+		"x *= 0x846ca68bU;\n"
+		"x ^= x >> 16;\n"
+		"return x;\n"
+		"}\n"
+		"float augmentRandom(uint seed, uint sample, uint stream) {\n"
+		"return (float) (augmentHash(augmentHash(augmentHash(seed) ^ sample) ^ stream) >> 8) * (2.0f / 16777216.0f) - 1.0f;\n"
+		"}\n"
+		"__kernel void augment(__global const float *inputs, __global float *outputs, unsigned int inp_width, unsigned int inp_height, \n"
+		"unsigned int num_inputs, unsigned int seed, unsigned int first_sample, float max_shift, float max_rotation, \n"
+		"float elastic_alpha, float background, unsigned int enabled) {\n"
+		"unsigned int input_id = get_global_id(0);\n"
+		"unsigned int sample_id = get_global_id(1);\n"
+		"unsigned int map_size = inp_width * inp_height;\n"
+		"unsigned int x = (input_id % map_size) % inp_width;\n"
+		"unsigned int y = (input_id % map_size) / inp_width;\n"
+		"__global const float *map = inputs + sample_id * num_inputs + (input_id / map_size) * map_size;\n"
+		"if (enabled == 0) {\n"
+		"outputs[sample_id * num_inputs + input_id] = map[y * inp_width + x];\n"
+		"return;\n"
+		"}\n"
+		"unsigned int sample = first_sample + sample_id;\n"
+		"float center_x = (inp_width - 1) * 0.5f;\n"
+		"float center_y = (inp_height - 1) * 0.5f;\n"
+		"float angle = max_rotation * augmentRandom(seed, sample, 2);\n"
+		"float rel_x = x - center_x;\n"
+		"float rel_y = y - center_y;\n"
+		"float src_x = cos(angle) * rel_x - sin(angle) * rel_y + center_x - max_shift * augmentRandom(seed, sample, 0);\n"
+		"float src_y = sin(angle) * rel_x + cos(angle) * rel_y + center_y - max_shift * augmentRandom(seed, sample, 1);\n"
+		"float grid_x = x * (ELASTIC_GRID - 1) / (float) max(inp_width - 1, 1U);\n"
+		"float grid_y = y * (ELASTIC_GRID - 1) / (float) max(inp_height - 1, 1U);\n"
+		"unsigned int cell_x = min((unsigned int) grid_x, (unsigned int) (ELASTIC_GRID - 2));\n"
+		"unsigned int cell_y = min((unsigned int) grid_y, (unsigned int) (ELASTIC_GRID - 2));\n"
+		"float fx = grid_x - cell_x;\n"
+		"float fy = grid_y - cell_y;\n"
+		"for (unsigned int axis = 0; axis < 2; axis++) {\n"
+		"unsigned int stream = 3 + 2 * (cell_y * ELASTIC_GRID + cell_x) + axis;\n"
+		"float top = (1.0f - fx) * augmentRandom(seed, sample, stream) + fx * augmentRandom(seed, sample, stream + 2);\n"
+		"float bottom = (1.0f - fx) * augmentRandom(seed, sample, stream + 2 * ELASTIC_GRID) + fx * augmentRandom(seed, sample, stream + 2 * ELASTIC_GRID + 2);\n"
+		"float displacement = elastic_alpha * ((1.0f - fy) * top + fy * bottom);\n"
+		"if (axis == 0) src_x += displacement;\n"
+		"else src_y += displacement;\n"
+		"}\n"
+		"float x0 = floor(src_x);\n"
+		"float y0 = floor(src_y);\n"
+		"float wx = src_x - x0;\n"
+		"float wy = src_y - y0;\n"
+		"float sum = 0.0f;\n"
+		"for (int j = 0; j < 2; j++) {\n"
+		"for (int i = 0; i < 2; i++) {\n"
+		"int px = (int) x0 + i;\n"
+		"int py = (int) y0 + j;\n"
+		"float value = background;\n"
+		"if ((px >= 0) && (py >= 0) && (px < (int) inp_width) && (py < (int) inp_height)) value = map[py * inp_width + px];\n"
+		"sum += (i ? wx : 1.0f - wx) * (j ? wy : 1.0f - wy) * value;\n"
+		"}\n"
+		"}\n"
+		"outputs[sample_id * num_inputs + input_id] = sum;\n"
+		"}\n";
+
+const NeuralNetworkLayerRegisterHelper<AugmentationLayer> AugmentationLayer::reg("AugmentationLayer");
+
+static uint32_t augmentHash(uint32_t x) {
+	x ^= x >> 16;
+	x *= 0x7feb352dU;
+	x ^= x >> 15;
+	x *= 0x846ca68bU;
+	x ^= x >> 16;
+	return x;
+}
+
+static float augmentRandom(uint32_t seed, uint32_t sample, uint32_t stream) {
+	return (float) (augmentHash(augmentHash(augmentHash(seed) ^ sample) ^ stream) >> 8) * (2.0f / 16777216.0f) - 1.0f;
+}
+
+AugmentationLayer::AugmentationLayer(Dimension input_maps, unsigned int num_feature_maps, Parameters parameters, unsigned int seed) :
+	input_maps(input_maps),
+	num_feature_maps(num_feature_maps),
+	parameters(parameters),
+	seed(seed) {
+	num_inputs = num_feature_maps * input_maps.width * input_maps.height;
+	num_outputs = num_inputs;
+}
+
+bool AugmentationLayer::initializeMemoryObjects(std::shared_ptr<OpenCLInterface> ocl, unsigned int batch_size) {
+	if (batch_size > batch_capacity) {
+		freeBatchMemoryObjects(ocl);
+		batch_capacity = batch_size;
+	}
+	if (imemid < 0) {
+		imemid = ocl->allocateMemoryObject(NULL, num_inputs * batch_capacity * sizeof(float), CL_MEM_READ_WRITE);
+	}
+	if (oememid < 0) {
+		oememid = ocl->allocateMemoryObject(NULL, num_outputs * batch_capacity * sizeof(float), CL_MEM_READ_WRITE);
+	}
+	if ((imemid < 0) || (oememid < 0)) {
+		return false;
+	}
+	return true;
+}
+
+void AugmentationLayer::freeBatchMemoryObjects(std::shared_ptr<OpenCLInterface> ocl) {
+	if (imemid >= 0) {
+		ocl->freeMemoryObject(imemid);
+		imemid = -1;
+	}
+	if (oememid >= 0) {
+		ocl->freeMemoryObject(oememid);
+		oememid = -1;
+	}
+}
+
+bool AugmentationLayer::initializeKernelObjects(std::shared_ptr<OpenCLInterface> ocl) {
+	if (akid < 0) {
+		akid = ocl->createKernelFromSource(augmentclcode, "augment");
+	}
+	return (akid >= 0);
+}
+
+int AugmentationLayer::uploadInput(const float *input, unsigned int batch_size, bool training) {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (!ocl->isInitialized()) {
+		return -1;
+	} else if (training && !initializeKernelObjects(ocl)) {
+		Logger::writeLine("AugmentationLayer::uploadInput(): Can't initialize kernel.");
+		return -1;
+	} else if (!initializeMemoryObjects(ocl, batch_size)) {
+		Logger::writeLine("AugmentationLayer::uploadInput(): Can't initialize memory objects.");
+		return -1;
+	}
+	//outside of training the input is the output, it is written there and computeDeviceOutput() has nothing to do
+	int memid = training ? imemid : oememid;
+	if (ocl->enqueueWriteMemoryContent(memid, (const void*) input, num_inputs * batch_size * sizeof(float)) != OpenCLInterface::OpenCLError::SUCCESS) {
+		Logger::writeLine("AugmentationLayer::uploadInput(): Unable to write input to the device.");
+		return -1;
+	}
+	return memid;
+}
+
+bool AugmentationLayer::computeDeviceOutput(int memid, unsigned int batch_size, bool training) {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (ocl->isInitialized()) {
+		if (!training && (memid >= 0) && (memid == oememid)) {
+			input_memid = memid;
+			return true;
+		} else if (!initializeKernelObjects(ocl)) {
+			Logger::writeLine("AugmentationLayer::computeDeviceOutput(): Can't initialize kernel. Unable to compute anything.");
+			return false;
+		} else if (!initializeMemoryObjects(ocl, batch_size)) {
+			Logger::writeLine("AugmentationLayer::computeDeviceOutput(): Can't initialize memory objects. Unable to compute anything.");
+			return false;
+		} else {
+			OpenCLInterface::Dimension dim;
+			dim.x = num_inputs;
+			dim.y = batch_size;
+			unsigned int enabled = training ? 1 : 0;
+			std::vector<int> memargs({memid, oememid});
+			std::vector<std::pair<void *, size_t>> constargs({std::make_pair((void *) &input_maps.width, sizeof(unsigned int)),
+															std::make_pair((void*) &input_maps.height, sizeof(unsigned int)),
+															std::make_pair((void*) &num_inputs, sizeof(unsigned int)),
+															std::make_pair((void*) &seed, sizeof(unsigned int)),
+															std::make_pair((void*) &sample_counter, sizeof(unsigned int)),
+															std::make_pair((void*) &parameters.max_shift, sizeof(float)),
+															std::make_pair((void*) &parameters.max_rotation, sizeof(float)),
+															std::make_pair((void*) &parameters.elastic_alpha, sizeof(float)),
+															std::make_pair((void*) &parameters.background, sizeof(float)),
+															std::make_pair((void*) &enabled, sizeof(unsigned int))});
+			if (ocl->enqueueKernel(akid, dim, memargs, constargs) != OpenCLInterface::OpenCLError::SUCCESS) {
+				Logger::writeLine("AugmentationLayer::computeDeviceOutput(): Error when calling the OpenCL kernel.");
+				return false;
+			}
+			if (training) sample_counter += batch_size;
+			input_memid = memid;
+			return true;
+		}
+	} else {
+		Logger::writeLine("AugmentationLayer::computeDeviceOutput(): OpenCLInterface not initialized. Unable to compute anything.");
+		return false;
+	}
+}
+
+int AugmentationLayer::getOutputMemoryId() const {
+	return oememid;
+}
+
+std::vector<float> AugmentationLayer::computeOutput(const std::vector<float> &input) {
+	std::vector<float> output(num_outputs);
+	computeHostOutput(&input[0], &output[0], 1, true);
+	return output;
+}
+
+int AugmentationLayer::uploadError(const float *error, unsigned int batch_size) {
+	//nothing to adapt and no previous layer to need the error on the device
+	return -1;
+}
+
+int AugmentationLayer::computeDeviceError(int memid, unsigned int batch_size) {
+	return memid;
+}
+
+std::vector<float> AugmentationLayer::computeError(const std::vector<float> &input) {
+	return input;
+}
+
+void AugmentationLayer::computeHostOutput(const float *input, float *output, unsigned int batch_size, bool training) {
+	if (!training) {
+		std::copy(input, input + num_inputs * batch_size, output);
+		return;
+	}
+	unsigned int map_size = input_maps.width * input_maps.height;
+	float center_x = (input_maps.width - 1) * 0.5f;
+	float center_y = (input_maps.height - 1) * 0.5f;
+	float grid_width = (float) std::max(input_maps.width - 1, 1U);
+	float grid_height = (float) std::max(input_maps.height - 1, 1U);
+	//same arithmetic as the augment kernel, one item per (pixel, sample) across all feature maps
+	ThreadPool::getInstance()->parallelFor(map_size * batch_size, [&](unsigned int begin, unsigned int end) {
+		for (unsigned int id = begin; id < end; id++) {
+			unsigned int sample_id = id / map_size;
+			unsigned int x = (id % map_size) % input_maps.width;
+			unsigned int y = (id % map_size) / input_maps.width;
+			uint32_t sample = sample_counter + sample_id;
+			float angle = parameters.max_rotation * augmentRandom(seed, sample, 2);
+			float rel_x = x - center_x;
+			float rel_y = y - center_y;
+			float src_x = std::cos(angle) * rel_x - std::sin(angle) * rel_y + center_x - parameters.max_shift * augmentRandom(seed, sample, 0);
+			float src_y = std::sin(angle) * rel_x + std::cos(angle) * rel_y + center_y - parameters.max_shift * augmentRandom(seed, sample, 1);
+			float grid_x = x * (ELASTIC_GRID - 1) / grid_width;
+			float grid_y = y * (ELASTIC_GRID - 1) / grid_height;
+			unsigned int cell_x = std::min((unsigned int) grid_x, (unsigned int) (ELASTIC_GRID - 2));
+			unsigned int cell_y = std::min((unsigned int) grid_y, (unsigned int) (ELASTIC_GRID - 2));
+			float fx = grid_x - cell_x;
+			float fy = grid_y - cell_y;
+			for (unsigned int axis = 0; axis < 2; axis++) {
+				unsigned int stream = 3 + 2 * (cell_y * ELASTIC_GRID + cell_x) + axis;
+				float top = (1.0f - fx) * augmentRandom(seed, sample, stream) + fx * augmentRandom(seed, sample, stream + 2);
+				float bottom = (1.0f - fx) * augmentRandom(seed, sample, stream + 2 * ELASTIC_GRID) + fx * augmentRandom(seed, sample, stream + 2 * ELASTIC_GRID + 2);
+				float displacement = parameters.elastic_alpha * ((1.0f - fy) * top + fy * bottom);
+				if (axis == 0) src_x += displacement;
+				else src_y += displacement;
+			}
+			float x0 = std::floor(src_x);
+			float y0 = std::floor(src_y);
+			float wx = src_x - x0;
+			float wy = src_y - y0;
+			for (unsigned int feature_map_id = 0; feature_map_id < num_feature_maps; feature_map_id++) {
+				const float *map = &input[sample_id * num_inputs + feature_map_id * map_size];
+				float sum = 0.0f;
+				for (int j = 0; j < 2; j++) {
+					for (int i = 0; i < 2; i++) {
+						int px = (int) x0 + i;
+						int py = (int) y0 + j;
+						float value = parameters.background;
+						if ((px >= 0) && (py >= 0) && (px < (int) input_maps.width) && (py < (int) input_maps.height)) value = map[py * input_maps.width + px];
+						sum += (i ? wx : 1.0f - wx) * (j ? wy : 1.0f - wy) * value;
+					}
+				}
+				output[sample_id * num_inputs + feature_map_id * map_size + y * input_maps.width + x] = sum;
+			}
+		}
+	});
+	sample_counter += batch_size;
+}
+
+void AugmentationLayer::computeHostError(const float *error, float *previous_error, unsigned int batch_size) {
+	std::copy(error, error + num_outputs * batch_size, previous_error);
+}
+
+std::string AugmentationLayer::getName() const {
+	return "AugmentationLayer";
+}
+
+std::string AugmentationLayer::getDatastring() const {
+	std::string datastring = std::to_string(num_feature_maps) + ":";
+	datastring += std::to_string(input_maps.width) + ":" + std::to_string(input_maps.height) + ":";
+	datastring += std::to_string(parameters.max_shift) + ":" + std::to_string(parameters.max_rotation) + ":";
+	datastring += std::to_string(parameters.elastic_alpha) + ":" + std::to_string(parameters.background) + ":";
+	datastring += std::to_string(seed) + ":" + std::to_string(sample_counter);
+	return datastring;
+}
+
+bool AugmentationLayer::parseDatastring(std::string datastring) {
+	std::vector<std::string> data = parseVectorRepresentation<std::string> (datastring, ':');
+	if (data.size() != 9) {
+		Logger::writeLine("AugmentationLayer::parseDatastring(): Invalid number of parameters. Found: " + std::to_string(data.size()));
+		return false;
+	}
+	num_feature_maps = std::stoul(data[0]);
+	input_maps.width = std::stoul(data[1]);
+	input_maps.height = std::stoul(data[2]);
+	num_inputs = input_maps.width * input_maps.height * num_feature_maps;
+	num_outputs = num_inputs;
+	parameters.max_shift = std::stof(data[3]);
+	parameters.max_rotation = std::stof(data[4]);
+	parameters.elastic_alpha = std::stof(data[5]);
+	parameters.background = std::stof(data[6]);
+	seed = std::stoul(data[7]);
+	sample_counter = std::stoul(data[8]);
+	return true;
+}
+
+AugmentationLayer::~AugmentationLayer() {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (imemid >= 0) {
+		ocl->freeMemoryObject(imemid);
+	}
+	if (oememid >= 0) {
+		ocl->freeMemoryObject(oememid);
+	}
+	if (akid >= 0) {
+		ocl->deleteKernel(akid);
+	}
+}
+
+} /* namespace clneural */
@@ -0,0 +1,67 @@
+/*
+ * AugmentationLayer.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef AUGMENTATIONLAYER_H_
+#define AUGMENTATIONLAYER_H_
+
+#include "NeuralNetworkLayer.h"
+#include "OpenCLInterface.h"
+
+namespace clneural {
+
+/* Distorts every training sample by a random shift, rotation and elastic deformation, applied equally to all
+ * feature maps of a sample. Outside of training passes the input is passed through unchanged.
+ * Meant as the first layer: its output buffer feeds the next layer on the device without a host round trip.
+ * The random numbers are a hash of the seed, a running sample counter and the parameter, so a pass can be
+ * reproduced from seed and counter. The error is passed through unchanged, the layer has nothing to learn. */
+class AugmentationLayer: public NeuralNetworkLayer {
+public:
+	struct Dimension {
+		unsigned int width = 0;
+		unsigned int height = 0;
+	};
+	struct Parameters {
+		float max_shift = 0.0f; //pixels in each direction
+		float max_rotation = 0.0f; //radians in each direction
+		float elastic_alpha = 0.0f; //maximum displacement of the elastic control points in pixels
+		float background = 0.0f; //value of pixels moved in from outside of the map
+	};
+private:
+	static const std::string augmentclcode;
+	Dimension input_maps;
+	unsigned int num_feature_maps = 0;
+	Parameters parameters;
+	unsigned int seed = 0;
+	unsigned int sample_counter = 0; //training samples augmented so far, part of the random number counter
+	int imemid = -1; //inputs
+	int oememid = -1; //outputs
+	int akid = -1; //kernel for augmentation
+	bool initializeMemoryObjects(std::shared_ptr<OpenCLInterface> ocl, unsigned int batch_size = 1);
+	void freeBatchMemoryObjects(std::shared_ptr<OpenCLInterface> ocl);
+	bool initializeKernelObjects(std::shared_ptr<OpenCLInterface> ocl);
+	static const NeuralNetworkLayerRegisterHelper<AugmentationLayer> reg;
+protected:
+	virtual std::vector<float> computeOutput(const std::vector<float> &input);
+	virtual std::vector<float> computeError(const std::vector<float> &input);
+	virtual void computeHostOutput(const float *input, float *output, unsigned int batch_size, bool training);
+	virtual void computeHostError(const float *error, float *previous_error, unsigned int batch_size);
+	virtual int uploadInput(const float *input, unsigned int batch_size, bool training);
+	virtual bool computeDeviceOutput(int memid, unsigned int batch_size, bool training);
+	virtual int getOutputMemoryId() const;
+	virtual int uploadError(const float *error, unsigned int batch_size);
+	virtual int computeDeviceError(int memid, unsigned int batch_size);
+	virtual std::string getName() const;
+	virtual std::string getDatastring() const;
+	virtual bool parseDatastring(std::string datastring);
+public:
+	AugmentationLayer() = default;
+	AugmentationLayer(Dimension input_maps, unsigned int num_feature_maps, Parameters parameters, unsigned int seed);
+	virtual ~AugmentationLayer();
+};
+
+} /* namespace clneural */
+
+#endif /* AUGMENTATIONLAYER_H_ */
@@ -0,0 +1,133 @@
+/*
+ * BatchPrefetcher.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "BatchPrefetcher.h"
+#include <algorithm>
+
+#define PREFETCHSPINS 64
+
+BatchPrefetcher::BatchPrefetcher(const ImageDataset &dataset, unsigned int batch_size, unsigned int num_classes, unsigned int epochs,
+		unsigned int seed, unsigned int num_workers, unsigned int capacity, bool stratified) : dataset(dataset), sampler(dataset, seed, stratified), stopping(false), parked(0) {
+	this->batch_size = std::max(1u, batch_size);
+	this->num_classes = num_classes;
+	this->epochs = epochs;
+	this->capacity = std::max(2u, capacity);
+	slots = std::unique_ptr<Slot[]>(new Slot[this->capacity]);
+	for (unsigned int i = 0; i < this->capacity; i++) {
+		slots[i].sequence = i;
+		//the buffers are allocated once and refilled for every batch
+		slots[i].batch.inputs.resize(this->batch_size * dataset.getSampleSize());
+		slots[i].batch.targets.resize(this->batch_size * num_classes);
+		slots[i].batch.labels.resize(this->batch_size);
+	}
+	for (unsigned int i = 0; i < std::max(1u, num_workers); i++) {
+		workers.push_back(std::thread(&BatchPrefetcher::workerLoop, this));
+	}
+}
+
+bool BatchPrefetcher::claimBatch(unsigned long &sequence, std::vector<unsigned int> &indices, unsigned int &epoch) {
+	std::lock_guard<std::mutex> lock(sampler_mutex);
+	if (sampling_finished) {
+		return false;
+	}
+	if (!sampler.hasNext() && ((epochs == 0) || (sampler.getEpoch() + 1 < epochs))) {
+		sampler.startEpoch();
+	}
+	epoch = sampler.getEpoch();
+	if (sampler.nextBatch(batch_size, indices) == 0) {
+		//the empty batch tells the consumer that all epochs are done
+		sampling_finished = true;
+	}
+	sequence = next_sequence++;
+	return true;
+}
+
+void BatchPrefetcher::fillBatch(Batch &batch, const std::vector<unsigned int> &indices, unsigned int epoch) const {
+	batch.size = indices.size();
+	batch.epoch = epoch;
+	//shrinking and regrowing within the capacity reserved by the constructor does not reallocate
+	batch.inputs.resize(batch.size * dataset.getSampleSize());
+	batch.targets.assign(batch.size * num_classes, 0.0f);
+	batch.labels.resize(batch.size);
+	for (unsigned int i = 0; i < indices.size(); i++) {
+		dataset.copySample(indices[i], &batch.inputs[i * dataset.getSampleSize()]);
+		uint8_t label = dataset.getLabel(indices[i]);
+		batch.labels[i] = label;
+		if (label < num_classes) batch.targets[i * num_classes + label] = 1.0f;
+	}
+}
+
+bool BatchPrefetcher::waitForSequence(Slot &slot, unsigned long sequence) {
+	//a slot is usually handed over quickly, a full or empty ring is waited for sleeping
+	for (unsigned int i = 0; i < PREFETCHSPINS; i++) {
+		if (slot.sequence.load(std::memory_order_acquire) == sequence) return true;
+		if (stopping.load(std::memory_order_relaxed)) return false;
+		std::this_thread::yield();
+	}
+	//parked and the sequence numbers are sequentially consistent, so wakeParked() either sees this thread or it sees the new sequence
+	std::unique_lock<std::mutex> lock(park_mutex);
+	parked++;
+	park_condition.wait(lock, [&]() {
+		return (slot.sequence.load() == sequence) || stopping.load();
+	});
+	parked--;
+	return slot.sequence.load(std::memory_order_acquire) == sequence;
+}
+
+void BatchPrefetcher::wakeParked() {
+	if (parked.load() > 0) {
+		std::lock_guard<std::mutex> lock(park_mutex);
+		park_condition.notify_all();
+	}
+}
+
+void BatchPrefetcher::workerLoop() {
+	std::vector<unsigned int> indices;
+	unsigned long sequence = 0;
+	unsigned int epoch = 0;
+	while (!stopping.load(std::memory_order_relaxed) && claimBatch(sequence, indices, epoch)) {
+		Slot &slot = slots[sequence % capacity];
+		//wait until the consumer has released the batch that used this slot one round earlier
+		if (!waitForSequence(slot, sequence)) return;
+		fillBatch(slot.batch, indices, epoch);
+		slot.sequence.store(sequence + 1);
+		wakeParked();
+	}
+}
+
+const BatchPrefetcher::Batch *BatchPrefetcher::acquire() {
+	if (consumer_holds_slot) {
+		release();
+	}
+	Slot &slot = slots[consumer_sequence % capacity];
+	waitForSequence(slot, consumer_sequence + 1);
+	if (slot.batch.size == 0) {
+		//the end marker is never released, so further calls return here as well
+		return nullptr;
+	}
+	consumer_holds_slot = true;
+	return &slot.batch;
+}
+
+void BatchPrefetcher::release() {
+	if (consumer_holds_slot) {
+		slots[consumer_sequence % capacity].sequence.store(consumer_sequence + capacity);
+		consumer_sequence++;
+		consumer_holds_slot = false;
+		wakeParked();
+	}
+}
+
+BatchPrefetcher::~BatchPrefetcher() {
+	stopping = true;
+	{
+		std::lock_guard<std::mutex> lock(park_mutex);
+		park_condition.notify_all();
+	}
+	for (unsigned int i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+}
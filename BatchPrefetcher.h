@@ -0,0 +1,76 @@
+/*
+ * BatchPrefetcher.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef BATCHPREFETCHER_H_
+#define BATCHPREFETCHER_H_
+
+#include "ImageDataset.h"
+#include "EpochSampler.h"
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+/* Assembles mini-batches (inputs and one-hot targets) on worker threads ahead of the training loop.
+ * Finished batches are passed through a bounded ring: every slot carries a sequence number telling whether it is
+ * free for the producer of batch s (sequence == s) or ready for the consumer (sequence == s + 1), so handing over
+ * a batch needs no lock. Batches are consumed in sampling order, no matter which worker filled them.
+ * A producer or the consumer that finds its slot busy spins briefly and then sleeps until a batch is published or released.
+ * The ring holds at least two slots, with one slot the free and ready sequence numbers would be the same.
+ * Only one thread may call acquire() and release(). */
+class BatchPrefetcher {
+public:
+	struct Batch {
+		std::vector<float> inputs; //size samples with getSampleSize() floats each
+		std::vector<float> targets; //size one-hot vectors with num_classes floats each
+		std::vector<uint8_t> labels;
+		unsigned int size = 0; //0 marks the end of the last epoch
+		unsigned int epoch = 0;
+	};
+private:
+	struct Slot {
+		std::atomic<unsigned long> sequence;
+		Batch batch;
+	};
+	const ImageDataset &dataset;
+	unsigned int batch_size = 0;
+	unsigned int num_classes = 0;
+	unsigned int capacity = 0;
+	unsigned int epochs = 0; //0 runs until destruction
+	std::unique_ptr<Slot[]> slots;
+	EpochSampler sampler;
+	std::mutex sampler_mutex; //guards sampler, next_sequence and sampling_finished
+	unsigned long next_sequence = 0; //next batch to be claimed by a worker
+	bool sampling_finished = false;
+	unsigned long consumer_sequence = 0;
+	bool consumer_holds_slot = false;
+	std::atomic<bool> stopping;
+	std::mutex park_mutex; //only taken to sleep and to wake the sleeping threads
+	std::condition_variable park_condition;
+	std::atomic<unsigned int> parked; //threads sleeping on park_condition
+	std::vector<std::thread> workers;
+	void workerLoop();
+	bool waitForSequence(Slot &slot, unsigned long sequence);
+	void wakeParked();
+	bool claimBatch(unsigned long &sequence, std::vector<unsigned int> &indices, unsigned int &epoch);
+	void fillBatch(Batch &batch, const std::vector<unsigned int> &indices, unsigned int epoch) const;
+public:
+	/* The data set should be materialized, otherwise every sample is converted from the mapped file by the workers.
+	 * A capacity below 2 is raised to 2. */
+	BatchPrefetcher(const ImageDataset &dataset, unsigned int batch_size, unsigned int num_classes, unsigned int epochs,
+			unsigned int seed, unsigned int num_workers = 1, unsigned int capacity = 4, bool stratified = true);
+	BatchPrefetcher(const BatchPrefetcher &) = delete;
+	BatchPrefetcher &operator=(const BatchPrefetcher &) = delete;
+	/* Waits for the next batch, returns nullptr after the last epoch. The batch stays valid until release(). */
+	const Batch *acquire();
+	/* Hands the slot of the acquired batch back to the workers. */
+	void release();
+	virtual ~BatchPrefetcher();
+};
+
+#endif /* BATCHPREFETCHER_H_ */
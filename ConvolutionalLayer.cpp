@@ -9,20 +9,38 @@
 #include "RandomGenerator.h"
 #include "OpenCLInterface.h"
 #include "Logger.h"
+#include "ThreadPool.h"
 #include <algorithm>
 #include <iostream>
 
+#define CONVREDUCEGROUP 64 //work items reducing one tile of the weight gradient, a power of two
+#define CONVREDUCEPAIRS 16 //(sample, output position) pairs per work item and tile of the weight gradient
+#define CONVGEMMTILE 16 //tile size of the GEMM path
+#define CONVGEMMMINTAPS 9 //smaller filters hardly overlap, lowering them only copies the inputs
+#define CONVGEMMMINMAPS 4 //fewer output maps reuse a tile of lowered inputs too rarely
+#define CONVGEMMMINCOLUMNS 1024 //output positions of the whole batch needed to fill the work groups
+
 namespace clneural {
 
+ConvolutionalLayer::ConvolutionKernel ConvolutionalLayer::convolution_kernel = ConvolutionalLayer::ConvolutionKernel::AUTOMATIC_KERNEL;
+
+/* Compiled with INFERENCE_ONLY defined the netsums are neither taken nor stored. */
 const std::string ConvolutionalLayer::fwclcode = "__kernel void computeOutput(__global const float *inputs, __global const float *weights, \n"
-		"__global float *outputs, __global float *netsums, __global const unsigned int *input_connections, __global const unsigned int *input_connection_indices, \n"
-		"unsigned int inp_width, unsigned int inp_height, unsigned int filter_width, unsigned int filter_height) {\n"
+		"__global float *outputs, \n"
+		"#ifndef INFERENCE_ONLY\n"
+		"__global float *netsums, \n"
+		"#endif\n"
+		"__global const unsigned int *input_connections, __global const unsigned int *input_connection_indices, \n"
+		"unsigned int inp_width, unsigned int inp_height, unsigned int filter_width, unsigned int filter_height, unsigned int num_inputs) {\n"
 		"unsigned int output_id = get_global_id(0);\n"
+		"unsigned int sample_id = get_global_id(1);\n"
+		"unsigned int num_outputs = get_global_size(0);\n"
 		"unsigned int output_feature_map_size = (inp_width - filter_width + 1) * (inp_height - filter_height + 1);\n"
 		"unsigned int input_feature_map_size = inp_width * inp_height;\n"
 		"unsigned int output_feature_map_id = output_id / output_feature_map_size;\n"
 		"unsigned int output_x = (output_id % output_feature_map_size) % (inp_width - filter_width + 1);\n"
 		"unsigned int output_y = (output_id % output_feature_map_size) / (inp_width - filter_width + 1);\n"
+		"__global const float *sample = inputs + sample_id * num_inputs;\n"
 		"float sum = 0.0f;\n"
 		"for (unsigned int i = 0; i < input_connection_indices[output_feature_map_id + 1] - input_connection_indices[output_feature_map_id]; i++) {\n"
 		"unsigned int input_feature_map_id = input_connections[input_connection_indices[output_feature_map_id] + i];\n"
@@ -30,20 +48,24 @@ const std::string ConvolutionalLayer::fwclcode = "__kernel void computeOutput(__
 		"for (unsigned int x = 0; x < filter_width; x++) {\n"
 		"unsigned int inp_x = output_x + x;\n"
 		"unsigned int inp_y = output_y + y;\n"
-		"sum += inputs[input_feature_map_id * input_feature_map_size + inp_y * inp_width + inp_x] * weights[(input_connection_indices[output_feature_map_id] + i) * (filter_width * filter_height) + output_feature_map_id + y*filter_width + x];\n"
+		"sum += sample[input_feature_map_id * input_feature_map_size + inp_y * inp_width + inp_x] * weights[(input_connection_indices[output_feature_map_id] + i) * (filter_width * filter_height) + output_feature_map_id + y*filter_width + x];\n"
 		"}\n"
 		"}\n"
 		"}\n"
 		"sum += weights[input_connection_indices[output_feature_map_id + 1]*(filter_width*filter_height) + output_feature_map_id];\n"
-		"netsums[output_id] = sum;\n"
-		"outputs[output_id] = activationFunction(sum);\n"
+		"#ifndef INFERENCE_ONLY\n"
+		"netsums[sample_id * num_outputs + output_id] = sum;\n"
+		"#endif\n"
+		"outputs[sample_id * num_outputs + output_id] = activationFunction(sum);\n"
 		"}\n";
 
 const std::string ConvolutionalLayer::fberrorclcode = "__kernel void computeNextError(__global const float *error, __global const float *netsums,\n"
 		"__global const float *weights, __global float *nexterror, __global const unsigned int *output_connections, \n"
 		"__global const unsigned int *output_connection_indices, __global const unsigned int *output_weight_indices, \n"
-		"unsigned int inp_width, unsigned int inp_height, unsigned int filter_width, unsigned int filter_height) {\n"
+		"unsigned int inp_width, unsigned int inp_height, unsigned int filter_width, unsigned int filter_height, unsigned int num_outputs) {\n"
 		"unsigned int input_id = get_global_id(0);\n"
+		"unsigned int sample_id = get_global_id(1);\n"
+		"unsigned int num_inputs = get_global_size(0);\n"
 		"unsigned int input_feature_map_size = inp_width * inp_height;\n"
 		"unsigned int output_feature_map_size = (inp_width - filter_width + 1) * (inp_height - filter_height + 1);\n"
 		"unsigned int input_feature_map_id = input_id / input_feature_map_size;\n"
@@ -57,47 +79,167 @@ const std::string ConvolutionalLayer::fberrorclcode = "__kernel void computeNext
 		"int output_x = inp_x - x;\n"
 		"int output_y = inp_y - y;\n"
 		"if ((output_x >= 0) && (output_y >= 0) && (output_x < (inp_width - filter_width + 1)) && (output_y < (inp_height - filter_height + 1))) {\n"
-		"unsigned int output_id = output_feature_map_id * output_feature_map_size + output_y * (inp_width - filter_width + 1) + output_x;"
+		"unsigned int output_id = sample_id * num_outputs + output_feature_map_id * output_feature_map_size + output_y * (inp_width - filter_width + 1) + output_x;"
 		"float delta = activationDerivate(netsums[output_id]) * error[output_id];\n"
 		"sum += weights[output_weight_indices[output_connection_indices[input_feature_map_id] + i] + y * filter_width + x] * delta;\n"
 		"}\n"
 		"}\n"
 		"}\n"
 		"}\n"
-		"nexterror[input_id] = sum;\n"
+		"nexterror[sample_id * num_inputs + input_id] = sum;\n"
 		"}\n";
 
-const std::string ConvolutionalLayer::fbweightsclcode = "__kernel void computeWeights(__global const float *error, __global const float *last_inputs, \n"
-		"__global const float *netsums, __global float *weights, __global const unsigned int *weight_output_maps, __global const unsigned int *input_connections, \n"
+/* Weight gradient as a 2D range over (output tile, weight): the (sample, output position) pairs of the weight's output map are split
+ * into tiles of tile_size pairs, each handled by a group of REDUCE_GROUP work items that add every REDUCE_GROUP-th pair and reduce
+ * their sums in local memory. Neighbouring work items read neighbouring outputs and inputs. accumulateWeights adds the sums of
+ * all tiles to the weight in tile order. */
+const std::string ConvolutionalLayer::fbweightsclcode = "__kernel __attribute__((reqd_work_group_size(REDUCE_GROUP, 1, 1)))\n"
+		"void computeWeightGradients(__global const float *error, __global const float *last_inputs, \n"
+		"__global const float *netsums, __global float *partial_sums, __global const unsigned int *weight_output_maps, __global const unsigned int *input_connections, \n"
 		" __global const unsigned int *input_connection_indices, unsigned int inp_width, unsigned int inp_height, unsigned int filter_width, \n"
-		"unsigned int filter_height, float learning_rate) {\n"
-		"unsigned int weight_id = get_global_id(0);\n"
+		"unsigned int filter_height, float learning_rate, unsigned int num_inputs, unsigned int num_outputs, unsigned int batch_size, unsigned int tile_size) {\n"
+		"__local float sums[REDUCE_GROUP];\n"
+		"unsigned int local_id = get_local_id(0);\n"
+		"unsigned int tile_id = get_group_id(0);\n"
+		"unsigned int weight_id = get_global_id(1);\n"
 		"unsigned int input_feature_map_size = inp_width * inp_height;\n"
-		"unsigned int output_feature_map_size = (inp_width - filter_width + 1) * (inp_height - filter_height + 1);\n"
+		"unsigned int output_width = inp_width - filter_width + 1;\n"
+		"unsigned int output_feature_map_size = output_width * (inp_height - filter_height + 1);\n"
 		"unsigned int output_feature_map_id = weight_output_maps[weight_id];\n"
 		"int weight_x = -1;\n"
 		"int weight_y = -1;\n"
 		"unsigned int weight_startindex = filter_height * filter_width * input_connection_indices[output_feature_map_id] + output_feature_map_id;\n"
-		"unsigned int input_map_offset = (weight_id % weight_startindex) / (filter_height * filter_width);\n"
+		"unsigned int input_map_offset = (weight_id - weight_startindex) / (filter_height * filter_width);\n"
 		"if (weight_id != input_connection_indices[output_feature_map_id + 1] * filter_height * filter_width + output_feature_map_id){\n"
 		"weight_y = ((weight_id - weight_startindex) % (filter_height * filter_width)) / filter_width;\n"
 		"weight_x = ((weight_id - weight_startindex) % (filter_height * filter_width)) % filter_width;\n"
 		"}\n"
+		"__global const float *map = last_inputs;\n"
+		"if (weight_x >= 0) map += input_connections[input_connection_indices[output_feature_map_id] + input_map_offset] * input_feature_map_size + weight_y * inp_width + weight_x;\n"
+		"unsigned int end = min(tile_id * tile_size + tile_size, batch_size * output_feature_map_size);\n"
 		"float delta = 0.0f;\n"
-		"for (unsigned int output_y = 0; output_y < (inp_height - filter_height + 1); output_y++) {\n"
-		"for (unsigned int output_x = 0; output_x < (inp_height - filter_height + 1); output_x++) {\n"
-		"unsigned int output_id = output_feature_map_id * output_feature_map_size + output_y * (inp_width - filter_width + 1) + output_x;\n"
+		"for (unsigned int pair = tile_id * tile_size + local_id; pair < end; pair += REDUCE_GROUP) {\n"
+		"unsigned int sample_id = pair / output_feature_map_size;\n"
+		"unsigned int position = pair % output_feature_map_size;\n"
+		"unsigned int output_id = sample_id * num_outputs + output_feature_map_id * output_feature_map_size + position;\n"
 		"float last_input = 1.0f;\n"
-		"if (weight_x > 0) {\n"
-		"unsigned int input_id = input_connections[input_connection_indices[output_feature_map_id] + input_map_offset] * input_feature_map_size + (output_y + weight_y) * inp_width + (output_x + weight_x);\n"
-		"last_input = last_inputs[input_id];\n"
+		"if (weight_x >= 0) {\n"
+		"last_input = map[sample_id * num_inputs + (position / output_width) * inp_width + position % output_width];\n"
 		"}\n"
 		"delta += learning_rate * error[output_id] * activationDerivate(netsums[output_id]) * last_input;\n"
 		"}\n"
+		"sums[local_id] = delta;\n"
+		"barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"for (unsigned int stride = REDUCE_GROUP / 2; stride > 0; stride /= 2) {\n"
+		"if (local_id < stride) sums[local_id] += sums[local_id + stride];\n"
+		"barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"}\n"
+		"if (local_id == 0) partial_sums[weight_id * get_num_groups(0) + tile_id] = sums[0];\n"
+		"}\n"
+		"__kernel void accumulateWeights(__global float *weights, __global const float *partial_sums, unsigned int num_tiles) {\n"
+		"unsigned int weight_id = get_global_id(0);\n"
+		"float delta = 0.0f;\n"
+		"for (unsigned int i = 0; i < num_tiles; i++) {\n"
+		"delta += partial_sums[weight_id * num_tiles + i];\n"
 		"}\n"
 		"weights[weight_id] += delta;\n"
 		"}\n";
 
+/* GEMM path: c = a * b in GEMM_TILE x GEMM_TILE tiles staged in local memory, one work item per element of c.
+ * LOAD_A(row, k), LOAD_B(k, column) and STORE(row, column, value) are defined when compiling and map the matrices to the buffers.
+ * MAP(map, column) is where an element of a feature map lies in a batch, for columns numbering the map positions sample by sample. */
+const std::string ConvolutionalLayer::gemmclcode = "#define MAP(map, column) (((column) / map_size) * map_stride + (map) * map_size + (column) % map_size)\n"
+		"__kernel __attribute__((reqd_work_group_size(GEMM_TILE, GEMM_TILE, 1)))\n"
+		"void multiplyTiled(__global const float *a, __global const float *b, __global float *c, \n"
+		"#ifdef STORE_NETSUMS\n"
+		"__global float *netsums, \n"
+		"#endif\n"
+		"unsigned int rows, unsigned int columns, unsigned int depth, unsigned int map_size, unsigned int map_stride) {\n"
+		"__local float a_tile[GEMM_TILE][GEMM_TILE];\n"
+		"__local float b_tile[GEMM_TILE][GEMM_TILE];\n"
+		"unsigned int local_x = get_local_id(0);\n"
+		"unsigned int local_y = get_local_id(1);\n"
+		"unsigned int column = get_global_id(0);\n"
+		"unsigned int row = get_global_id(1);\n"
+		"float sum = 0.0f;\n"
+		"for (unsigned int offset = 0; offset < depth; offset += GEMM_TILE) {\n"
+		"a_tile[local_y][local_x] = ((row < rows) && (offset + local_x < depth)) ? LOAD_A(row, offset + local_x) : 0.0f;\n"
+		"b_tile[local_y][local_x] = ((offset + local_y < depth) && (column < columns)) ? LOAD_B(offset + local_y, column) : 0.0f;\n"
+		"barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"for (unsigned int k = 0; k < GEMM_TILE; k++) {\n"
+		"sum += a_tile[local_y][k] * b_tile[k][local_x];\n"
+		"}\n"
+		"barrier(CLK_LOCAL_MEM_FENCE);\n"
+		"}\n"
+		"if ((row < rows) && (column < columns)) {\n"
+		"STORE(row, column, sum);\n"
+		"}\n"
+		"}\n";
+
+/* GEMM path, im2col: one row per (input map, filter position) and a last row of ones for the bias,
+ * one column per (sample, output position), one work item per element. */
+const std::string ConvolutionalLayer::expandclcode = "__kernel void expandInputs(__global const float *inputs, __global float *lowered, \n"
+		"unsigned int inp_width, unsigned int inp_height, unsigned int filter_width, unsigned int filter_height, unsigned int num_inputs) {\n"
+		"unsigned int column = get_global_id(0);\n"
+		"unsigned int row = get_global_id(1);\n"
+		"unsigned int num_columns = get_global_size(0);\n"
+		"float value = 1.0f;\n"
+		"if (row + 1 < get_global_size(1)) {\n"
+		"unsigned int output_width = inp_width - filter_width + 1;\n"
+		"unsigned int output_feature_map_size = output_width * (inp_height - filter_height + 1);\n"
+		"unsigned int position = column % output_feature_map_size;\n"
+		"unsigned int tap = row % (filter_width * filter_height);\n"
+		"unsigned int inp_x = position % output_width + tap % filter_width;\n"
+		"unsigned int inp_y = position / output_width + tap / filter_width;\n"
+		"value = inputs[(column / output_feature_map_size) * num_inputs + (row / (filter_width * filter_height)) * inp_width * inp_height + inp_y * inp_width + inp_x];\n"
+		"}\n"
+		"lowered[row * num_columns + column] = value;\n"
+		"}\n";
+
+/* GEMM path, col2im: sums the errors of all lowered copies of an input, one work item per (input, sample). */
+const std::string ConvolutionalLayer::collectclcode = "__kernel void collectErrors(__global const float *lowered, __global float *nexterror, \n"
+		"unsigned int inp_width, unsigned int inp_height, unsigned int filter_width, unsigned int filter_height, unsigned int num_columns) {\n"
+		"unsigned int input_id = get_global_id(0);\n"
+		"unsigned int sample_id = get_global_id(1);\n"
+		"unsigned int num_inputs = get_global_size(0);\n"
+		"unsigned int input_feature_map_size = inp_width * inp_height;\n"
+		"int output_width = inp_width - filter_width + 1;\n"
+		"int output_height = inp_height - filter_height + 1;\n"
+		"unsigned int input_feature_map_id = input_id / input_feature_map_size;\n"
+		"int inp_x = (input_id % input_feature_map_size) % inp_width;\n"
+		"int inp_y = (input_id % input_feature_map_size) / inp_width;\n"
+		"float sum = 0.0f;\n"
+		"for (int y = filter_height - 1; y >= 0; y--) {\n"
+		"for (int x = filter_width - 1; x >= 0; x--) {\n"
+		"int output_x = inp_x - x;\n"
+		"int output_y = inp_y - y;\n"
+		"if ((output_x >= 0) && (output_y >= 0) && (output_x < output_width) && (output_y < output_height)) {\n"
+		"unsigned int row = input_feature_map_id * filter_width * filter_height + y * filter_width + x;\n"
+		"sum += lowered[row * num_columns + sample_id * output_width * output_height + output_y * output_width + output_x];\n"
+		"}\n"
+		"}\n"
+		"}\n"
+		"nexterror[sample_id * num_inputs + input_id] = sum;\n"
+		"}\n";
+
+/* GEMM path: moves the weights between their layout and the dense matrix, one work item per weight.
+ * computeDeltas evaluates delta = error * act'(netsum) once for both products of the error pass. */
+const std::string ConvolutionalLayer::packclcode = "__kernel void packWeights(__global const float *weights, __global float *packed, __global const unsigned int *packed_indices) {\n"
+		"unsigned int weight_id = get_global_id(0);\n"
+		"packed[packed_indices[weight_id]] = weights[weight_id];\n"
+		"}\n"
+		"__kernel void adaptPackedWeights(__global float *weights, __global const float *gradient, __global const unsigned int *packed_indices, float learning_rate) {\n"
+		"unsigned int weight_id = get_global_id(0);\n"
+		"weights[weight_id] += learning_rate * gradient[packed_indices[weight_id]];\n"
+		"}\n"
+		"#ifdef DELTAS\n"
+		"__kernel void computeDeltas(__global const float *error, __global const float *netsums, __global float *deltas) {\n"
+		"unsigned int id = get_global_id(0);\n"
+		"deltas[id] = error[id] * activationDerivate(netsums[id]);\n"
+		"}\n"
+		"#endif\n";
+
+const NeuralNetworkLayerRegisterHelper<ConvolutionalLayer> ConvolutionalLayer::reg("ConvolutionalLayer");
 
 ConvolutionalLayer::ConvolutionalLayer(Dimension input_maps, Dimension filter, const std::vector<std::list<unsigned int>> &input_to_output,
 		std::shared_ptr<ActivationFunction> act, float learning) :
@@ -145,47 +287,108 @@ ConvolutionalLayer::ConvolutionalLayer(Dimension input_maps, Dimension filter, c
 	num_input_maps = output_to_input.size();
 }
 
-bool ConvolutionalLayer::initializeMemoryObjects(std::shared_ptr<OpenCLInterface> ocl) {
+bool ConvolutionalLayer::initializeMemoryObjects(std::shared_ptr<OpenCLInterface> ocl, unsigned int batch_size, bool training) {
+	if (batch_size > batch_capacity) {
+		freeBatchMemoryObjects(ocl);
+		batch_capacity = batch_size;
+	}
 	if (wmemid < 0) {
 		wmemid = ocl->allocateMemoryObject((void *) &weights[0], weights.size() * sizeof(float), CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
 	}
-	if (womemid < 0) {
-		womemid = ocl->allocateMemoryObject((void *) &weight_output_maps[0],  weight_output_maps.size() * sizeof(unsigned int), CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
-	}
 	if (imemid < 0) {
-		imemid = ocl->allocateMemoryObject(NULL, num_inputs * sizeof(float), CL_MEM_READ_WRITE);
+		imemid = ocl->allocateMemoryObject(NULL, num_inputs * batch_capacity * sizeof(float), CL_MEM_READ_WRITE);
 	}
 	if (oememid < 0) {
-		oememid = ocl->allocateMemoryObject(NULL, num_outputs * sizeof(float), CL_MEM_WRITE_ONLY);
+		oememid = ocl->allocateMemoryObject(NULL, num_outputs * batch_capacity * sizeof(float), CL_MEM_READ_WRITE);
+	}
+	if (icmemid < 0) {
+		icmemid = ocl->allocateMemoryObject((void *) &input_connections[0], input_connections.size() * sizeof(unsigned int), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
+	}
+	if (icimemid < 0) {
+		icimemid = ocl->allocateMemoryObject((void *) &input_connection_indices[0], input_connection_indices.size() * sizeof(unsigned int), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
+	}
+	if ((wmemid < 0) || (imemid < 0) || (oememid < 0) || (icmemid < 0) || (icimemid < 0)) {
+		return false;
+	}
+	if (!training) {
+		return true;
+	}
+	if (womemid < 0) {
+		womemid = ocl->allocateMemoryObject((void *) &weight_output_maps[0],  weight_output_maps.size() * sizeof(unsigned int), CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
+	}
+	if (ememid < 0) {
+		ememid = ocl->allocateMemoryObject(NULL, num_outputs * batch_capacity * sizeof(float), CL_MEM_READ_ONLY);
 	}
 	if (smemid < 0) {
-		smemid = ocl->allocateMemoryObject(NULL, num_outputs * sizeof(float), CL_MEM_READ_WRITE);
+		smemid = ocl->allocateMemoryObject(NULL, num_outputs * batch_capacity * sizeof(float), CL_MEM_READ_WRITE);
 	}
 	if (nememid < 0) {
-		nememid = ocl->allocateMemoryObject(NULL, num_inputs * sizeof(float), CL_MEM_WRITE_ONLY);
-	}
-	if (icmemid < 0) {
-		icmemid = ocl->allocateMemoryObject((void *) &input_connections[0], input_connections.size() * sizeof(unsigned int), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
+		nememid = ocl->allocateMemoryObject(NULL, num_inputs * batch_capacity * sizeof(float), CL_MEM_READ_WRITE);
 	}
 	if (ocmemid < 0) {
 		ocmemid = ocl->allocateMemoryObject((void *) &output_connections[0], output_connections.size() * sizeof(unsigned int), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
 	}
-	if (icimemid < 0) {
-		icimemid = ocl->allocateMemoryObject((void *) &input_connection_indices[0], input_connection_indices.size() * sizeof(unsigned int), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
-	}
 	if (ocimemid < 0) {
 		ocimemid = ocl->allocateMemoryObject((void *) &output_connection_indices[0], output_connection_indices.size() * sizeof(unsigned int), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
 	}
 	if (owimemid < 0) {
 		owimemid = ocl->allocateMemoryObject((void *) &output_weight_indices[0], output_weight_indices.size() * sizeof(unsigned int), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR);
 	}
-	if ((wmemid < 0) || (womemid < 0) || (imemid < 0) || (oememid < 0) || (smemid < 0) || (nememid < 0) || (icmemid < 0) || (ocmemid < 0) || (icimemid < 0) || (ocimemid < 0) || (owimemid < 0)) {
+	if (rmemid < 0) {
+		unsigned int tile_size = CONVREDUCEGROUP * CONVREDUCEPAIRS;
+		unsigned int num_tiles = ((num_outputs / num_output_maps) * batch_capacity + tile_size - 1) / tile_size;
+		rmemid = ocl->allocateMemoryObject(NULL, weight_output_maps.size() * num_tiles * sizeof(float), CL_MEM_READ_WRITE);
+	}
+	if ((womemid < 0) || (ememid < 0) || (smemid < 0) || (nememid < 0) || (ocmemid < 0) || (ocimemid < 0) || (owimemid < 0) || (rmemid < 0)) {
 		return false;
 	}
 	return true;
 }
 
-bool ConvolutionalLayer::initializeKernelObjects(std::shared_ptr<OpenCLInterface> ocl) {
+void ConvolutionalLayer::freeBatchMemoryObjects(std::shared_ptr<OpenCLInterface> ocl) {
+	if (imemid >= 0) {
+		ocl->freeMemoryObject(imemid);
+		imemid = -1;
+	}
+	if (oememid >= 0) {
+		ocl->freeMemoryObject(oememid);
+		oememid = -1;
+	}
+	if (ememid >= 0) {
+		ocl->freeMemoryObject(ememid);
+		ememid = -1;
+	}
+	if (smemid >= 0) {
+		ocl->freeMemoryObject(smemid);
+		smemid = -1;
+	}
+	if (nememid >= 0) {
+		ocl->freeMemoryObject(nememid);
+		nememid = -1;
+	}
+	if (rmemid >= 0) {
+		ocl->freeMemoryObject(rmemid);
+		rmemid = -1;
+	}
+	if (pcmemid >= 0) {
+		ocl->freeMemoryObject(pcmemid);
+		pcmemid = -1;
+	}
+	if (pdmemid >= 0) {
+		ocl->freeMemoryObject(pdmemid);
+		pdmemid = -1;
+	}
+	last_pass_gemm = false;
+}
+
+bool ConvolutionalLayer::initializeKernelObjects(std::shared_ptr<OpenCLInterface> ocl, bool training) {
+	if (!training) {
+		if (oikid < 0) {
+			std::string code = "#define INFERENCE_ONLY\n" + act->getCode() + fwclcode;
+			oikid = ocl->createKernelFromSource(code, "computeOutput");
+		}
+		return (oikid >= 0);
+	}
 	if (okid < 0) {
 		std::string code = act->getCode() + fwclcode;
 		okid = ocl->createKernelFromSource(code, "computeOutput");
@@ -195,39 +398,331 @@ bool ConvolutionalLayer::initializeKernelObjects(std::shared_ptr<OpenCLInterface
 		fberrorkid = ocl->createKernelFromSource(code, "computeNextError");
 	}
 	if (fbweightskid < 0) {
-		std::string code = act->getDerivCode() + fbweightsclcode;
-		fbweightskid = ocl->createKernelFromSource(code, "computeWeights");
+		std::string code = "#define REDUCE_GROUP " + std::to_string(CONVREDUCEGROUP) + "\n" + act->getDerivCode() + fbweightsclcode;
+		fbweightskid = ocl->createKernelFromSource(code, "computeWeightGradients");
 	}
-	if ((okid < 0) || (fberrorkid < 0) || (fbweightskid < 0)) {
+	if (fbaccumulatekid < 0) {
+		std::string code = "#define REDUCE_GROUP " + std::to_string(CONVREDUCEGROUP) + "\n" + act->getDerivCode() + fbweightsclcode;
+		fbaccumulatekid = ocl->createKernelFromSource(code, "accumulateWeights");
+	}
+	if ((okid < 0) || (fberrorkid < 0) || (fbweightskid < 0) || (fbaccumulatekid < 0)) {
 		return false;
 	}
 	return true;
 }
 
-std::vector<float> ConvolutionalLayer::computeOutput(const std::vector<float> &input) {
+void ConvolutionalLayer::setConvolutionKernel(ConvolutionKernel kernel) {
+	ConvolutionalLayer::convolution_kernel = kernel;
+}
+
+ConvolutionalLayer::ConvolutionKernel ConvolutionalLayer::getConvolutionKernel() {
+	return convolution_kernel;
+}
+
+bool ConvolutionalLayer::buildPackedWeightIndices() {
+	if (packed_weight_indices.size() == weight_output_maps.size()) {
+		return true;
+	} else if (gemm_unavailable) {
+		return false;
+	}
+	unsigned int filter_size = filter.width * filter.height;
+	unsigned int packed_width = num_input_maps * filter_size + 1;
+	std::vector<unsigned int> indices(weight_output_maps.size());
+	std::vector<bool> used(num_output_maps * packed_width, false);
+	for (unsigned int output_feature_map_id = 0; output_feature_map_id < num_output_maps; output_feature_map_id++) {
+		for (unsigned int c = input_connection_indices[output_feature_map_id]; c < input_connection_indices[output_feature_map_id + 1]; c++) {
+			unsigned int packed_start = output_feature_map_id * packed_width + input_connections[c] * filter_size;
+			if (used[packed_start]) {
+				Logger::writeLine("ConvolutionalLayer::buildPackedWeightIndices(): Input map connected twice, the GEMM path is not available.");
+				gemm_unavailable = true;
+				return false;
+			}
+			for (unsigned int i = 0; i < filter_size; i++) {
+				indices[c * filter_size + output_feature_map_id + i] = packed_start + i;
+				used[packed_start + i] = true;
+			}
+		}
+		indices[input_connection_indices[output_feature_map_id + 1] * filter_size + output_feature_map_id] = (output_feature_map_id + 1) * packed_width - 1;
+	}
+	packed_weight_indices = indices;
+	return true;
+}
+
+bool ConvolutionalLayer::useGemm(unsigned int batch_size) {
+	if (convolution_kernel == ConvolutionKernel::DIRECT_KERNEL) {
+		return false;
+	} else if (!buildPackedWeightIndices()) {
+		return false;
+	} else if (convolution_kernel == ConvolutionKernel::GEMM_KERNEL) {
+		return true;
+	}
+	unsigned int output_feature_map_size = num_outputs / num_output_maps;
+	//the dense matrix multiplies zeros for maps that are not connected, at least half of them have to be
+	bool dense = (2 * input_connections.size() >= num_output_maps * num_input_maps);
+	return dense && (filter.width * filter.height >= CONVGEMMMINTAPS) && (num_output_maps >= CONVGEMMMINMAPS) && (output_feature_map_size * batch_size >= CONVGEMMMINCOLUMNS);
+}
+
+bool ConvolutionalLayer::initializeGemmObjects(std::shared_ptr<OpenCLInterface> ocl, bool training) {
+	unsigned int filter_size = filter.width * filter.height;
+	unsigned int packed_width = num_input_maps * filter_size + 1;
+	unsigned int num_columns = (num_outputs / num_output_maps) * batch_capacity;
+	if (pwmemid < 0) {
+		//only the connected positions are written by packWeights, the others stay zero
+		std::vector<float> zeros(num_output_maps * packed_width, 0.0f);
+		pwmemid = ocl->allocateMemoryObject((void *) &zeros[0], zeros.size() * sizeof(float), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR);
+	}
+	if (pwimemid < 0) {
+		pwimemid = ocl->allocateMemoryObject((void *) &packed_weight_indices[0], packed_weight_indices.size() * sizeof(unsigned int), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR);
+	}
+	if (pcmemid < 0) {
+		pcmemid = ocl->allocateMemoryObject(NULL, packed_width * num_columns * sizeof(float), CL_MEM_READ_WRITE);
+	}
+	std::string tile = "#define GEMM_TILE " + std::to_string(CONVGEMMTILE) + "\n";
+	if (ppackkid < 0) {
+		ppackkid = ocl->createKernelFromSource(packclcode, "packWeights");
+	}
+	if (pexpandkid < 0) {
+		pexpandkid = ocl->createKernelFromSource(expandclcode, "expandInputs");
+	}
+	if ((pwmemid < 0) || (pwimemid < 0) || (pcmemid < 0) || (ppackkid < 0) || (pexpandkid < 0)) {
+		return false;
+	}
+	if (!training) {
+		if (poikid < 0) {
+			std::string code = tile + "#define LOAD_A(row, k) a[(row) * depth + (k)]\n"
+									  "#define LOAD_B(k, column) b[(k) * columns + (column)]\n"
+									  "#define STORE(row, column, value) c[MAP(row, column)] = activationFunction(value)\n";
+			poikid = ocl->createKernelFromSource(code + act->getCode() + gemmclcode, "multiplyTiled");
+		}
+		return (poikid >= 0);
+	}
+	if (pgmemid < 0) {
+		pgmemid = ocl->allocateMemoryObject(NULL, num_output_maps * packed_width * sizeof(float), CL_MEM_READ_WRITE);
+	}
+	if (pdmemid < 0) {
+		pdmemid = ocl->allocateMemoryObject(NULL, num_outputs * batch_capacity * sizeof(float), CL_MEM_READ_WRITE);
+	}
+	if (pokid < 0) {
+		std::string code = tile + "#define STORE_NETSUMS\n"
+								  "#define LOAD_A(row, k) a[(row) * depth + (k)]\n"
+								  "#define LOAD_B(k, column) b[(k) * columns + (column)]\n"
+								  "#define STORE(row, column, value) netsums[MAP(row, column)] = value; c[MAP(row, column)] = activationFunction(value)\n";
+		pokid = ocl->createKernelFromSource(code + act->getCode() + gemmclcode, "multiplyTiled");
+	}
+	if (pdeltakid < 0) {
+		pdeltakid = ocl->createKernelFromSource("#define DELTAS\n" + act->getDerivCode() + packclcode, "computeDeltas");
+	}
+	if (pgradientkid < 0) {
+		//deltas (output maps x columns) times the transposed lowered inputs
+		std::string code = tile + "#define LOAD_A(row, k) a[MAP(row, k)]\n"
+								  "#define LOAD_B(k, column) b[(column) * depth + (k)]\n"
+								  "#define STORE(row, column, value) c[(row) * columns + (column)] = value\n";
+		pgradientkid = ocl->createKernelFromSource(code + gemmclcode, "multiplyTiled");
+	}
+	if (perrorkid < 0) {
+		//transposed dense weights times the deltas (output maps x columns)
+		std::string code = tile + "#define LOAD_A(row, k) a[(k) * rows + (row)]\n"
+								  "#define LOAD_B(k, column) b[MAP(k, column)]\n"
+								  "#define STORE(row, column, value) c[(row) * columns + (column)] = value\n";
+		perrorkid = ocl->createKernelFromSource(code + gemmclcode, "multiplyTiled");
+	}
+	if (pcollectkid < 0) {
+		pcollectkid = ocl->createKernelFromSource(collectclcode, "collectErrors");
+	}
+	if (padaptkid < 0) {
+		padaptkid = ocl->createKernelFromSource(packclcode, "adaptPackedWeights");
+	}
+	if ((pgmemid < 0) || (pdmemid < 0) || (pokid < 0) || (pdeltakid < 0) || (pgradientkid < 0) || (perrorkid < 0) || (pcollectkid < 0) || (padaptkid < 0)) {
+		return false;
+	}
+	return true;
+}
+
+bool ConvolutionalLayer::computeGemmOutput(std::shared_ptr<OpenCLInterface> ocl, int memid, unsigned int batch_size, bool training) {
+	unsigned int packed_width = num_input_maps * filter.width * filter.height + 1;
+	unsigned int output_feature_map_size = num_outputs / num_output_maps;
+	unsigned int num_columns = output_feature_map_size * batch_size;
+	//the weights may have changed since the last pass, on the device or on the host
+	OpenCLInterface::Dimension dim;
+	dim.x = weight_output_maps.size();
+	std::vector<std::pair<void *, size_t>> constargs;
+	if (ocl->enqueueKernel(ppackkid, dim, std::vector<int>({wmemid, pwmemid, pwimemid}), constargs) != OpenCLInterface::OpenCLError::SUCCESS) {
+		Logger::writeLine("ConvolutionalLayer::computeGemmOutput(): Error when calling the OpenCL kernel for weight packing.");
+		return false;
+	}
+	dim.x = num_columns;
+	dim.y = packed_width;
+	constargs = std::vector<std::pair<void *, size_t>>({std::make_pair((void *) &input_maps.width, sizeof(unsigned int)),
+														std::make_pair((void*) &input_maps.height, sizeof(unsigned int)),
+														std::make_pair((void*) &filter.width, sizeof(unsigned int)),
+														std::make_pair((void*) &filter.height, sizeof(unsigned int)),
+														std::make_pair((void*) &num_inputs, sizeof(unsigned int))});
+	if (ocl->enqueueKernel(pexpandkid, dim, std::vector<int>({memid, pcmemid}), constargs) != OpenCLInterface::OpenCLError::SUCCESS) {
+		Logger::writeLine("ConvolutionalLayer::computeGemmOutput(): Error when calling the OpenCL kernel for input lowering.");
+		return false;
+	}
+	OpenCLInterface::Dimension local;
+	local.x = CONVGEMMTILE;
+	local.y = CONVGEMMTILE;
+	dim.x = (num_columns + CONVGEMMTILE - 1) / CONVGEMMTILE * CONVGEMMTILE;
+	dim.y = (num_output_maps + CONVGEMMTILE - 1) / CONVGEMMTILE * CONVGEMMTILE;
+	std::vector<int> memargs({pwmemid, pcmemid, oememid, smemid});
+	constargs = std::vector<std::pair<void *, size_t>>({std::make_pair((void *) &num_output_maps, sizeof(unsigned int)),
+														std::make_pair((void*) &num_columns, sizeof(unsigned int)),
+														std::make_pair((void*) &packed_width, sizeof(unsigned int)),
+														std::make_pair((void*) &output_feature_map_size, sizeof(unsigned int)),
+														std::make_pair((void*) &num_outputs, sizeof(unsigned int))});
+	if (!training) memargs.pop_back();
+	if (ocl->enqueueKernel(training ? pokid : poikid, dim, local, memargs, constargs) != OpenCLInterface::OpenCLError::SUCCESS) {
+		Logger::writeLine("ConvolutionalLayer::computeGemmOutput(): Error when calling the OpenCL kernel for output computation.");
+		return false;
+	}
+	return true;
+}
+
+int ConvolutionalLayer::computeGemmError(std::shared_ptr<OpenCLInterface> ocl, int memid, unsigned int batch_size) {
+	unsigned int packed_width = num_input_maps * filter.width * filter.height + 1;
+	unsigned int output_feature_map_size = num_outputs / num_output_maps;
+	unsigned int num_columns = output_feature_map_size * batch_size;
+	OpenCLInterface::Dimension dim;
+	dim.x = num_outputs * batch_size;
+	std::vector<std::pair<void *, size_t>> constargs;
+	if (ocl->enqueueKernel(pdeltakid, dim, std::vector<int>({memid, smemid, pdmemid}), constargs) != OpenCLInterface::OpenCLError::SUCCESS) {
+		Logger::writeLine("ConvolutionalLayer::computeGemmError(): Error when calling the OpenCL kernel for delta computation.");
+		return -1;
+	}
+	OpenCLInterface::Dimension local;
+	local.x = CONVGEMMTILE;
+	local.y = CONVGEMMTILE;
+	dim.x = (packed_width + CONVGEMMTILE - 1) / CONVGEMMTILE * CONVGEMMTILE;
+	dim.y = (num_output_maps + CONVGEMMTILE - 1) / CONVGEMMTILE * CONVGEMMTILE;
+	constargs = std::vector<std::pair<void *, size_t>>({std::make_pair((void *) &num_output_maps, sizeof(unsigned int)),
+														std::make_pair((void*) &packed_width, sizeof(unsigned int)),
+														std::make_pair((void*) &num_columns, sizeof(unsigned int)),
+														std::make_pair((void*) &output_feature_map_size, sizeof(unsigned int)),
+														std::make_pair((void*) &num_outputs, sizeof(unsigned int))});
+	setProfilingLabel("weights");
+	if (ocl->enqueueKernel(pgradientkid, dim, local, std::vector<int>({pdmemid, pcmemid, pgmemid}), constargs) != OpenCLInterface::OpenCLError::SUCCESS) {
+		Logger::writeLine("ConvolutionalLayer::computeGemmError(): Error when calling the OpenCL kernel for gradient computation.");
+		return -1;
+	}
+	//overwrites the lowered inputs the gradient needed, still with the old weights
+	dim.x = (num_columns + CONVGEMMTILE - 1) / CONVGEMMTILE * CONVGEMMTILE;
+	dim.y = (packed_width + CONVGEMMTILE - 1) / CONVGEMMTILE * CONVGEMMTILE;
+	constargs = std::vector<std::pair<void *, size_t>>({std::make_pair((void *) &packed_width, sizeof(unsigned int)),
+														std::make_pair((void*) &num_columns, sizeof(unsigned int)),
+														std::make_pair((void*) &num_output_maps, sizeof(unsigned int)),
+														std::make_pair((void*) &output_feature_map_size, sizeof(unsigned int)),
+														std::make_pair((void*) &num_outputs, sizeof(unsigned int))});
+	setProfilingLabel("error");
+	if (ocl->enqueueKernel(perrorkid, dim, local, std::vector<int>({pwmemid, pdmemid, pcmemid}), constargs) != OpenCLInterface::OpenCLError::SUCCESS) {
+		Logger::writeLine("ConvolutionalLayer::computeGemmError(): Error when calling the OpenCL kernel for next error calculation.");
+		return -1;
+	}
+	dim.x = num_inputs;
+	dim.y = batch_size;
+	constargs = std::vector<std::pair<void *, size_t>>({std::make_pair((void *) &input_maps.width, sizeof(unsigned int)),
+														std::make_pair((void*) &input_maps.height, sizeof(unsigned int)),
+														std::make_pair((void*) &filter.width, sizeof(unsigned int)),
+														std::make_pair((void*) &filter.height, sizeof(unsigned int)),
+														std::make_pair((void*) &num_columns, sizeof(unsigned int))});
+	if (ocl->enqueueKernel(pcollectkid, dim, std::vector<int>({pcmemid, nememid}), constargs) != OpenCLInterface::OpenCLError::SUCCESS) {
+		Logger::writeLine("ConvolutionalLayer::computeGemmError(): Error when calling the OpenCL kernel for error collection.");
+		return -1;
+	}
+	dim.x = weight_output_maps.size();
+	dim.y = 0;
+	constargs = std::vector<std::pair<void *, size_t>>({std::make_pair((void *) &learning, sizeof(float))});
+	setProfilingLabel("weights");
+	if (ocl->enqueueKernel(padaptkid, dim, std::vector<int>({wmemid, pgmemid, pwimemid}), constargs) != OpenCLInterface::OpenCLError::SUCCESS) {
+		Logger::writeLine("ConvolutionalLayer::computeGemmError(): Error when calling the OpenCL kernel for weight adaption.");
+		return -1;
+	}
+	return nememid;
+}
+
+int ConvolutionalLayer::uploadInput(const float *input, unsigned int batch_size, bool training) {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (!ocl->isInitialized()) {
+		return -1;
+	} else if (!initializeKernelObjects(ocl, training)) {
+		Logger::writeLine("ConvolutionalLayer::uploadInput(): Can't initialize kernel.");
+		return -1;
+	} else if (!initializeMemoryObjects(ocl, batch_size, training)) {
+		Logger::writeLine("ConvolutionalLayer::uploadInput(): Can't initialize memory objects.");
+		return -1;
+	} else if (ocl->enqueueWriteMemoryContent(imemid, (const void*) input, num_inputs * batch_size * sizeof(float)) != OpenCLInterface::OpenCLError::SUCCESS) {
+		Logger::writeLine("ConvolutionalLayer::uploadInput(): Unable to write input to the device.");
+		return -1;
+	}
+	return imemid;
+}
+
+bool ConvolutionalLayer::computeDeviceOutput(int memid, unsigned int batch_size, bool training) {
 	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
 	if (ocl->isInitialized()) {
-		if (!initializeKernelObjects(ocl)) {
-			Logger::writeLine("ConvolutionalLayer::computeOutput(): Can't initialize kernel. Unable to compute anything.");
-			return input;
-		} else if (!initializeMemoryObjects(ocl)) {
-			Logger::writeLine("ConvolutionalLayer::computeOutput(): Can't initialize memory objects. Unable to compute anything.");
-			return input;
+		if (!initializeKernelObjects(ocl, training)) {
+			Logger::writeLine("ConvolutionalLayer::computeDeviceOutput(): Can't initialize kernel. Unable to compute anything.");
+			return false;
+		} else if (!initializeMemoryObjects(ocl, batch_size, training)) {
+			Logger::writeLine("ConvolutionalLayer::computeDeviceOutput(): Can't initialize memory objects. Unable to compute anything.");
+			return false;
+		} else if (useGemm(batch_size)) {
+			if (!initializeGemmObjects(ocl, training)) {
+				Logger::writeLine("ConvolutionalLayer::computeDeviceOutput(): Can't initialize the GEMM path. Unable to compute anything.");
+				return false;
+			} else if (!computeGemmOutput(ocl, memid, batch_size, training)) {
+				return false;
+			}
+			last_pass_gemm = true;
+			input_memid = memid;
+			return true;
 		} else {
-			std::vector<float> output(num_outputs);
-			ocl->writeMemoryContent(imemid, (void*) &input[0], num_inputs * sizeof(float));
 			OpenCLInterface::Dimension dim;
 			dim.x = num_outputs;
-			std::vector<int> memargs({imemid, wmemid, oememid, smemid, icmemid, icimemid});
+			dim.y = batch_size;
+			std::vector<int> memargs({memid, wmemid, oememid, smemid, icmemid, icimemid});
 			std::vector<std::pair<void *, size_t>> constargs({std::make_pair((void *) &input_maps.width, sizeof(unsigned int)),
 															std::make_pair((void*) &input_maps.height, sizeof(unsigned int)),
 															std::make_pair((void*) &filter.width, sizeof(unsigned int)),
-															std::make_pair((void*) &filter.height, sizeof(unsigned int))});
-			OpenCLInterface::OpenCLError err = ocl->callKernel(okid, dim, memargs, constargs);
+															std::make_pair((void*) &filter.height, sizeof(unsigned int)),
+															std::make_pair((void*) &num_inputs, sizeof(unsigned int))});
+			OpenCLInterface::OpenCLError err;
+			if (training) {
+				err = ocl->enqueueKernel(okid, dim, memargs, constargs);
+			} else {
+				memargs.erase(memargs.begin() + 3);
+				err = ocl->enqueueKernel(oikid, dim, memargs, constargs);
+			}
 			if (err != OpenCLInterface::OpenCLError::SUCCESS) {
-				Logger::writeLine("ConvolutionalLayer::computeOutput(): Error when calling the OpenCL kernel.");
-				return input;
+				Logger::writeLine("ConvolutionalLayer::computeDeviceOutput(): Error when calling the OpenCL kernel.");
+				return false;
 			}
+			last_pass_gemm = false;
+			input_memid = memid;
+			return true;
+		}
+	} else {
+		Logger::writeLine("ConvolutionalLayer::computeDeviceOutput(): OpenCLInterface not initialized. Unable to compute anything.");
+		return false;
+	}
+}
+
+int ConvolutionalLayer::getOutputMemoryId() const {
+	return oememid;
+}
+
+std::vector<float> ConvolutionalLayer::computeOutput(const std::vector<float> &input) {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (ocl->isInitialized()) {
+		int memid = uploadInput(&input[0], 1, true);
+		if (memid < 0) {
+			Logger::writeLine("ConvolutionalLayer::computeOutput(): Can't upload input. Unable to compute anything.");
+			return input;
+		} else if (!computeDeviceOutput(memid, 1, true)) {
+			return input;
+		} else {
+			std::vector<float> output(num_outputs);
 			ocl->getMemoryContent(oememid, (void *) &output[0], num_outputs * sizeof(float));
 			return output;
 		}
@@ -237,42 +732,111 @@ std::vector<float> ConvolutionalLayer::computeOutput(const std::vector<float> &i
 	}
 }
 
-std::vector<float> ConvolutionalLayer::computeError(const std::vector<float> &input) {
+int ConvolutionalLayer::uploadError(const float *error, unsigned int batch_size) {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (!ocl->isInitialized()) {
+		return -1;
+	} else if (!initializeKernelObjects(ocl)) {
+		Logger::writeLine("ConvolutionalLayer::uploadError(): Can't initialize kernel.");
+		return -1;
+	} else if (!initializeMemoryObjects(ocl, batch_size)) {
+		Logger::writeLine("ConvolutionalLayer::uploadError(): Can't initialize memory objects.");
+		return -1;
+	} else if (ocl->enqueueWriteMemoryContent(ememid, (const void*) error, num_outputs * batch_size * sizeof(float)) != OpenCLInterface::OpenCLError::SUCCESS) {
+		Logger::writeLine("ConvolutionalLayer::uploadError(): Unable to write error to the device.");
+		return -1;
+	}
+	return ememid;
+}
+
+int ConvolutionalLayer::computeDeviceError(int memid, unsigned int batch_size) {
 	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
 	if (ocl->isInitialized()) {
 		if (!initializeKernelObjects(ocl)) {
-			Logger::writeLine("ConvolutionalLayer::computeError(): Can't initialize kernel. Unable to compute anything.");
-			return input;
-		} else if (!initializeMemoryObjects(ocl)) {
-			Logger::writeLine("ConvolutionalLayer::computeError(): Can't initialize memory objects. Unable to compute anything.");
-			return input;
+			Logger::writeLine("ConvolutionalLayer::computeDeviceError(): Can't initialize kernel. Unable to compute anything.");
+			return -1;
+		} else if (!initializeMemoryObjects(ocl, batch_size)) {
+			Logger::writeLine("ConvolutionalLayer::computeDeviceError(): Can't initialize memory objects. Unable to compute anything.");
+			return -1;
+		} else if (last_pass_gemm) {
+			//the lowered inputs of the forward pass are only there on the GEMM path
+			if (!initializeGemmObjects(ocl, true)) {
+				Logger::writeLine("ConvolutionalLayer::computeDeviceError(): Can't initialize the GEMM path. Unable to compute anything.");
+				return -1;
+			}
+			int newmemid = computeGemmError(ocl, memid, batch_size);
+			if (newmemid >= 0) {
+				weights_dirty = true;
+			}
+			return newmemid;
 		} else {
-			std::vector<float> newerror(num_inputs);
-			ocl->writeMemoryContent(oememid, (void*) &input[0], num_outputs * sizeof(float));
 			OpenCLInterface::Dimension dim;
 			dim.x = num_inputs;
-			std::vector<int> memargs({oememid, smemid, wmemid, nememid, ocmemid, ocimemid, owimemid});
+			dim.y = batch_size;
+			std::vector<int> memargs({memid, smemid, wmemid, nememid, ocmemid, ocimemid, owimemid});
 			std::vector<std::pair<void *, size_t>> constargs({std::make_pair((void *) &input_maps.width, sizeof(unsigned int)),
 															std::make_pair((void*) &input_maps.height, sizeof(unsigned int)),
 															std::make_pair((void*) &filter.width, sizeof(unsigned int)),
-															std::make_pair((void*) &filter.height, sizeof(unsigned int))});
-			OpenCLInterface::OpenCLError err = ocl->callKernel(fberrorkid, dim, memargs, constargs);
+															std::make_pair((void*) &filter.height, sizeof(unsigned int)),
+															std::make_pair((void*) &num_outputs, sizeof(unsigned int))});
+			OpenCLInterface::OpenCLError err = ocl->enqueueKernel(fberrorkid, dim, memargs, constargs);
 			if (err != OpenCLInterface::OpenCLError::SUCCESS) {
-				Logger::writeLine("ConvolutionalLayer::computeError(): Error when calling the OpenCL kernel for next error calculation.");
-				return input;
-			} else {
-				dim.x = weights.size();
-				ocl->getMemoryContent(nememid, (void *) &newerror[0], num_inputs * sizeof(float));
-				memargs = std::vector<int>({oememid, imemid, smemid, wmemid, womemid, icmemid, icimemid});
-				constargs.push_back(std::make_pair((void*) &learning, sizeof(float)));
-				err = ocl->callKernel(fbweightskid, dim, memargs, constargs);
-				if (err != OpenCLInterface::OpenCLError::SUCCESS) {
-					Logger::writeLine("ConvolutionalLayer::computeError(): Error when calling the OpenCL kernel for weight calculation.");
-					return input;
-				}
-				ocl->getMemoryContent(wmemid, (void *) &weights[0], weights.size() * sizeof(float));
-				return newerror;
+				Logger::writeLine("ConvolutionalLayer::computeDeviceError(): Error when calling the OpenCL kernel for next error calculation.");
+				return -1;
+			}
+			unsigned int tile_size = CONVREDUCEGROUP * CONVREDUCEPAIRS;
+			unsigned int num_tiles = ((num_outputs / num_output_maps) * batch_size + tile_size - 1) / tile_size;
+			OpenCLInterface::Dimension local;
+			local.x = CONVREDUCEGROUP;
+			local.y = 1;
+			dim.x = num_tiles * CONVREDUCEGROUP;
+			dim.y = weight_output_maps.size();
+			memargs = std::vector<int>({memid, input_memid, smemid, rmemid, womemid, icmemid, icimemid});
+			constargs.pop_back();
+			constargs.push_back(std::make_pair((void*) &learning, sizeof(float)));
+			constargs.push_back(std::make_pair((void*) &num_inputs, sizeof(unsigned int)));
+			constargs.push_back(std::make_pair((void*) &num_outputs, sizeof(unsigned int)));
+			constargs.push_back(std::make_pair((void*) &batch_size, sizeof(unsigned int)));
+			constargs.push_back(std::make_pair((void*) &tile_size, sizeof(unsigned int)));
+			setProfilingLabel("weights");
+			err = ocl->enqueueKernel(fbweightskid, dim, local, memargs, constargs);
+			if (err != OpenCLInterface::OpenCLError::SUCCESS) {
+				Logger::writeLine("ConvolutionalLayer::computeDeviceError(): Error when calling the OpenCL kernel for weight calculation.");
+				return -1;
+			}
+			dim.x = weight_output_maps.size();
+			dim.y = 0;
+			memargs = std::vector<int>({wmemid, rmemid});
+			constargs = std::vector<std::pair<void *, size_t>>({std::make_pair((void*) &num_tiles, sizeof(unsigned int))});
+			err = ocl->enqueueKernel(fbaccumulatekid, dim, memargs, constargs);
+			if (err != OpenCLInterface::OpenCLError::SUCCESS) {
+				Logger::writeLine("ConvolutionalLayer::computeDeviceError(): Error when calling the OpenCL kernel for weight accumulation.");
+				return -1;
 			}
+			weights_dirty = true;
+			return nememid;
+		}
+	} else {
+		Logger::writeLine("ConvolutionalLayer::computeDeviceError(): OpenCLInterface not initialized. Unable to compute anything.");
+		return -1;
+	}
+}
+
+std::vector<float> ConvolutionalLayer::computeError(const std::vector<float> &input) {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (ocl->isInitialized()) {
+		int memid = uploadError(&input[0], 1);
+		if (memid < 0) {
+			Logger::writeLine("ConvolutionalLayer::computeError(): Can't upload error. Unable to compute anything.");
+			return input;
+		}
+		int errmemid = computeDeviceError(memid, 1);
+		if (errmemid < 0) {
+			return input;
+		} else {
+			std::vector<float> newerror(num_inputs);
+			ocl->getMemoryContent(errmemid, (void *) &newerror[0], num_inputs * sizeof(float));
+			return newerror;
 		}
 	} else {
 		Logger::writeLine("ConvolutionalLayer::computeError(): OpenCLInterface not initialized. Unable to compute anything.");
@@ -280,11 +844,151 @@ std::vector<float> ConvolutionalLayer::computeError(const std::vector<float> &in
 	}
 }
 
+void ConvolutionalLayer::computeHostOutput(const float *input, float *output, unsigned int batch_size, bool training) {
+	synchronizeWeights();
+	unsigned int output_width = input_maps.width - filter.width + 1;
+	unsigned int output_feature_map_size = output_width * (input_maps.height - filter.height + 1);
+	unsigned int input_feature_map_size = input_maps.width * input_maps.height;
+	unsigned int filter_size = filter.width * filter.height;
+	//same arithmetic as the computeOutput kernel, one item per (output, sample)
+	ThreadPool::getInstance()->parallelFor(num_outputs * batch_size, [&](unsigned int begin, unsigned int end) {
+		for (unsigned int id = begin; id < end; id++) {
+			unsigned int output_id = id % num_outputs;
+			unsigned int output_feature_map_id = output_id / output_feature_map_size;
+			unsigned int output_x = (output_id % output_feature_map_size) % output_width;
+			unsigned int output_y = (output_id % output_feature_map_size) / output_width;
+			const float *sample = &input[(id / num_outputs) * num_inputs];
+			float sum = 0.0f;
+			for (unsigned int c = input_connection_indices[output_feature_map_id]; c < input_connection_indices[output_feature_map_id + 1]; c++) {
+				const float *map = sample + input_connections[c] * input_feature_map_size;
+				const float *kernel = &weights[c * filter_size + output_feature_map_id];
+				for (unsigned int y = 0; y < filter.height; y++) {
+					const float *line = map + (output_y + y) * input_maps.width + output_x;
+					for (unsigned int x = 0; x < filter.width; x++) {
+						sum += line[x] * kernel[y * filter.width + x];
+					}
+				}
+			}
+			sum += weights[input_connection_indices[output_feature_map_id + 1] * filter_size + output_feature_map_id];
+			if (training) netsums[id] = sum;
+			output[id] = act->compute(sum);
+		}
+	});
+}
+
+void ConvolutionalLayer::computeHostError(const float *error, float *previous_error, unsigned int batch_size) {
+	const float *inputs = input_activations;
+	float *derivs = derivatives;
+	for (unsigned int i = 0; i < num_outputs * batch_size; i++) {
+		derivs[i] = act->computeDerivative(netsums[i]);
+	}
+	int output_width = input_maps.width - filter.width + 1;
+	int output_height = input_maps.height - filter.height + 1;
+	unsigned int output_feature_map_size = output_width * output_height;
+	unsigned int input_feature_map_size = input_maps.width * input_maps.height;
+	unsigned int filter_size = filter.width * filter.height;
+	//same arithmetic as the computeNextError kernel, one item per (input, sample)
+	ThreadPool::getInstance()->parallelFor(num_inputs * batch_size, [&](unsigned int begin, unsigned int end) {
+		for (unsigned int id = begin; id < end; id++) {
+			unsigned int sample_id = id / num_inputs;
+			unsigned int input_id = id % num_inputs;
+			unsigned int input_feature_map_id = input_id / input_feature_map_size;
+			int inp_x = (input_id % input_feature_map_size) % input_maps.width;
+			int inp_y = (input_id % input_feature_map_size) / input_maps.width;
+			float sum = 0.0f;
+			for (unsigned int c = output_connection_indices[input_feature_map_id]; c < output_connection_indices[input_feature_map_id + 1]; c++) {
+				unsigned int output_feature_map_id = output_connections[c];
+				for (int y = filter.height - 1; y >= 0; y--) {
+					for (int x = filter.width - 1; x >= 0; x--) {
+						int output_x = inp_x - x;
+						int output_y = inp_y - y;
+						if ((output_x >= 0) && (output_y >= 0) && (output_x < output_width) && (output_y < output_height)) {
+							unsigned int output_id = sample_id * num_outputs + output_feature_map_id * output_feature_map_size + output_y * output_width + output_x;
+							float delta = derivs[output_id] * error[output_id];
+							sum += weights[output_weight_indices[c] + y * filter.width + x] * delta;
+						}
+					}
+				}
+			}
+			previous_error[id] = sum;
+		}
+	});
+	//same terms as the computeWeightGradients kernel, one item per weight, after all errors used the old weights
+	ThreadPool::getInstance()->parallelFor(weight_output_maps.size(), [&](unsigned int begin, unsigned int end) {
+		for (unsigned int weight_id = begin; weight_id < end; weight_id++) {
+			unsigned int output_feature_map_id = weight_output_maps[weight_id];
+			unsigned int weight_startindex = filter_size * input_connection_indices[output_feature_map_id] + output_feature_map_id;
+			unsigned int input_map_offset = (weight_id - weight_startindex) / filter_size;
+			bool bias = (weight_id == input_connection_indices[output_feature_map_id + 1] * filter_size + output_feature_map_id);
+			unsigned int weight_x = ((weight_id - weight_startindex) % filter_size) % filter.width;
+			unsigned int weight_y = ((weight_id - weight_startindex) % filter_size) / filter.width;
+			const float *map = bias ? nullptr : &inputs[input_connections[input_connection_indices[output_feature_map_id] + input_map_offset] * input_feature_map_size];
+			float delta = 0.0f;
+			for (unsigned int sample_id = 0; sample_id < batch_size; sample_id++) {
+				for (int output_y = 0; output_y < output_height; output_y++) {
+					for (int output_x = 0; output_x < output_width; output_x++) {
+						unsigned int output_id = sample_id * num_outputs + output_feature_map_id * output_feature_map_size + output_y * output_width + output_x;
+						float last_input = 1.0f;
+						if (!bias) {
+							last_input = map[sample_id * num_inputs + (output_y + weight_y) * input_maps.width + (output_x + weight_x)];
+						}
+						delta += learning * error[output_id] * derivs[output_id] * last_input;
+					}
+				}
+			}
+			weights[weight_id] += delta;
+		}
+	});
+	if (wmemid >= 0) {
+		//outdated now, recreated from the host weights by the next device pass
+		OpenCLInterface::getInstance()->freeMemoryObject(wmemid);
+		wmemid = -1;
+	}
+}
+
 std::string ConvolutionalLayer::getName() const {
 	return "ConvolutionalLayer";
 }
 
+void ConvolutionalLayer::synchronizeWeights() const {
+	if (released_weights > 0) {
+		weights.resize(released_weights);
+		released_weights = 0;
+		weights_dirty = true;
+	}
+	if (weights_dirty) {
+		std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+		setProfilingLabel("readback");
+		if (ocl->getMemoryContent(wmemid, (void *) &weights[0], weights.size() * sizeof(float)) != OpenCLInterface::OpenCLError::SUCCESS) {
+			Logger::writeLine("ConvolutionalLayer::synchronizeWeights(): Unable to read weights from the device.");
+		} else {
+			weights_dirty = false;
+		}
+	}
+}
+
+bool ConvolutionalLayer::copyWeights(std::vector<float> &output) const {
+	if ((released_weights == 0) && !weights_dirty) {
+		output = weights;
+		return true;
+	}
+	//read into the caller's buffer, a released host copy stays released
+	output.resize((released_weights > 0) ? released_weights : weights.size());
+	setProfilingLabel("readback");
+	if (OpenCLInterface::getInstance()->getMemoryContent(wmemid, (void *) &output[0], output.size() * sizeof(float)) != OpenCLInterface::OpenCLError::SUCCESS) {
+		Logger::writeLine("ConvolutionalLayer::copyWeights(): Unable to read weights from the device.");
+		return false;
+	}
+	return true;
+}
+
 std::string ConvolutionalLayer::getDatastring() const {
+	std::vector<float> current;
+	copyWeights(current);
+	return getParameterString() + ":" + getVectorRepresentation<float>(current, ';');
+}
+
+std::string ConvolutionalLayer::getParameterString() const {
 	std::string datastring = act->getName() + ":";
 	datastring += std::to_string(learning) + ":" + std::to_string(num_input_maps) + ":" + std::to_string(num_output_maps) + ":";
 	datastring += std::to_string(input_maps.width) + ":" + std::to_string(input_maps.height) + ":";
@@ -294,20 +998,59 @@ std::string ConvolutionalLayer::getDatastring() const {
 	datastring += getVectorRepresentation<unsigned int>(output_connections, ';') + ":";
 	datastring += getVectorRepresentation<unsigned int>(output_connection_indices, ';') + ":";
 	datastring += getVectorRepresentation<unsigned int>(output_weight_indices, ';') + ":";
-	datastring += getVectorRepresentation<unsigned int>(weight_output_maps, ';') + ":";
-	datastring += getVectorRepresentation<float>(weights, ';');
+	datastring += getVectorRepresentation<unsigned int>(weight_output_maps, ';');
 	return datastring;
 }
 
+const std::vector<float> *ConvolutionalLayer::getWeights() const {
+	synchronizeWeights();
+	return &weights;
+}
+
+bool ConvolutionalLayer::loadWeightsToDevice(const float *weights, size_t num_weights, bool keep_host_copy) {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (!ocl->isInitialized()) {
+		Logger::writeLine("ConvolutionalLayer::loadWeightsToDevice(): OpenCL system was not initialized.");
+		return false;
+	} else if (num_weights != weight_output_maps.size()) {
+		Logger::writeLine("ConvolutionalLayer::loadWeightsToDevice(): Invalid number of weights.");
+		return false;
+	}
+	if (wmemid >= 0) {
+		ocl->freeMemoryObject(wmemid);
+	}
+	//copied while allocating, the buffer does not use the host memory afterwards
+	wmemid = ocl->allocateMemoryObject((void *) weights, num_weights * sizeof(float), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR);
+	if (wmemid < 0) {
+		Logger::writeLine("ConvolutionalLayer::loadWeightsToDevice(): Unable to allocate the weights on the device.");
+		return false;
+	}
+	weights_dirty = false;
+	if (keep_host_copy) {
+		released_weights = 0;
+		if (this->weights.data() != weights) {
+			this->weights.assign(weights, weights + num_weights);
+		}
+	} else {
+		released_weights = num_weights;
+		std::vector<float>().swap(this->weights);
+	}
+	return true;
+}
+
 bool ConvolutionalLayer::parseDatastring(std::string datastring) {
-	std::vector<std::string> data = parseVectorRepresentation<std::string> (datastring, ':');
-	if (data.size() != 15) {
-		Logger::writeLine("ConvolutionalLayer::parseDatastring(): Invalid number of parameters.");
+	return parseDatastringWithWeights(datastring);
+}
+
+bool ConvolutionalLayer::parseParameterString(std::string parameters, const float *weights, size_t num_weights) {
+	std::vector<std::string> data = parseVectorRepresentation<std::string> (parameters, ':');
+	if (data.size() != 14) {
+		Logger::writeLine("ConvolutionalLayer::parseParameterString(): Invalid number of parameters.");
 		return false;
 	} else {
 		act = ActivationFunction::getObjectFromString(data[0]);
 		if (act == nullptr) {
-			Logger::writeLine("ConvolutionalLayer::parseDatastring(): Invalid activation function identifier: " + data[0]);
+			Logger::writeLine("ConvolutionalLayer::parseParameterString(): Invalid activation function identifier: " + data[0]);
 			return false;
 		} else {
 			learning = std::stof(data[1]);
@@ -323,7 +1066,88 @@ bool ConvolutionalLayer::parseDatastring(std::string datastring) {
 			output_connection_indices = parseVectorRepresentation<unsigned int>(data[11], ';');
 			output_weight_indices = parseVectorRepresentation<unsigned int>(data[12], ';');
 			weight_output_maps = parseVectorRepresentation<unsigned int>(data[13], ';');
-			weights = parseVectorRepresentation<float>(data[14], ';');
+			packed_weight_indices.clear();
+			gemm_unavailable = false;
+			if ((num_input_maps == 0) || (num_output_maps == 0) || (filter.width == 0) || (filter.height == 0)
+					|| (filter.width > input_maps.width) || (filter.height > input_maps.height)) {
+				Logger::writeLine("ConvolutionalLayer::parseParameterString(): Invalid layer geometry.");
+				return false;
+			}
+			if ((num_inputs != ((size_t) num_input_maps) * input_maps.width * input_maps.height)
+					|| (num_outputs != ((size_t) input_maps.width - filter.width + 1) * (input_maps.height - filter.height + 1) * num_output_maps)) {
+				Logger::writeLine("ConvolutionalLayer::parseParameterString(): Number of inputs or outputs does not match the layer geometry.");
+				return false;
+			}
+			if (!checkConnectionTables()) {
+				Logger::writeLine("ConvolutionalLayer::parseParameterString(): Invalid connection tables.");
+				return false;
+			}
+			if (num_weights != weight_output_maps.size()) {
+				Logger::writeLine("ConvolutionalLayer::parseParameterString(): Invalid number of weights.");
+				return false;
+			}
+			//without weights they are passed to loadWeightsToDevice() afterwards
+			if (weights != nullptr) {
+				this->weights.assign(weights, weights + num_weights);
+			} else {
+				this->weights.clear();
+			}
+			released_weights = 0;
+		}
+	}
+	return true;
+}
+
+bool ConvolutionalLayer::checkConnectionTables() const {
+	size_t filter_size = filter.width * filter.height;
+	if ((input_connection_indices.size() != num_output_maps + 1) || (output_connection_indices.size() != num_input_maps + 1)) {
+		return false;
+	}
+	//the index arrays have to start at zero, grow monotonically and end with the size of the connection arrays
+	if ((input_connection_indices.front() != 0) || (input_connection_indices.back() != input_connections.size())) {
+		return false;
+	}
+	if ((output_connection_indices.front() != 0) || (output_connection_indices.back() != output_connections.size())) {
+		return false;
+	}
+	for (unsigned int i = 0; i < num_output_maps; i++) {
+		if (input_connection_indices[i] > input_connection_indices[i + 1]) {
+			return false;
+		}
+	}
+	for (unsigned int i = 0; i < num_input_maps; i++) {
+		if (output_connection_indices[i] > output_connection_indices[i + 1]) {
+			return false;
+		}
+	}
+	for (unsigned int i = 0; i < input_connections.size(); i++) {
+		if (input_connections[i] >= num_input_maps) {
+			return false;
+		}
+	}
+	for (unsigned int i = 0; i < output_connections.size(); i++) {
+		if (output_connections[i] >= num_output_maps) {
+			return false;
+		}
+	}
+	//every connection has filter_size weights, every output map one bias
+	size_t expected_weights = input_connections.size() * filter_size + num_output_maps;
+	if ((weight_output_maps.size() != expected_weights) || (output_weight_indices.size() != output_connections.size())) {
+		return false;
+	}
+	//the weights of an output map follow each other, the kernels derive the connection of a weight from this layout
+	size_t weight_id = 0;
+	for (unsigned int i = 0; i < num_output_maps; i++) {
+		size_t map_weights = (input_connection_indices[i + 1] - input_connection_indices[i]) * filter_size + 1;
+		for (size_t j = 0; j < map_weights; j++) {
+			if (weight_output_maps[weight_id++] != i) {
+				return false;
+			}
+		}
+	}
+	for (unsigned int i = 0; i < output_weight_indices.size(); i++) {
+		if (((size_t) output_weight_indices[i]) + filter_size > expected_weights) {
+			return false;
 		}
 	}
 	return true;
@@ -337,9 +1161,93 @@ unsigned int ConvolutionalLayer::getNumOutputFeatureMaps() const {
 	return num_output_maps;
 }
 
+void ConvolutionalLayer::freeTrainingObjects() {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (womemid >= 0) {
+		ocl->freeMemoryObject(womemid);
+		womemid = -1;
+	}
+	if (ememid >= 0) {
+		ocl->freeMemoryObject(ememid);
+		ememid = -1;
+	}
+	if (smemid >= 0) {
+		ocl->freeMemoryObject(smemid);
+		smemid = -1;
+	}
+	if (nememid >= 0) {
+		ocl->freeMemoryObject(nememid);
+		nememid = -1;
+	}
+	if (rmemid >= 0) {
+		ocl->freeMemoryObject(rmemid);
+		rmemid = -1;
+	}
+	if (ocmemid >= 0) {
+		ocl->freeMemoryObject(ocmemid);
+		ocmemid = -1;
+	}
+	if (ocimemid >= 0) {
+		ocl->freeMemoryObject(ocimemid);
+		ocimemid = -1;
+	}
+	if (owimemid >= 0) {
+		ocl->freeMemoryObject(owimemid);
+		owimemid = -1;
+	}
+	if (okid >= 0) {
+		ocl->deleteKernel(okid);
+		okid = -1;
+	}
+	if (fberrorkid >= 0) {
+		ocl->deleteKernel(fberrorkid);
+		fberrorkid = -1;
+	}
+	if (fbweightskid >= 0) {
+		ocl->deleteKernel(fbweightskid);
+		fbweightskid = -1;
+	}
+	if (fbaccumulatekid >= 0) {
+		ocl->deleteKernel(fbaccumulatekid);
+		fbaccumulatekid = -1;
+	}
+	if (pgmemid >= 0) {
+		ocl->freeMemoryObject(pgmemid);
+		pgmemid = -1;
+	}
+	if (pdmemid >= 0) {
+		ocl->freeMemoryObject(pdmemid);
+		pdmemid = -1;
+	}
+	if (pokid >= 0) {
+		ocl->deleteKernel(pokid);
+		pokid = -1;
+	}
+	if (pdeltakid >= 0) {
+		ocl->deleteKernel(pdeltakid);
+		pdeltakid = -1;
+	}
+	if (pgradientkid >= 0) {
+		ocl->deleteKernel(pgradientkid);
+		pgradientkid = -1;
+	}
+	if (perrorkid >= 0) {
+		ocl->deleteKernel(perrorkid);
+		perrorkid = -1;
+	}
+	if (pcollectkid >= 0) {
+		ocl->deleteKernel(pcollectkid);
+		pcollectkid = -1;
+	}
+	if (padaptkid >= 0) {
+		ocl->deleteKernel(padaptkid);
+		padaptkid = -1;
+	}
+}
+
 ConvolutionalLayer::~ConvolutionalLayer() {
 	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
-	if (wmemid > 0) {
+	if (wmemid >= 0) {
 		ocl->freeMemoryObject(wmemid);
 	}
 	if (womemid > 0) {
@@ -351,12 +1259,18 @@ ConvolutionalLayer::~ConvolutionalLayer() {
 	if (oememid > 0) {
 		ocl->freeMemoryObject(oememid);
 	}
+	if (ememid > 0) {
+		ocl->freeMemoryObject(ememid);
+	}
 	if (smemid > 0) {
 		ocl->freeMemoryObject(smemid);
 	}
 	if (nememid > 0) {
 		ocl->freeMemoryObject(nememid);
 	}
+	if (rmemid > 0) {
+		ocl->freeMemoryObject(rmemid);
+	}
 	if (icmemid > 0) {
 		ocl->freeMemoryObject(icmemid);
 	}
@@ -381,6 +1295,54 @@ ConvolutionalLayer::~ConvolutionalLayer() {
 	if (fbweightskid > 0) {
 		ocl->deleteKernel(fbweightskid);
 	}
+	if (fbaccumulatekid > 0) {
+		ocl->deleteKernel(fbaccumulatekid);
+	}
+	if (oikid > 0) {
+		ocl->deleteKernel(oikid);
+	}
+	if (pwmemid > 0) {
+		ocl->freeMemoryObject(pwmemid);
+	}
+	if (pwimemid > 0) {
+		ocl->freeMemoryObject(pwimemid);
+	}
+	if (pcmemid > 0) {
+		ocl->freeMemoryObject(pcmemid);
+	}
+	if (pgmemid > 0) {
+		ocl->freeMemoryObject(pgmemid);
+	}
+	if (pdmemid > 0) {
+		ocl->freeMemoryObject(pdmemid);
+	}
+	if (ppackkid > 0) {
+		ocl->deleteKernel(ppackkid);
+	}
+	if (pexpandkid > 0) {
+		ocl->deleteKernel(pexpandkid);
+	}
+	if (pokid > 0) {
+		ocl->deleteKernel(pokid);
+	}
+	if (poikid > 0) {
+		ocl->deleteKernel(poikid);
+	}
+	if (pdeltakid > 0) {
+		ocl->deleteKernel(pdeltakid);
+	}
+	if (pgradientkid > 0) {
+		ocl->deleteKernel(pgradientkid);
+	}
+	if (perrorkid > 0) {
+		ocl->deleteKernel(perrorkid);
+	}
+	if (pcollectkid > 0) {
+		ocl->deleteKernel(pcollectkid);
+	}
+	if (padaptkid > 0) {
+		ocl->deleteKernel(padaptkid);
+	}
 }
 
 } /* namespace clneural */
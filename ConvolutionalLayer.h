@@ -23,12 +23,24 @@ public:
 		unsigned int width = 0;
 		unsigned int height = 0;
 	};
+	enum ConvolutionKernel {
+		AUTOMATIC_KERNEL, //GEMM path for large enough filters, maps and batches with dense connections
+		DIRECT_KERNEL, //one work item per output, reading its input windows
+		GEMM_KERNEL //inputs lowered to a matrix (im2col) and multiplied with the weights in tiles
+	};
 private:
-	std::vector<float> weights;
+	static ConvolutionKernel convolution_kernel;
+	mutable std::vector<float> weights;
+	mutable bool weights_dirty = false; //device weights changed since the last synchronization
+	mutable size_t released_weights = 0; //number of weights only held by the device, read back on demand
 	float learning = 0.5f;
 	static const std::string fwclcode;
 	static const std::string fberrorclcode;
 	static const std::string fbweightsclcode;
+	static const std::string gemmclcode;
+	static const std::string expandclcode;
+	static const std::string collectclcode;
+	static const std::string packclcode;
 	std::shared_ptr<ActivationFunction> act = nullptr;
 	std::vector<unsigned int> input_connections;
 	std::vector<unsigned int> input_connection_indices;
@@ -36,12 +48,15 @@ private:
 	std::vector<unsigned int> output_connection_indices;
 	std::vector<unsigned int> output_weight_indices;
 	std::vector<unsigned int> weight_output_maps;
+	std::vector<unsigned int> packed_weight_indices; //position of every weight in the dense matrix of the GEMM path, built on first use
+	bool gemm_unavailable = false; //the connection table has no dense matrix, buildPackedWeightIndices() failed once
 	unsigned int num_input_maps = 0;
 	unsigned int num_output_maps = 0;
 	int wmemid = -1; //weights
 	int womemid = -1; //weights to output feature maps
 	int imemid = -1; //inputs
-	int oememid = -1; //outputs and errors from next layer
+	int oememid = -1; //outputs
+	int ememid = -1; //errors from next layer
 	int nememid = -1; //error to previous layer
 	int smemid =-1; //input*weight sums
 	int icmemid = -1; //input feature maps per output feature map
@@ -49,25 +64,70 @@ private:
 	int ocmemid = -1; //output feature maps per input feature map
 	int ocimemid = -1; //indices for every map in the above array
 	int owimemid = -1; //position in weight array for an output map assigned to an input map
+	int rmemid = -1; //weight gradients per output tile, reduced by the work groups
 	int okid = -1; //kernel for output computation
 	int fberrorkid = -1; //kernel for previous error computation
-	int fbweightskid = -1; //kernel for weight adaption computation
+	int fbweightskid = -1; //kernel for weight gradient computation per output tile
+	int fbaccumulatekid = -1; //kernel adding the weight gradients of all tiles to the weights
+	int oikid = -1; //kernel for output computation without netsums (inference)
+	int pwmemid = -1; //GEMM path: weights as dense matrix, one row per output map, zero for maps not connected
+	int pwimemid = -1; //GEMM path: packed_weight_indices
+	int pcmemid = -1; //GEMM path: lowered inputs of the last forward pass, reused for the errors of the lowered inputs
+	int pgmemid = -1; //GEMM path: weight gradient as dense matrix
+	int pdmemid = -1; //GEMM path: deltas of the error pass
+	int ppackkid = -1; //GEMM path: kernel copying the weights into the dense matrix
+	int pexpandkid = -1; //GEMM path: im2col kernel
+	int pokid = -1; //GEMM path: output computation
+	int poikid = -1; //GEMM path: output computation without netsums (inference)
+	int pdeltakid = -1; //GEMM path: delta computation
+	int pgradientkid = -1; //GEMM path: weight gradient computation
+	int perrorkid = -1; //GEMM path: error computation for the lowered inputs
+	int pcollectkid = -1; //GEMM path: col2im kernel summing the errors of the lowered inputs
+	int padaptkid = -1; //GEMM path: kernel adapting the weights to the dense gradient
+	bool last_pass_gemm = false; //the last forward pass used the GEMM path and left its lowered inputs on the device
 	Dimension input_maps;
 	Dimension filter;
-	bool initializeMemoryObjects(std::shared_ptr<OpenCLInterface> ocl);
-	bool initializeKernelObjects(std::shared_ptr<OpenCLInterface> ocl);
+	bool initializeMemoryObjects(std::shared_ptr<OpenCLInterface> ocl, unsigned int batch_size = 1, bool training = true);
+	void freeBatchMemoryObjects(std::shared_ptr<OpenCLInterface> ocl);
+	bool initializeKernelObjects(std::shared_ptr<OpenCLInterface> ocl, bool training = true);
+	/* Checks the parsed connection tables against each other and the number of feature maps, the kernels do not check their indices. */
+	bool checkConnectionTables() const;
+	/* GEMM path: the dense weight matrix has num_output_maps rows of num_input_maps * filter size + 1 columns, the last one for the bias.
+	 * Not possible if an output map is connected to the same input map twice. */
+	bool buildPackedWeightIndices();
+	bool useGemm(unsigned int batch_size);
+	bool initializeGemmObjects(std::shared_ptr<OpenCLInterface> ocl, bool training);
+	bool computeGemmOutput(std::shared_ptr<OpenCLInterface> ocl, int memid, unsigned int batch_size, bool training);
+	int computeGemmError(std::shared_ptr<OpenCLInterface> ocl, int memid, unsigned int batch_size);
 	static const NeuralNetworkLayerRegisterHelper<ConvolutionalLayer> reg;
 protected:
 	virtual std::vector<float> computeOutput(const std::vector<float> &input);
 	virtual std::vector<float> computeError(const std::vector<float> &input);
+	virtual void computeHostOutput(const float *input, float *output, unsigned int batch_size, bool training);
+	virtual void computeHostError(const float *error, float *previous_error, unsigned int batch_size);
+	virtual int uploadInput(const float *input, unsigned int batch_size, bool training);
+	virtual bool computeDeviceOutput(int memid, unsigned int batch_size, bool training);
+	virtual int getOutputMemoryId() const;
+	virtual int uploadError(const float *error, unsigned int batch_size);
+	virtual int computeDeviceError(int memid, unsigned int batch_size);
+	virtual void freeTrainingObjects();
 	virtual std::string getName() const;
 	virtual std::string getDatastring() const;
 	virtual bool parseDatastring(std::string datastring);
+	virtual std::string getParameterString() const;
+	virtual bool parseParameterString(std::string parameters, const float *weights, size_t num_weights);
 public:
+	/* Selects the device kernels of all convolutional layers. Takes effect with the next forward pass. */
+	static void setConvolutionKernel(ConvolutionKernel kernel);
+	static ConvolutionKernel getConvolutionKernel();
 	ConvolutionalLayer(Dimension input_maps, Dimension filter, const std::vector<std::list<unsigned int>> &input_to_output, std::shared_ptr<ActivationFunction> act, float learning);
 	ConvolutionalLayer() = default;
 	unsigned int getNumOutputFeatureMaps() const;
 	unsigned int getNumInputFeatureMaps() const;
+	virtual void synchronizeWeights() const;
+	virtual const std::vector<float> *getWeights() const;
+	virtual bool copyWeights(std::vector<float> &output) const;
+	virtual bool loadWeightsToDevice(const float *weights, size_t num_weights, bool keep_host_copy);
 	virtual ~ConvolutionalLayer();
 };
 
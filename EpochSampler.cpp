@@ -0,0 +1,85 @@
+/*
+ * EpochSampler.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "EpochSampler.h"
+#include "Logger.h"
+#include <algorithm>
+
+EpochSampler::EpochSampler(const ImageDataset &dataset, unsigned int seed, bool stratified) : dataset(dataset), stratified(stratified) {
+	randgen.seed(seed);
+	if (stratified && !dataset.hasLabels()) {
+		Logger::writeLine("EpochSampler::EpochSampler(): No labels loaded, stratified sampling disabled.");
+		this->stratified = false;
+	}
+	order.resize(dataset.getNumImages());
+	for (unsigned int i = 0; i < order.size(); i++) {
+		order[i] = i;
+	}
+	shuffle();
+}
+
+void EpochSampler::shuffle() {
+	if (stratified) {
+		shuffleStratified();
+	} else {
+		std::shuffle(order.begin(), order.end(), randgen);
+	}
+}
+
+void EpochSampler::startEpoch() {
+	shuffle();
+	position = 0;
+	epoch++;
+}
+
+void EpochSampler::shuffleStratified() {
+	std::vector<std::vector<unsigned int>> classes(256);
+	for (unsigned int i = 0; i < order.size(); i++) {
+		classes[dataset.getLabel(i)].push_back(i);
+	}
+	//the k-th of n elements of a class is placed at (k + offset)/n of the epoch, with a random offset per class
+	std::uniform_real_distribution<double> dist(0.0, 1.0);
+	std::vector<std::pair<double, unsigned int>> keys;
+	keys.reserve(order.size());
+	for (unsigned int c = 0; c < classes.size(); c++) {
+		if (classes[c].empty()) continue;
+		std::shuffle(classes[c].begin(), classes[c].end(), randgen);
+		double offset = dist(randgen);
+		for (unsigned int k = 0; k < classes[c].size(); k++) {
+			keys.push_back(std::make_pair((k + offset) / classes[c].size(), classes[c][k]));
+		}
+	}
+	std::sort(keys.begin(), keys.end());
+	for (unsigned int i = 0; i < keys.size(); i++) {
+		order[i] = keys[i].second;
+	}
+}
+
+unsigned int EpochSampler::getEpoch() const {
+	return epoch;
+}
+
+unsigned int EpochSampler::getRemaining() const {
+	return order.size() - position;
+}
+
+bool EpochSampler::hasNext() const {
+	return position < order.size();
+}
+
+unsigned int EpochSampler::next() {
+	return order[position++];
+}
+
+unsigned int EpochSampler::nextBatch(unsigned int batch_size, std::vector<unsigned int> &indices) {
+	unsigned int count = std::min(batch_size, getRemaining());
+	indices.assign(order.begin() + position, order.begin() + position + count);
+	position += count;
+	return count;
+}
+
+EpochSampler::~EpochSampler() {
+}
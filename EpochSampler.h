@@ -0,0 +1,41 @@
+/*
+ * EpochSampler.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef EPOCHSAMPLER_H_
+#define EPOCHSAMPLER_H_
+
+#include "ImageDataset.h"
+#include <vector>
+#include <random>
+
+/* Iterates over all images of a data set in a new random order per epoch, handing out storage indices.
+ * The data set is neither copied nor modified, popped elements are ignored.
+ * Stratified epochs spread every label evenly over the epoch, so each mini-batch has about the label distribution of the whole set. */
+class EpochSampler {
+private:
+	const ImageDataset &dataset;
+	std::vector<unsigned int> order; //storage indices of the current epoch
+	unsigned int position = 0;
+	unsigned int epoch = 0;
+	bool stratified = false;
+	std::default_random_engine randgen;
+	void shuffle();
+	void shuffleStratified();
+public:
+	EpochSampler(const ImageDataset &dataset, unsigned int seed, bool stratified = false);
+	/* Draws the permutation of the next epoch, the first one is drawn by the constructor. */
+	void startEpoch();
+	/* Number of the current epoch, starting at 0. */
+	unsigned int getEpoch() const;
+	unsigned int getRemaining() const;
+	bool hasNext() const;
+	unsigned int next();
+	/* Fills indices with up to batch_size storage indices, returns how many, 0 at the end of the epoch. */
+	unsigned int nextBatch(unsigned int batch_size, std::vector<unsigned int> &indices);
+	virtual ~EpochSampler();
+};
+
+#endif /* EPOCHSAMPLER_H_ */
@@ -9,9 +9,19 @@
 #include "RandomGenerator.h"
 #include "OpenCLInterface.h"
 #include "Logger.h"
+#include "ThreadPool.h"
+#include <algorithm>
+
+#define FFTILEGROUPSIZE 64 //work items per group of the tiled kernel
+#define FFTILENEURONS 4 //outputs per work item of the tiled kernel
+#define FFTILEINPUTS 256 //inputs staged in local memory at once
+#define FFTILEMININPUTS 256
+#define FFTILEMINOUTPUTS 64
 
 namespace clneural {
 
+FullFeedforwardLayer::OutputKernel FullFeedforwardLayer::output_kernel = FullFeedforwardLayer::OutputKernel::AUTOMATIC_KERNEL;
+
 const std::string FullFeedforwardLayer::fwclcode = "__kernel void computeOutput(__global const float *inputs, __global const float *weights, __global float *outputs, __global float *netsums, unsigned int num_inputs) {\n"
 												 "unsigned int neuron_id = get_global_id(0);\n"
 												 "float sum = 0.0f;\n"
@@ -23,18 +33,117 @@ const std::string FullFeedforwardLayer::fwclcode = "__kernel void computeOutput(
 												 "outputs[neuron_id] = activationFunction(sum);\n"
 												 "}\n";
 
-const std::string FullFeedforwardLayer::fbclcode = "__kernel void computeError(__global const float *error, __global const float *last_inputs, __global const float *netsums, __global float *weights, __global float *nexterror, unsigned int num_outputs, float learning_rate) {\n"
+/* Batched output: outputs = act(inputs * weights^T + bias), one work item per (neuron, sample) element of the output matrix.
+ * Compiled with INFERENCE_ONLY defined the netsums are neither taken nor stored. */
+const std::string FullFeedforwardLayer::fwbatchclcode = "__kernel void computeBatchOutput(__global const float *inputs, __global const float *weights, __global float *outputs,\n"
+												 "#ifndef INFERENCE_ONLY\n"
+												 "__global float *netsums,\n"
+												 "#endif\n"
+												 "unsigned int num_inputs) {\n"
+												 "unsigned int neuron_id = get_global_id(0);\n"
+												 "unsigned int sample_id = get_global_id(1);\n"
+												 "unsigned int num_outputs = get_global_size(0);\n"
+												 "__global const float *sample = inputs + sample_id * num_inputs;\n"
+												 "__global const float *row = weights + neuron_id * (num_inputs + 1);\n"
+												 "float sum = 0.0f;\n"
+												 "for (unsigned int i = 0; i < num_inputs; i++) {\n"
+												 "sum += sample[i] * row[i];\n"
+												 "}\n"
+												 "sum += row[num_inputs];\n"
+												 "#ifndef INFERENCE_ONLY\n"
+												 "netsums[sample_id * num_outputs + neuron_id] = sum;\n"
+												 "#endif\n"
+												 "outputs[sample_id * num_outputs + neuron_id] = activationFunction(sum);\n"
+												 "}\n";
+
+/* Deltas of the error pass: delta = error * act'(netsum), one work item per (neuron, sample). Computed once so the error
+ * and weight kernels below do not evaluate the derivative for every input again. */
+const std::string FullFeedforwardLayer::fbdeltaclcode = "__kernel void computeBatchDeltas(__global const float *error, __global const float *netsums, __global float *deltas) {\n"
+												 "unsigned int id = get_global_id(1) * get_global_size(0) + get_global_id(0);\n"
+												 "deltas[id] = error[id] * activationDerivate(netsums[id]);\n"
+												 "}\n";
+
+/* Batched error for the previous layer: nexterror = deltas * weights, one work item per (input, sample).
+ * Neighbouring work items read neighbouring weights of the same row. */
+const std::string FullFeedforwardLayer::fbbatcherrorclcode = "__kernel void computeBatchError(__global const float *deltas, __global const float *weights, __global float *nexterror, unsigned int num_outputs) {\n"
 												 "unsigned int input_id = get_global_id(0);\n"
+												 "unsigned int sample_id = get_global_id(1);\n"
+												 "unsigned int num_inputs = get_global_size(0);\n"
+												 "__global const float *sample_deltas = deltas + sample_id * num_outputs;\n"
+												 "float sum = 0.0f;\n"
+												 "for (unsigned int i = 0; i < num_outputs; i++) {\n"
+												 "sum += weights[i*(num_inputs+1) + input_id] * sample_deltas[i];\n"
+												 "}\n"
+												 "nexterror[sample_id * num_inputs + input_id] = sum;\n"
+												 "}\n";
+
+/* Batched weight update: weights += learning_rate * deltas^T * inputs, the outer product accumulated over the batch,
+ * one work item per weight. Has to run after computeBatchError, which needs the old weights. */
+const std::string FullFeedforwardLayer::fbbatchweightsclcode = "__kernel void computeBatchWeights(__global const float *deltas, __global const float *last_inputs, __global float *weights, unsigned int num_outputs, unsigned int batch_size, float learning_rate) {\n"
+												 "unsigned int input_id = get_global_id(0);\n"
+												 "unsigned int neuron_id = get_global_id(1);\n"
 												 "unsigned int num_inputs = get_global_size(0) - 1;\n"
 												 "float sum = 0.0f;\n"
+												 "for (unsigned int s = 0; s < batch_size; s++) {\n"
 												 "float last_input = 1.0f;\n"
-												 "if (input_id != num_inputs) last_input = last_inputs[input_id];\n"
-												 "for (unsigned int i = 0; i < num_outputs; i++) {\n"
-												 "float delta = error[i] * activationDerivate(netsums[i]);\n"
-												 "sum += weights[i*(num_inputs+1) + input_id] * delta;"
-												 "weights[i*(num_inputs+1) + input_id] += learning_rate * delta * last_input;\n"
+												 "if (input_id != num_inputs) last_input = last_inputs[s * num_inputs + input_id];\n"
+												 "sum += deltas[s * num_outputs + neuron_id] * last_input;\n"
+												 "}\n"
+												 "weights[neuron_id*(num_inputs+1) + input_id] += learning_rate * sum;\n"
+												 "}\n";
+
+/* Batched output for wide layers: a group of TILE_GROUP_SIZE work items computes TILE_GROUP_SIZE * TILE_NEURONS outputs of one sample.
+ * The sample is staged in local memory TILE_INPUTS floats at a time, so it is read from global memory once per group instead of
+ * once per output, and every work item applies each tile to its TILE_NEURONS weight rows four floats at a time.
+ * The tile defines are prepended when compiling, INFERENCE_ONLY works as for computeBatchOutput. */
+const std::string FullFeedforwardLayer::fwtiledclcode = "__kernel __attribute__((reqd_work_group_size(TILE_GROUP_SIZE, 1, 1)))\n"
+												 "void computeTiledOutput(__global const float *inputs, __global const float *weights, __global float *outputs,\n"
+												 "#ifndef INFERENCE_ONLY\n"
+												 "__global float *netsums,\n"
+												 "#endif\n"
+												 "unsigned int num_inputs, unsigned int num_outputs) {\n"
+												 "__local float tile[TILE_INPUTS];\n"
+												 "unsigned int local_id = get_local_id(0);\n"
+												 "unsigned int sample_id = get_global_id(1);\n"
+												 "unsigned int first_neuron = get_group_id(0) * TILE_GROUP_SIZE * TILE_NEURONS + local_id;\n"
+												 "__global const float *sample = inputs + sample_id * num_inputs;\n"
+												 "__global const float *rows[TILE_NEURONS];\n"
+												 "float sums[TILE_NEURONS];\n"
+												 "for (unsigned int k = 0; k < TILE_NEURONS; k++) {\n"
+												 //work items past the last output compute the last one again, all of them have to reach the barriers
+												 "rows[k] = weights + min(first_neuron + k * TILE_GROUP_SIZE, num_outputs - 1) * (num_inputs + 1);\n"
+												 "sums[k] = 0.0f;\n"
+												 "}\n"
+												 "for (unsigned int offset = 0; offset < num_inputs; offset += TILE_INPUTS) {\n"
+												 "unsigned int count = min((unsigned int) TILE_INPUTS, num_inputs - offset);\n"
+												 "for (unsigned int i = local_id; i < count; i += TILE_GROUP_SIZE) {\n"
+												 "tile[i] = sample[offset + i];\n"
+												 "}\n"
+												 "barrier(CLK_LOCAL_MEM_FENCE);\n"
+												 "unsigned int i = 0;\n"
+												 "for (; i + 4 <= count; i += 4) {\n"
+												 "float4 x = vload4(0, tile + i);\n"
+												 "for (unsigned int k = 0; k < TILE_NEURONS; k++) {\n"
+												 "sums[k] += dot(x, vload4(0, rows[k] + offset + i));\n"
+												 "}\n"
+												 "}\n"
+												 "for (; i < count; i++) {\n"
+												 "for (unsigned int k = 0; k < TILE_NEURONS; k++) {\n"
+												 "sums[k] += tile[i] * rows[k][offset + i];\n"
+												 "}\n"
+												 "}\n"
+												 "barrier(CLK_LOCAL_MEM_FENCE);\n"
+												 "}\n"
+												 "for (unsigned int k = 0; k < TILE_NEURONS; k++) {\n"
+												 "unsigned int neuron_id = first_neuron + k * TILE_GROUP_SIZE;\n"
+												 "if (neuron_id < num_outputs) {\n"
+												 "float sum = sums[k] + rows[k][num_inputs];\n"
+												 "#ifndef INFERENCE_ONLY\n"
+												 "netsums[sample_id * num_outputs + neuron_id] = sum;\n"
+												 "#endif\n"
+												 "outputs[sample_id * num_outputs + neuron_id] = activationFunction(sum);\n"
+												 "}\n"
 												 "}\n"
-												 "if (input_id != num_inputs) nexterror[input_id] = sum;\n"
 												 "}\n";
 
 const NeuralNetworkLayerRegisterHelper<FullFeedforwardLayer> FullFeedforwardLayer::reg("FullFeedforwardLayer");
@@ -48,141 +157,547 @@ FullFeedforwardLayer::FullFeedforwardLayer(unsigned int num_inputs, unsigned int
 	}
 }
 
-bool FullFeedforwardLayer::initializeMemoryObjects(std::shared_ptr<OpenCLInterface> ocl) {
+bool FullFeedforwardLayer::initializeMemoryObjects(std::shared_ptr<OpenCLInterface> ocl, unsigned int batch_size, bool training) {
+	if (batch_size > batch_capacity) {
+		freeBatchMemoryObjects(ocl);
+		batch_capacity = batch_size;
+	}
 	if (wmemid < 0) {
 		wmemid = ocl->allocateMemoryObject((void *) &weights[0], (num_inputs + 1) * num_outputs * sizeof(float), CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
 	}
 	if (imemid < 0) {
-		imemid = ocl->allocateMemoryObject(NULL, num_inputs * sizeof(float), CL_MEM_READ_WRITE);
+		imemid = ocl->allocateMemoryObject(NULL, num_inputs * batch_capacity * sizeof(float), CL_MEM_READ_WRITE);
 	}
 	if (oememid < 0) {
-		oememid = ocl->allocateMemoryObject(NULL, num_outputs * sizeof(float), CL_MEM_WRITE_ONLY);
+		oememid = ocl->allocateMemoryObject(NULL, num_outputs * batch_capacity * sizeof(float), CL_MEM_READ_WRITE);
+	}
+	if ((oememid < 0) || (imemid < 0) || (wmemid < 0)) {
+		return false;
+	}
+	if (!training) {
+		return true;
+	}
+	if (ememid < 0) {
+		ememid = ocl->allocateMemoryObject(NULL, num_outputs * batch_capacity * sizeof(float), CL_MEM_READ_ONLY);
 	}
 	if (smemid < 0) {
-		smemid = ocl->allocateMemoryObject(NULL, num_outputs * sizeof(float), CL_MEM_READ_WRITE);
+		smemid = ocl->allocateMemoryObject(NULL, num_outputs * batch_capacity * sizeof(float), CL_MEM_READ_WRITE);
 	}
 	if (nememid < 0) {
-		nememid = ocl->allocateMemoryObject(NULL, num_inputs * sizeof(float), CL_MEM_READ_ONLY);
+		nememid = ocl->allocateMemoryObject(NULL, num_inputs * batch_capacity * sizeof(float), CL_MEM_READ_WRITE);
+	}
+	if (dmemid < 0) {
+		dmemid = ocl->allocateMemoryObject(NULL, num_outputs * batch_capacity * sizeof(float), CL_MEM_READ_WRITE);
 	}
-	if ((oememid < 0) || (imemid < 0) || (wmemid < 0) ||(smemid < 0) || (nememid < 0)) {
+	if ((ememid < 0) || (smemid < 0) || (nememid < 0) || (dmemid < 0)) {
 		return false;
 	}
 	return true;
 }
 
-bool FullFeedforwardLayer::initializeKernelObjects(std::shared_ptr<OpenCLInterface> ocl) {
-	if (okid < 0) {
-		std::string code = act->getCode() + fwclcode;
-		okid = ocl->createKernelFromSource(code, "computeOutput");
+void FullFeedforwardLayer::freeBatchMemoryObjects(std::shared_ptr<OpenCLInterface> ocl) {
+	if (imemid >= 0) {
+		ocl->freeMemoryObject(imemid);
+		imemid = -1;
 	}
-	if (fbkid < 0) {
-		std::string code = act->getDerivCode() + fbclcode;
-		fbkid = ocl->createKernelFromSource(code, "computeError");
+	if (oememid >= 0) {
+		ocl->freeMemoryObject(oememid);
+		oememid = -1;
+	}
+	if (ememid >= 0) {
+		ocl->freeMemoryObject(ememid);
+		ememid = -1;
 	}
-	if ((okid < 0) || (fbkid < 0)) {
+	if (smemid >= 0) {
+		ocl->freeMemoryObject(smemid);
+		smemid = -1;
+	}
+	if (nememid >= 0) {
+		ocl->freeMemoryObject(nememid);
+		nememid = -1;
+	}
+	if (dmemid >= 0) {
+		ocl->freeMemoryObject(dmemid);
+		dmemid = -1;
+	}
+}
+
+void FullFeedforwardLayer::setOutputKernel(OutputKernel kernel) {
+	FullFeedforwardLayer::output_kernel = kernel;
+}
+
+FullFeedforwardLayer::OutputKernel FullFeedforwardLayer::getOutputKernel() {
+	return output_kernel;
+}
+
+bool FullFeedforwardLayer::useTiledOutput() const {
+	if (output_kernel == OutputKernel::AUTOMATIC_KERNEL) {
+		//narrow layers leave most work items of a group idle, short rows do not amortize the staging
+		return (num_inputs >= FFTILEMININPUTS) && (num_outputs >= FFTILEMINOUTPUTS);
+	}
+	return (output_kernel == OutputKernel::TILED_KERNEL);
+}
+
+bool FullFeedforwardLayer::initializeKernelObjects(std::shared_ptr<OpenCLInterface> ocl, bool training) {
+	bool tiled = useTiledOutput();
+	std::string tiledefines = "#define TILE_GROUP_SIZE " + std::to_string(FFTILEGROUPSIZE) + "\n"
+							  "#define TILE_NEURONS " + std::to_string(FFTILENEURONS) + "\n"
+							  "#define TILE_INPUTS " + std::to_string(FFTILEINPUTS) + "\n";
+	if (!training) {
+		if (tiled) {
+			if (otikid < 0) {
+				std::string code = "#define INFERENCE_ONLY\n" + tiledefines + act->getCode() + fwtiledclcode;
+				otikid = ocl->createKernelFromSource(code, "computeTiledOutput");
+			}
+			return (otikid >= 0);
+		}
+		if (oikid < 0) {
+			std::string code = "#define INFERENCE_ONLY\n" + act->getCode() + fwbatchclcode;
+			oikid = ocl->createKernelFromSource(code, "computeBatchOutput");
+		}
+		return (oikid >= 0);
+	}
+	if (tiled) {
+		if (otkid < 0) {
+			std::string code = tiledefines + act->getCode() + fwtiledclcode;
+			otkid = ocl->createKernelFromSource(code, "computeTiledOutput");
+		}
+		if (otkid < 0) {
+			return false;
+		}
+	} else {
+		if (okid < 0) {
+			std::string code = act->getCode() + fwclcode;
+			okid = ocl->createKernelFromSource(code, "computeOutput");
+		}
+		if (obkid < 0) {
+			std::string code = act->getCode() + fwbatchclcode;
+			obkid = ocl->createKernelFromSource(code, "computeBatchOutput");
+		}
+		if ((okid < 0) || (obkid < 0)) {
+			return false;
+		}
+	}
+	if (fbdkid < 0) {
+		std::string code = act->getDerivCode() + fbdeltaclcode;
+		fbdkid = ocl->createKernelFromSource(code, "computeBatchDeltas");
+	}
+	if (fbekid < 0) {
+		std::string code = fbbatcherrorclcode;
+		fbekid = ocl->createKernelFromSource(code, "computeBatchError");
+	}
+	if (fbwkid < 0) {
+		std::string code = fbbatchweightsclcode;
+		fbwkid = ocl->createKernelFromSource(code, "computeBatchWeights");
+	}
+	if ((fbdkid < 0) || (fbekid < 0) || (fbwkid < 0)) {
 		return false;
 	}
 	return true;
 }
 
-std::vector<float> FullFeedforwardLayer::computeOutput(const std::vector<float> &input) {
+int FullFeedforwardLayer::uploadInput(const float *input, unsigned int batch_size, bool training) {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (!ocl->isInitialized()) {
+		return -1;
+	} else if (!initializeKernelObjects(ocl, training)) {
+		Logger::writeLine("FullFeedforwardLayer::uploadInput(): Can't initialize kernel.");
+		return -1;
+	} else if (!initializeMemoryObjects(ocl, batch_size, training)) {
+		Logger::writeLine("FullFeedforwardLayer::uploadInput(): Can't initialize memory objects.");
+		return -1;
+	} else if (ocl->enqueueWriteMemoryContent(imemid, (const void*) input, num_inputs * batch_size * sizeof(float)) != OpenCLInterface::OpenCLError::SUCCESS) {
+		Logger::writeLine("FullFeedforwardLayer::uploadInput(): Unable to write input to the device.");
+		return -1;
+	}
+	return imemid;
+}
+
+bool FullFeedforwardLayer::computeDeviceOutput(int memid, unsigned int batch_size, bool training) {
 	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
 	if (ocl->isInitialized()) {
-		if (!initializeKernelObjects(ocl)) {
-			Logger::writeLine("FullFeedforwardLayer::computeOutput(): Can't initialize kernel. Unable to compute anything.");
-			return input;
-		} else if (!initializeMemoryObjects(ocl)) {
-			Logger::writeLine("FullFeedforwardLayer::computeOutput(): Can't initialize memory objects. Unable to compute anything.");
-			return input;
+		if (!initializeKernelObjects(ocl, training)) {
+			Logger::writeLine("FullFeedforwardLayer::computeDeviceOutput(): Can't initialize kernel. Unable to compute anything.");
+			return false;
+		} else if (!initializeMemoryObjects(ocl, batch_size, training)) {
+			Logger::writeLine("FullFeedforwardLayer::computeDeviceOutput(): Can't initialize memory objects. Unable to compute anything.");
+			return false;
 		} else {
-			std::vector<float> output(num_outputs);
-			ocl->writeMemoryContent(imemid, (void*) &input[0], num_inputs * sizeof(float));
 			OpenCLInterface::Dimension dim;
 			dim.x = num_outputs;
-			std::vector<int> memargs({imemid, wmemid, oememid, smemid});
+			std::vector<int> memargs({memid, wmemid, oememid, smemid});
 			std::vector<std::pair<void *, size_t>> constargs({std::make_pair((void *) &num_inputs, sizeof(unsigned int))});
-			OpenCLInterface::OpenCLError err = ocl->callKernel(okid, dim, memargs, constargs);
-			if (err != OpenCLInterface::OpenCLError::SUCCESS) {
-				Logger::writeLine("FullFeedforwardLayer::computeOutput(): Error when calling the OpenCL kernel.");
-				return input;
+			OpenCLInterface::OpenCLError err;
+			if (useTiledOutput()) {
+				OpenCLInterface::Dimension local;
+				local.x = FFTILEGROUPSIZE;
+				local.y = 1;
+				dim.x = (num_outputs + FFTILEGROUPSIZE * FFTILENEURONS - 1) / (FFTILEGROUPSIZE * FFTILENEURONS) * FFTILEGROUPSIZE;
+				dim.y = batch_size;
+				constargs.push_back(std::make_pair((void *) &num_outputs, sizeof(unsigned int)));
+				if (!training) memargs.pop_back();
+				err = ocl->enqueueKernel(training ? otkid : otikid, dim, local, memargs, constargs);
+			} else if (!training) {
+				dim.y = batch_size;
+				memargs.pop_back();
+				err = ocl->enqueueKernel(oikid, dim, memargs, constargs);
+			} else if (batch_size == 1) {
+				err = ocl->enqueueKernel(okid, dim, memargs, constargs);
 			} else {
-				ocl->getMemoryContent(oememid, (void *) &output[0], num_outputs * sizeof(float));
-				return output;
+				dim.y = batch_size;
+				err = ocl->enqueueKernel(obkid, dim, memargs, constargs);
+			}
+			if (err != OpenCLInterface::OpenCLError::SUCCESS) {
+				Logger::writeLine("FullFeedforwardLayer::computeDeviceOutput(): Error when calling the OpenCL kernel.");
+				return false;
 			}
+			input_memid = memid;
+			return true;
 		}
 	} else {
-		Logger::writeLine("FullFeedforwardLayer::computeOutput(): OpenCLInterface not initialized. Unable to compute anything.");
-		return input;
+		Logger::writeLine("FullFeedforwardLayer::computeDeviceOutput(): OpenCLInterface not initialized. Unable to compute anything.");
+		return false;
 	}
 }
 
-std::vector<float> FullFeedforwardLayer::computeError(const std::vector<float> &input) {
+int FullFeedforwardLayer::getOutputMemoryId() const {
+	return oememid;
+}
+
+std::vector<float> FullFeedforwardLayer::computeOutput(const std::vector<float> &input) {
 	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
 	if (ocl->isInitialized()) {
-		if (!initializeKernelObjects(ocl)) {
-			Logger::writeLine("FullFeedforwardLayer::computeError(): Can't initialize kernel. Unable to compute anything.");
+		int memid = uploadInput(&input[0], 1, true);
+		if (memid < 0) {
+			Logger::writeLine("FullFeedforwardLayer::computeOutput(): Can't upload input. Unable to compute anything.");
 			return input;
-		} else if (!initializeMemoryObjects(ocl)) {
-			Logger::writeLine("FullFeedforwardLayer::computeError(): Can't initialize memory objects. Unable to compute anything.");
+		} else if (!computeDeviceOutput(memid, 1, true)) {
 			return input;
 		} else {
-			std::vector<float> newerror(num_inputs);
-			ocl->writeMemoryContent(oememid, (void*) &input[0], num_outputs * sizeof(float));
+			std::vector<float> output(num_outputs);
+			ocl->getMemoryContent(oememid, (void *) &output[0], num_outputs * sizeof(float));
+			return output;
+		}
+	} else {
+		Logger::writeLine("FullFeedforwardLayer::computeOutput(): OpenCLInterface not initialized. Unable to compute anything.");
+		return input;
+	}
+}
 
+int FullFeedforwardLayer::uploadError(const float *error, unsigned int batch_size) {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (!ocl->isInitialized()) {
+		return -1;
+	} else if (!initializeKernelObjects(ocl)) {
+		Logger::writeLine("FullFeedforwardLayer::uploadError(): Can't initialize kernel.");
+		return -1;
+	} else if (!initializeMemoryObjects(ocl, batch_size)) {
+		Logger::writeLine("FullFeedforwardLayer::uploadError(): Can't initialize memory objects.");
+		return -1;
+	} else if (ocl->enqueueWriteMemoryContent(ememid, (const void*) error, num_outputs * batch_size * sizeof(float)) != OpenCLInterface::OpenCLError::SUCCESS) {
+		Logger::writeLine("FullFeedforwardLayer::uploadError(): Unable to write error to the device.");
+		return -1;
+	}
+	return ememid;
+}
+
+int FullFeedforwardLayer::computeDeviceError(int memid, unsigned int batch_size) {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (ocl->isInitialized()) {
+		if (!initializeKernelObjects(ocl)) {
+			Logger::writeLine("FullFeedforwardLayer::computeDeviceError(): Can't initialize kernel. Unable to compute anything.");
+			return -1;
+		} else if (!initializeMemoryObjects(ocl, batch_size)) {
+			Logger::writeLine("FullFeedforwardLayer::computeDeviceError(): Can't initialize memory objects. Unable to compute anything.");
+			return -1;
+		} else {
 			OpenCLInterface::Dimension dim;
+			dim.x = num_outputs;
+			dim.y = batch_size;
+			std::vector<int> memargs({memid, smemid, dmemid});
+			std::vector<std::pair<void *, size_t>> constargs;
+			OpenCLInterface::OpenCLError err = ocl->enqueueKernel(fbdkid, dim, memargs, constargs);
+			if (err != OpenCLInterface::OpenCLError::SUCCESS) {
+				Logger::writeLine("FullFeedforwardLayer::computeDeviceError(): Error when calling the OpenCL kernel for delta computation.");
+				return -1;
+			}
+			dim.x = num_inputs;
+			memargs = std::vector<int>({dmemid, wmemid, nememid});
+			constargs.push_back(std::make_pair((void *) &num_outputs, sizeof(unsigned int)));
+			err = ocl->enqueueKernel(fbekid, dim, memargs, constargs);
+			if (err != OpenCLInterface::OpenCLError::SUCCESS) {
+				Logger::writeLine("FullFeedforwardLayer::computeDeviceError(): Error when calling the OpenCL kernel for next error computation.");
+				return -1;
+			}
 			dim.x = num_inputs + 1;
-			std::vector<int> memargs({oememid, imemid, smemid, wmemid, nememid});
-			std::vector<std::pair<void *, size_t>> constargs({std::make_pair((void *) &num_outputs, sizeof(unsigned int)),
-																std::make_pair((void *) &learning, sizeof(float))});
-			OpenCLInterface::OpenCLError err = ocl->callKernel(fbkid, dim, memargs, constargs);
+			dim.y = num_outputs;
+			memargs = std::vector<int>({dmemid, input_memid, wmemid});
+			constargs.push_back(std::make_pair((void *) &batch_size, sizeof(unsigned int)));
+			constargs.push_back(std::make_pair((void *) &learning, sizeof(float)));
+			setProfilingLabel("weights");
+			err = ocl->enqueueKernel(fbwkid, dim, memargs, constargs);
 			if (err != OpenCLInterface::OpenCLError::SUCCESS) {
-				Logger::writeLine("FullFeedforwardLayer::computeError(): Error when calling the OpenCL kernel.");
-				return input;
-			} else {
-				ocl->getMemoryContent(nememid, (void *) &newerror[0], num_inputs * sizeof(float));
-				ocl->getMemoryContent(wmemid, (void *) &weights[0], num_inputs * num_outputs * sizeof(float));
-				return newerror;
+				Logger::writeLine("FullFeedforwardLayer::computeDeviceError(): Error when calling the OpenCL kernel for weights computation.");
+				return -1;
 			}
 		}
+		weights_dirty = true;
+		return nememid;
+	} else {
+		Logger::writeLine("FullFeedforwardLayer::computeDeviceError(): OpenCLInterface not initialized. Unable to compute anything.");
+		return -1;
+	}
+}
+
+std::vector<float> FullFeedforwardLayer::computeError(const std::vector<float> &input) {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (ocl->isInitialized()) {
+		int memid = uploadError(&input[0], 1);
+		if (memid < 0) {
+			Logger::writeLine("FullFeedforwardLayer::computeError(): Can't upload error. Unable to compute anything.");
+			return input;
+		}
+		int errmemid = computeDeviceError(memid, 1);
+		if (errmemid < 0) {
+			return input;
+		} else {
+			std::vector<float> newerror(num_inputs);
+			ocl->getMemoryContent(errmemid, (void *) &newerror[0], num_inputs * sizeof(float));
+			return newerror;
+		}
 	} else {
 		Logger::writeLine("FullFeedforwardLayer::computeError(): OpenCLInterface not initialized. Unable to compute anything.");
 		return input;
 	}
 }
 
+void FullFeedforwardLayer::computeHostOutput(const float *input, float *output, unsigned int batch_size, bool training) {
+	synchronizeWeights();
+	//same arithmetic as computeBatchOutput, one item per (neuron, sample)
+	ThreadPool::getInstance()->parallelFor(num_outputs * batch_size, [&](unsigned int begin, unsigned int end) {
+		for (unsigned int id = begin; id < end; id++) {
+			const float *sample = &input[(id / num_outputs) * num_inputs];
+			const float *row = &weights[(id % num_outputs) * (num_inputs + 1)];
+			float sum = 0.0f;
+			for (unsigned int i = 0; i < num_inputs; i++) {
+				sum += sample[i] * row[i];
+			}
+			sum += row[num_inputs];
+			if (training) netsums[id] = sum;
+			output[id] = act->compute(sum);
+		}
+	});
+}
+
+void FullFeedforwardLayer::computeHostError(const float *error, float *previous_error, unsigned int batch_size) {
+	const float *inputs = input_activations;
+	float *deltas = derivatives;
+	for (unsigned int i = 0; i < num_outputs * batch_size; i++) {
+		deltas[i] = error[i] * act->computeDerivative(netsums[i]);
+	}
+	std::fill(previous_error, previous_error + num_inputs * batch_size, 0.0f);
+	//rows are added in neuron order to a range of inputs, the same sums as computeBatchError without strided reads
+	ThreadPool::getInstance()->parallelFor(num_inputs, [&](unsigned int begin, unsigned int end) {
+		for (unsigned int s = 0; s < batch_size; s++) {
+			float *sum = &previous_error[s * num_inputs];
+			for (unsigned int i = 0; i < num_outputs; i++) {
+				float delta = deltas[s * num_outputs + i];
+				const float *row = &weights[i * (num_inputs + 1)];
+				for (unsigned int input_id = begin; input_id < end; input_id++) {
+					sum[input_id] += row[input_id] * delta;
+				}
+			}
+		}
+	});
+	//the weights are only adapted after all errors used the old ones, as on the device
+	ThreadPool::getInstance()->parallelFor(num_outputs, [&](unsigned int begin, unsigned int end) {
+		//kept by every thread, so the sums are only allocated for the first and larger layers
+		static thread_local std::vector<float> sums;
+		sums.resize(num_inputs + 1);
+		for (unsigned int neuron_id = begin; neuron_id < end; neuron_id++) {
+			float *row = &weights[neuron_id * (num_inputs + 1)];
+			std::fill(sums.begin(), sums.end(), 0.0f);
+			//samples in the outer loop keep the accesses contiguous, each sum still adds the samples in order
+			for (unsigned int s = 0; s < batch_size; s++) {
+				float delta = deltas[s * num_outputs + neuron_id];
+				const float *sample = &inputs[s * num_inputs];
+				for (unsigned int input_id = 0; input_id < num_inputs; input_id++) {
+					sums[input_id] += delta * sample[input_id];
+				}
+				sums[num_inputs] += delta;
+			}
+			for (unsigned int input_id = 0; input_id <= num_inputs; input_id++) {
+				row[input_id] += learning * sums[input_id];
+			}
+		}
+	});
+	if (wmemid >= 0) {
+		//outdated now, recreated from the host weights by the next device pass
+		OpenCLInterface::getInstance()->freeMemoryObject(wmemid);
+		wmemid = -1;
+	}
+}
+
 std::string FullFeedforwardLayer::getName() const {
 	return "FullFeedforwardLayer";
 }
 
+void FullFeedforwardLayer::synchronizeWeights() const {
+	if (released_weights > 0) {
+		weights.resize(released_weights);
+		released_weights = 0;
+		weights_dirty = true;
+	}
+	if (weights_dirty) {
+		std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+		setProfilingLabel("readback");
+		if (ocl->getMemoryContent(wmemid, (void *) &weights[0], weights.size() * sizeof(float)) != OpenCLInterface::OpenCLError::SUCCESS) {
+			Logger::writeLine("FullFeedforwardLayer::synchronizeWeights(): Unable to read weights from the device.");
+		} else {
+			weights_dirty = false;
+		}
+	}
+}
+
+bool FullFeedforwardLayer::copyWeights(std::vector<float> &output) const {
+	if ((released_weights == 0) && !weights_dirty) {
+		output = weights;
+		return true;
+	}
+	//read into the caller's buffer, a released host copy stays released
+	output.resize((released_weights > 0) ? released_weights : weights.size());
+	setProfilingLabel("readback");
+	if (OpenCLInterface::getInstance()->getMemoryContent(wmemid, (void *) &output[0], output.size() * sizeof(float)) != OpenCLInterface::OpenCLError::SUCCESS) {
+		Logger::writeLine("FullFeedforwardLayer::copyWeights(): Unable to read weights from the device.");
+		return false;
+	}
+	return true;
+}
+
 std::string FullFeedforwardLayer::getDatastring() const {
-	std::string repr = act->getName() + ":" + std::to_string(learning) + ":" + getVectorRepresentation<float>(weights, ';');
-	return repr;
+	std::vector<float> current;
+	copyWeights(current);
+	return getParameterString() + ":" + getVectorRepresentation<float>(current, ';');
+}
+
+std::string FullFeedforwardLayer::getParameterString() const {
+	return act->getName() + ":" + std::to_string(learning);
+}
+
+const std::vector<float> *FullFeedforwardLayer::getWeights() const {
+	synchronizeWeights();
+	return &weights;
+}
+
+bool FullFeedforwardLayer::loadWeightsToDevice(const float *weights, size_t num_weights, bool keep_host_copy) {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (!ocl->isInitialized()) {
+		Logger::writeLine("FullFeedforwardLayer::loadWeightsToDevice(): OpenCL system was not initialized.");
+		return false;
+	} else if (num_weights != (num_inputs + 1) * num_outputs) {
+		Logger::writeLine("FullFeedforwardLayer::loadWeightsToDevice(): Invalid number of weights.");
+		return false;
+	}
+	if (wmemid >= 0) {
+		ocl->freeMemoryObject(wmemid);
+	}
+	//copied while allocating, the buffer does not use the host memory afterwards
+	wmemid = ocl->allocateMemoryObject((void *) weights, num_weights * sizeof(float), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR);
+	if (wmemid < 0) {
+		Logger::writeLine("FullFeedforwardLayer::loadWeightsToDevice(): Unable to allocate the weights on the device.");
+		return false;
+	}
+	weights_dirty = false;
+	if (keep_host_copy) {
+		released_weights = 0;
+		if (this->weights.data() != weights) {
+			this->weights.assign(weights, weights + num_weights);
+		}
+	} else {
+		released_weights = num_weights;
+		std::vector<float>().swap(this->weights);
+	}
+	return true;
 }
 
 bool FullFeedforwardLayer::parseDatastring(std::string datastring) {
-	std::vector<std::string> data = parseVectorRepresentation<std::string>(datastring, ':');
-	if (data.size() != 3) {
-		Logger::writeLine("FullFeedforwardLayer::parseDatastring(): Invalid number of parameters.");
+	return parseDatastringWithWeights(datastring);
+}
+
+bool FullFeedforwardLayer::parseParameterString(std::string parameters, const float *weights, size_t num_weights) {
+	std::vector<std::string> data = parseVectorRepresentation<std::string>(parameters, ':');
+	if (data.size() != 2) {
+		Logger::writeLine("FullFeedforwardLayer::parseParameterString(): Invalid number of parameters.");
 		return false;
 	} else {
 		act = ActivationFunction::getObjectFromString(data[0]);
 		if (act == nullptr) {
-			Logger::writeLine("FullFeedforwardLayer::parseDatastring(): Invalid activation function identifier: " + data[0]);
+			Logger::writeLine("FullFeedforwardLayer::parseParameterString(): Invalid activation function identifier: " + data[0]);
 			return false;
 		}
 		learning = std::stof(data[1]);
-		weights = parseVectorRepresentation<float>(data[2], ';');
-		if(weights.size() != (num_inputs + 1) * num_outputs) {
-			Logger::writeLine("FullFeedforwardLayer::parseDatastring(): Invalid number of weights.");
+		if (num_weights != (num_inputs + 1) * num_outputs) {
+			Logger::writeLine("FullFeedforwardLayer::parseParameterString(): Invalid number of weights.");
 			return false;
 		}
+		//without weights they are passed to loadWeightsToDevice() afterwards
+		if (weights != nullptr) {
+			this->weights.assign(weights, weights + num_weights);
+		} else {
+			this->weights.clear();
+		}
+		released_weights = 0;
 	}
 	return true;
 }
 
+void FullFeedforwardLayer::freeTrainingObjects() {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (ememid >= 0) {
+		ocl->freeMemoryObject(ememid);
+		ememid = -1;
+	}
+	if (smemid >= 0) {
+		ocl->freeMemoryObject(smemid);
+		smemid = -1;
+	}
+	if (nememid >= 0) {
+		ocl->freeMemoryObject(nememid);
+		nememid = -1;
+	}
+	if (dmemid >= 0) {
+		ocl->freeMemoryObject(dmemid);
+		dmemid = -1;
+	}
+	if (okid >= 0) {
+		ocl->deleteKernel(okid);
+		okid = -1;
+	}
+	if (fbdkid >= 0) {
+		ocl->deleteKernel(fbdkid);
+		fbdkid = -1;
+	}
+	if (obkid >= 0) {
+		ocl->deleteKernel(obkid);
+		obkid = -1;
+	}
+	if (fbekid >= 0) {
+		ocl->deleteKernel(fbekid);
+		fbekid = -1;
+	}
+	if (fbwkid >= 0) {
+		ocl->deleteKernel(fbwkid);
+		fbwkid = -1;
+	}
+	if (otkid >= 0) {
+		ocl->deleteKernel(otkid);
+		otkid = -1;
+	}
+}
+
 FullFeedforwardLayer::~FullFeedforwardLayer() {
 	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
-	if (wmemid > 0) {
+	if (wmemid >= 0) {
 		ocl->freeMemoryObject(wmemid);
 	}
 	if (imemid > 0) {
@@ -191,17 +706,41 @@ FullFeedforwardLayer::~FullFeedforwardLayer() {
 	if (oememid > 0) {
 		ocl->freeMemoryObject(oememid);
 	}
+	if (ememid > 0) {
+		ocl->freeMemoryObject(ememid);
+	}
 	if (nememid > 0) {
 		ocl->freeMemoryObject(nememid);
 	}
 	if (smemid > 0) {
 		ocl->freeMemoryObject(smemid);
 	}
+	if (dmemid > 0) {
+		ocl->freeMemoryObject(dmemid);
+	}
 	if(okid > 0) {
 		ocl->deleteKernel(okid);
 	}
-	if(fbkid > 0) {
-		ocl->deleteKernel(okid);
+	if(fbdkid > 0) {
+		ocl->deleteKernel(fbdkid);
+	}
+	if(obkid > 0) {
+		ocl->deleteKernel(obkid);
+	}
+	if(fbekid > 0) {
+		ocl->deleteKernel(fbekid);
+	}
+	if(fbwkid > 0) {
+		ocl->deleteKernel(fbwkid);
+	}
+	if(oikid > 0) {
+		ocl->deleteKernel(oikid);
+	}
+	if(otkid > 0) {
+		ocl->deleteKernel(otkid);
+	}
+	if(otikid > 0) {
+		ocl->deleteKernel(otikid);
 	}
 }
 
@@ -16,31 +16,71 @@
 namespace clneural {
 
 class FullFeedforwardLayer: public NeuralNetworkLayer {
+public:
+	enum OutputKernel {
+		AUTOMATIC_KERNEL, //tiled kernel for layers with at least FFTILEMININPUTS inputs and FFTILEMINOUTPUTS outputs
+		ROW_KERNEL, //one work item per output
+		TILED_KERNEL //inputs staged in local memory, several outputs per work item
+	};
 private:
-	std::vector<float> weights;
+	static OutputKernel output_kernel;
+	mutable std::vector<float> weights;
+	mutable bool weights_dirty = false; //device weights changed since the last synchronization
+	mutable size_t released_weights = 0; //number of weights only held by the device, read back on demand
 	float learning = 0.5f;
 	std::shared_ptr<ActivationFunction> act;
 	static const std::string fwclcode;
-	static const std::string fbclcode;
+	static const std::string fbdeltaclcode;
+	static const std::string fwbatchclcode;
+	static const std::string fbbatcherrorclcode;
+	static const std::string fbbatchweightsclcode;
+	static const std::string fwtiledclcode;
 	int okid = -1;
-	int fbkid = -1;
+	int fbdkid = -1; //batched delta computation
+	int obkid = -1; //batched output computation
+	int fbekid = -1; //batched error computation for the previous layer
+	int fbwkid = -1; //batched weight adaption
+	int oikid = -1; //batched output computation without netsums (inference)
+	int otkid = -1; //tiled output computation
+	int otikid = -1; //tiled output computation without netsums (inference)
 	int wmemid = -1; //weights
 	int imemid = -1; //inputs
 	int nememid = -1; //errors for previous layer (delta)
-	int oememid = -1; //neuron outputs (after activation function) and error from next layer
+	int oememid = -1; //neuron outputs (after activation function)
+	int ememid = -1; //error from next layer
 	int smemid = -1; //neuron sums
-	bool initializeMemoryObjects(std::shared_ptr<OpenCLInterface> ocl);
-	bool initializeKernelObjects(std::shared_ptr<OpenCLInterface> ocl);
+	int dmemid = -1; //deltas of the error pass
+	bool initializeMemoryObjects(std::shared_ptr<OpenCLInterface> ocl, unsigned int batch_size = 1, bool training = true);
+	void freeBatchMemoryObjects(std::shared_ptr<OpenCLInterface> ocl);
+	bool initializeKernelObjects(std::shared_ptr<OpenCLInterface> ocl, bool training = true);
+	bool useTiledOutput() const;
 	static const NeuralNetworkLayerRegisterHelper<FullFeedforwardLayer> reg;
 protected:
 	virtual std::vector<float> computeOutput(const std::vector<float> &input);
 	virtual std::vector<float> computeError(const std::vector<float> &input);
+	virtual void computeHostOutput(const float *input, float *output, unsigned int batch_size, bool training);
+	virtual void computeHostError(const float *error, float *previous_error, unsigned int batch_size);
+	virtual int uploadInput(const float *input, unsigned int batch_size, bool training);
+	virtual bool computeDeviceOutput(int memid, unsigned int batch_size, bool training);
+	virtual int getOutputMemoryId() const;
+	virtual int uploadError(const float *error, unsigned int batch_size);
+	virtual int computeDeviceError(int memid, unsigned int batch_size);
+	virtual void freeTrainingObjects();
 	virtual std::string getName() const;
 	virtual std::string getDatastring() const;
 	virtual bool parseDatastring(std::string datastring);
+	virtual std::string getParameterString() const;
+	virtual bool parseParameterString(std::string parameters, const float *weights, size_t num_weights);
 public:
+	/* Selects the device kernel of the forward pass for all layers. Takes effect with the next forward pass. */
+	static void setOutputKernel(OutputKernel kernel);
+	static OutputKernel getOutputKernel();
 	FullFeedforwardLayer(unsigned int num_inputs, unsigned int num_outputs, std::shared_ptr<ActivationFunction> act, float learning);
 	FullFeedforwardLayer() = default;
+	virtual void synchronizeWeights() const;
+	virtual const std::vector<float> *getWeights() const;
+	virtual bool copyWeights(std::vector<float> &output) const;
+	virtual bool loadWeightsToDevice(const float *weights, size_t num_weights, bool keep_host_copy);
 	virtual ~FullFeedforwardLayer();
 };
 
@@ -0,0 +1,205 @@
+/*
+ * IdxFile.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "IdxFile.h"
+#include "Logger.h"
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+IdxFile::IdxFile() {
+}
+
+uint32_t IdxFile::readBigEndian(const uint8_t *data, unsigned int bytes) {
+	uint32_t value = 0;
+	for (unsigned int i = 0; i < bytes; i++) {
+		value = (value << 8) | data[i];
+	}
+	return value;
+}
+
+template<typename T> T IdxFile::readElement(const uint8_t *data) {
+	uint8_t swapped[sizeof(T)];
+	for (unsigned int i = 0; i < sizeof(T); i++) {
+		swapped[i] = data[sizeof(T) - 1 - i];
+	}
+	T value;
+	memcpy(&value, swapped, sizeof(T));
+	return value;
+}
+
+bool IdxFile::open(const std::string &filename) {
+	close();
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		Logger::writeLine("IdxFile::open(): File not found: \"" + filename + "\".");
+		return false;
+	}
+	struct stat filestat;
+	if ((fstat(fd, &filestat) == 0) && (filestat.st_size > 0)) {
+		mapping = mmap(NULL, filestat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping == MAP_FAILED) {
+			mapping = nullptr;
+		} else {
+			mapping_size = filestat.st_size;
+		}
+	}
+	//the mapping stays valid after closing the descriptor
+	::close(fd);
+	if (mapping == nullptr) {
+		Logger::writeLine("IdxFile::open(): Unable to map file: \"" + filename + "\".");
+		return false;
+	}
+	const uint8_t *header = (const uint8_t *) mapping;
+	unsigned int rank = 0;
+	element_bytes = 0;
+	//magic number: two zero bytes, the element type and the number of dimensions
+	if ((mapping_size >= 4) && (header[0] == 0) && (header[1] == 0)) {
+		type = (DataType) header[2];
+		rank = header[3];
+		switch (type) {
+			case UNSIGNED_BYTE:
+			case SIGNED_BYTE:
+				element_bytes = 1;
+				break;
+			case SHORT:
+				element_bytes = 2;
+				break;
+			case INT:
+			case FLOAT:
+				element_bytes = 4;
+				break;
+			case DOUBLE:
+				element_bytes = 8;
+				break;
+		}
+	}
+	if (element_bytes == 0) {
+		Logger::writeLine("IdxFile::open(): Invalid IDX header: \"" + filename + "\".");
+		close();
+		return false;
+	}
+	if ((rank < 1) || (mapping_size < 4 + 4 * (size_t) rank)) {
+		Logger::writeLine("IdxFile::open(): Invalid IDX header: \"" + filename + "\".");
+		close();
+		return false;
+	}
+	//every product is checked, a corrupt header must not wrap around and pass the size check below
+	item_size = 1;
+	bool overflow = false;
+	for (unsigned int i = 0; i < rank; i++) {
+		dimensions.push_back(readBigEndian(header + 4 + 4 * i, 4));
+		if (i > 0) {
+			overflow = overflow || ((dimensions[i] != 0) && (item_size > SIZE_MAX / element_bytes / dimensions[i]));
+			item_size *= dimensions[i];
+		}
+	}
+	size_t item_bytes = item_size * element_bytes;
+	if (overflow || ((dimensions[0] != 0) && (item_bytes > SIZE_MAX / dimensions[0]))) {
+		Logger::writeLine("IdxFile::open(): Invalid IDX dimensions: \"" + filename + "\".");
+		close();
+		return false;
+	}
+	payload = header + 4 + 4 * rank;
+	if (mapping_size - (payload - header) < ((size_t) dimensions[0]) * item_bytes) {
+		Logger::writeLine("IdxFile::open(): File truncated: \"" + filename + "\".");
+		close();
+		return false;
+	}
+	return true;
+}
+
+void IdxFile::close() {
+	if (mapping != nullptr) {
+		munmap(mapping, mapping_size);
+	}
+	mapping = nullptr;
+	mapping_size = 0;
+	payload = nullptr;
+	element_bytes = 0;
+	dimensions.clear();
+	item_size = 0;
+}
+
+bool IdxFile::isOpen() const {
+	return payload != nullptr;
+}
+
+IdxFile::DataType IdxFile::getType() const {
+	return type;
+}
+
+unsigned int IdxFile::getRank() const {
+	return dimensions.size();
+}
+
+const std::vector<unsigned int> &IdxFile::getDimensions() const {
+	return dimensions;
+}
+
+unsigned int IdxFile::getNumItems() const {
+	return dimensions.empty() ? 0 : dimensions[0];
+}
+
+std::vector<unsigned int> IdxFile::getItemShape() const {
+	if (dimensions.empty()) {
+		return std::vector<unsigned int>();
+	}
+	return std::vector<unsigned int>(dimensions.begin() + 1, dimensions.end());
+}
+
+size_t IdxFile::getItemSize() const {
+	return item_size;
+}
+
+const uint8_t *IdxFile::getRawItem(unsigned int index) const {
+	return payload + ((size_t) index) * item_size * element_bytes;
+}
+
+void IdxFile::readItems(unsigned int first, unsigned int count, float *output) const {
+	const uint8_t *data = getRawItem(first);
+	size_t size = ((size_t) count) * item_size;
+	switch (type) {
+		case UNSIGNED_BYTE:
+			for (size_t i = 0; i < size; i++) output[i] = data[i];
+			break;
+		case SIGNED_BYTE:
+			for (size_t i = 0; i < size; i++) output[i] = (int8_t) data[i];
+			break;
+		case SHORT:
+			for (size_t i = 0; i < size; i++) output[i] = readElement<int16_t>(data + 2 * i);
+			break;
+		case INT:
+			for (size_t i = 0; i < size; i++) output[i] = readElement<int32_t>(data + 4 * i);
+			break;
+		case FLOAT:
+			for (size_t i = 0; i < size; i++) output[i] = readElement<float>(data + 4 * i);
+			break;
+		case DOUBLE:
+			for (size_t i = 0; i < size; i++) output[i] = readElement<double>(data + 8 * i);
+			break;
+	}
+}
+
+void IdxFile::releaseItems(unsigned int first, unsigned int count) const {
+	//only whole pages inside the range may be dropped, the neighbouring items could still be in use
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t begin = getRawItem(first) - (const uint8_t *) mapping;
+	size_t end = getRawItem(first + count) - (const uint8_t *) mapping;
+	begin = (begin + page_size - 1) / page_size * page_size;
+	end = end / page_size * page_size;
+	if (end > begin) {
+		//the mapping is private and never written, dropped pages are read from the file again on access
+		madvise((uint8_t *) mapping + begin, end - begin, MADV_DONTNEED);
+	}
+}
+
+IdxFile::~IdxFile() {
+	close();
+}
@@ -0,0 +1,62 @@
+/*
+ * IdxFile.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef IDXFILE_H_
+#define IDXFILE_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/* Read-only memory-mapped IDX file of any element type and rank.
+ * The first dimension counts the items, the others give the shape of one item.
+ * Pages are only read when items are accessed, releaseItems() drops them again, so files larger than RAM can be streamed. */
+class IdxFile {
+public:
+	enum DataType {
+		UNSIGNED_BYTE = 0x08,
+		SIGNED_BYTE = 0x09,
+		SHORT = 0x0B,
+		INT = 0x0C,
+		FLOAT = 0x0D,
+		DOUBLE = 0x0E
+	};
+private:
+	void *mapping = nullptr;
+	size_t mapping_size = 0;
+	const uint8_t *payload = nullptr; //first element of the first item
+	DataType type = UNSIGNED_BYTE;
+	unsigned int element_bytes = 0;
+	std::vector<unsigned int> dimensions;
+	size_t item_size = 0; //elements per item
+	static uint32_t readBigEndian(const uint8_t *data, unsigned int bytes);
+	template<typename T> static T readElement(const uint8_t *data);
+public:
+	IdxFile();
+	IdxFile(const IdxFile &) = delete;
+	IdxFile &operator=(const IdxFile &) = delete;
+	/* Maps the file and validates the header, returns false (logging the reason) if it is no valid IDX file. */
+	bool open(const std::string &filename);
+	void close();
+	bool isOpen() const;
+	DataType getType() const;
+	unsigned int getRank() const;
+	const std::vector<unsigned int> &getDimensions() const;
+	unsigned int getNumItems() const;
+	/* Dimensions of one item, all but the first. */
+	std::vector<unsigned int> getItemShape() const;
+	size_t getItemSize() const;
+	/* Big-endian payload of an item, getItemSize() elements of the file's type. */
+	const uint8_t *getRawItem(unsigned int index) const;
+	/* Converts count items starting at first to floats. */
+	void readItems(unsigned int first, unsigned int count, float *output) const;
+	/* Tells the kernel that the pages of these items are not needed any more. */
+	void releaseItems(unsigned int first, unsigned int count) const;
+	virtual ~IdxFile();
+};
+
+#endif /* IDXFILE_H_ */
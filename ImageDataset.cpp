@@ -6,84 +6,74 @@
  */
 
 #include "ImageDataset.h"
+#include "NormalizeStage.h"
+#include "PadStage.h"
 #include "Logger.h"
-#include <fstream>
-#include <inttypes.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include "time.h"
 
+#define MATERIALIZECHUNK 1024 //samples converted before their pages are released
+
 ImageDataset::ImageDataset() {
 	randgen.seed(time(NULL));
+	stages.push_back(std::shared_ptr<SampleStage>(new NormalizeStage(0.0f, 255.0f, -0.1f, 1.175f)));
+	stages.push_back(std::shared_ptr<SampleStage>(new PadStage(2, -0.1f)));
+}
+
+void ImageDataset::freeSamples() {
+	if (samples != nullptr) {
+		free(samples);
+		samples = nullptr;
+	}
+}
+
+void ImageDataset::setStages(const std::vector<std::shared_ptr<SampleStage>> &stages) {
+	freeSamples();
+	this->stages = stages;
+	updateSampleShape();
+}
+
+void ImageDataset::updateSampleShape() {
+	sample_shape = image_file.getItemShape();
+	for (unsigned int i = 0; i < stages.size(); i++) {
+		sample_shape = stages[i]->getOutputShape(sample_shape);
+	}
+	sample_size = image_file.isOpen() ? 1 : 0;
+	for (unsigned int i = 0; i < sample_shape.size(); i++) sample_size *= sample_shape[i];
+	size_t alignment = SAMPLEALIGNMENT / sizeof(float);
+	sample_stride = (sample_size + alignment - 1) / alignment * alignment;
 }
 
 void ImageDataset::loadImagesFromFile(std::string imagefile) {
-	std::ifstream infile(imagefile, std::ifstream::in | std::ifstream::binary);
-	if (infile.is_open()) {
-		uint8_t magic_buf[4];
-		uint8_t dataset_size_buf[4];
-		uint32_t magic = 0;
-		uint32_t dataset_size = 0;
-		infile.read((char *) &magic_buf, 4);
-		infile.read((char *) &dataset_size_buf, 4);
-		for (unsigned int i = 0; i < 4; i++) {
-			magic |= ((uint32_t) magic_buf[i]) << (8*(3-i));
-			dataset_size |= ((uint32_t) dataset_size_buf[i]) << (8*(3-i));
-		}
-		if (magic == 0x00000803) {
-			uint8_t imagebuffer[IMAGESIZE*IMAGESIZE];
-			for (unsigned int i = 0; i < dataset_size; i++) {
-				infile.read((char *) &imagebuffer, IMAGESIZE*IMAGESIZE);
-				std::vector<float> newimage(64, -0.1f);
-				for (unsigned int y = 0; y < IMAGESIZE; y++) {
-					newimage.push_back(-0.1f);
-					newimage.push_back(-0.1f);
-					for (unsigned int x = 0; x < IMAGESIZE; x++) {
-						newimage.push_back(-0.1f + 1.275f * ((float) imagebuffer[y*IMAGESIZE + x])/255.0f);
-					}
-					newimage.push_back(-0.1f);
-					newimage.push_back(-0.1f);
-				}
-				for (unsigned int j = 0; j < 64; j++) newimage.push_back(-0.1f);
-				data.push_back(newimage);
-			}
-			Logger::writeLine("ImageDataset::loadImagesFromFile(): Loaded image file with " + std::to_string(dataset_size) + " images.");
-		} else {
-			Logger::writeLine("ImageDataset::loadImagesFromFile(): Invalid image file, no data loaded.");
+	freeSamples();
+	label_file.close();
+	elements.clear();
+	if (image_file.open(imagefile)) {
+		elements.resize(image_file.getNumItems());
+		for (uint32_t i = 0; i < elements.size(); i++) {
+			elements[i] = i;
 		}
+		Logger::writeLine("ImageDataset::loadImagesFromFile(): Loaded image file with " + std::to_string(elements.size()) + " images.");
 	} else {
-		Logger::writeLine("ImageDataset::loadImagesFromFile(): File not found: \"" + imagefile + "\".");
+		Logger::writeLine("ImageDataset::loadImagesFromFile(): No data loaded.");
 	}
+	updateSampleShape();
 }
 
 void ImageDataset::loadLabelsFromFile(std::string labelfile) {
-	if (data.size() > 0) {
-		std::ifstream infile(labelfile, std::ifstream::in | std::ifstream::binary);
-		if (infile.is_open()) {
-			uint8_t magic_buf[4];
-			uint8_t dataset_size_buf[4];
-			uint32_t magic = 0;
-			uint32_t dataset_size = 0;
-			infile.read((char *) &magic_buf, 4);
-			infile.read((char *) &dataset_size_buf, 4);
-			for (unsigned int i = 0; i < 4; i++) {
-				magic |= ((uint32_t) magic_buf[i]) << (8*(3-i));
-				dataset_size |= ((uint32_t) dataset_size_buf[i]) << (8*(3-i));
-			}
-			if (magic == 0x00000801) {
-				if (dataset_size == data.size()) {
-					uint8_t label;
-					for (unsigned int i = 0; i < dataset_size; i++) {
-						infile.read((char *) &label, 1);
-						labels.push_back(label);
-					}
-					Logger::writeLine("ImageDataset::loadLabelsFromFile(): Loaded label file with " + std::to_string(dataset_size) + " labels.");
-				} else {
-					Logger::writeLine("ImageDataset::loadLabelsFromFile(): Label file not suitable for this data set (number of labels not matching).");
-				}
-			} else {
+	if (image_file.isOpen()) {
+		if (label_file.open(labelfile)) {
+			if (label_file.getRank() != 1) {
 				Logger::writeLine("ImageDataset::loadLabelsFromFile(): Invalid label file, no data loaded.");
+				label_file.close();
+			} else if (label_file.getNumItems() != image_file.getNumItems()) {
+				Logger::writeLine("ImageDataset::loadLabelsFromFile(): Label file not suitable for this data set (number of labels not matching).");
+				label_file.close();
+			} else {
+				Logger::writeLine("ImageDataset::loadLabelsFromFile(): Loaded label file with " + std::to_string(label_file.getNumItems()) + " labels.");
 			}
-		} else {
-			Logger::writeLine("ImageDataset::loadLabelsFromFile(): File not found: \"" + labelfile + "\".");
 		}
 	} else {
 		Logger::writeLine("ImageDataset::loadLabelsFromFile(): No image data loaded, load image data before assigning labels.");
@@ -91,30 +81,152 @@ void ImageDataset::loadLabelsFromFile(std::string labelfile) {
 }
 
 unsigned int ImageDataset::getSize() const {
-	return data.size();
+	return elements.size();
+}
+
+unsigned int ImageDataset::getNumImages() const {
+	return image_file.getNumItems();
+}
+
+bool ImageDataset::hasLabels() const {
+	return label_file.isOpen();
 }
 
 std::pair<std::vector<float>, uint8_t> ImageDataset::popRandomElementWithLabel() {
-	std::uniform_int_distribution<unsigned int> dist(0, data.size() - 1);
+	std::uniform_int_distribution<unsigned int> dist(0, elements.size() - 1);
 	unsigned int randindex = dist(randgen);
-	std::vector<float> randelem = data[randindex];
-	std::swap(data[randindex], data.back());
-	data.pop_back();
-	uint8_t randlabel = labels[randindex];
-	std::swap(labels[randindex], labels.back());
-	labels.pop_back();
+	std::vector<float> randelem = (*this)[randindex];
+	uint8_t randlabel = (*this)(randindex);
+	std::swap(elements[randindex], elements.back());
+	elements.pop_back();
 	return std::make_pair(randelem, randlabel);
 }
 
+unsigned int ImageDataset::popRandomElement() {
+	std::uniform_int_distribution<unsigned int> dist(0, elements.size() - 1);
+	unsigned int randindex = dist(randgen);
+	unsigned int index = elements[randindex];
+	std::swap(elements[randindex], elements.back());
+	elements.pop_back();
+	return index;
+}
+
+unsigned int ImageDataset::getStorageIndex(unsigned int id) const {
+	return elements[id];
+}
+
+const std::vector<unsigned int> &ImageDataset::getSampleShape() const {
+	return sample_shape;
+}
+
+size_t ImageDataset::getSampleSize() const {
+	return sample_size;
+}
+
+size_t ImageDataset::getSampleStride() const {
+	return sample_stride;
+}
+
+bool ImageDataset::materialize() {
+	if (samples != nullptr) {
+		return true;
+	}
+	if (!image_file.isOpen()) {
+		Logger::writeLine("ImageDataset::materialize(): No image data loaded.");
+		return false;
+	}
+	unsigned int num_images = image_file.getNumItems();
+	void *buffer = nullptr;
+	if (posix_memalign(&buffer, SAMPLEALIGNMENT, std::max((size_t) 1, ((size_t) num_images) * sample_stride * sizeof(float))) != 0) {
+		Logger::writeLine("ImageDataset::materialize(): Unable to allocate the sample buffer.");
+		return false;
+	}
+	samples = (float *) buffer;
+	for (unsigned int first = 0; first < num_images; first += MATERIALIZECHUNK) {
+		unsigned int count = std::min((unsigned int) MATERIALIZECHUNK, num_images - first);
+		for (unsigned int i = first; i < first + count; i++) {
+			convertSample(i, samples + ((size_t) i) * sample_stride);
+		}
+		image_file.releaseItems(first, count);
+	}
+	return true;
+}
+
+bool ImageDataset::isMaterialized() const {
+	return samples != nullptr;
+}
+
+const float *ImageDataset::getSample(unsigned int index) const {
+	return getSamples(index, 1);
+}
+
+const float *ImageDataset::getSamples(unsigned int first, unsigned int count) const {
+	unsigned int num_images = image_file.getNumItems();
+	if ((samples == nullptr) || (first > num_images) || (count > num_images - first)) {
+		return nullptr;
+	}
+	return samples + ((size_t) first) * sample_stride;
+}
+
+uint8_t ImageDataset::getLabel(unsigned int index) const {
+	if (label_file.getType() == IdxFile::UNSIGNED_BYTE) {
+		return *label_file.getRawItem(index);
+	}
+	float label = 0.0f;
+	label_file.readItems(index, 1, &label);
+	return (uint8_t) label;
+}
+
+void ImageDataset::copySample(unsigned int index, float *output) const {
+	if (samples != nullptr) {
+		memcpy(output, samples + ((size_t) index) * sample_stride, sample_size * sizeof(float));
+	} else {
+		convertSample(index, output);
+	}
+}
+
+void ImageDataset::convertSample(unsigned int index, float *output) const {
+	if (stages.empty()) {
+		image_file.readItems(index, 1, output);
+		return;
+	}
+	//every thread converting samples keeps its own intermediate buffers
+	static thread_local std::vector<float> buffers[2];
+	std::vector<unsigned int> shape = image_file.getItemShape();
+	buffers[0].resize(image_file.getItemSize());
+	image_file.readItems(index, 1, &buffers[0][0]);
+	for (unsigned int i = 0; i < stages.size(); i++) {
+		std::vector<unsigned int> output_shape = stages[i]->getOutputShape(shape);
+		float *stage_output = output;
+		if (i + 1 < stages.size()) {
+			size_t size = 1;
+			for (unsigned int j = 0; j < output_shape.size(); j++) size *= output_shape[j];
+			buffers[(i + 1) % 2].resize(size);
+			stage_output = &buffers[(i + 1) % 2][0];
+		}
+		stages[i]->apply(shape, &buffers[i % 2][0], stage_output);
+		shape = output_shape;
+	}
+}
+
+const uint8_t *ImageDataset::getRawImage(unsigned int id) const {
+	return image_file.getRawItem(elements[id]);
+}
+
+void ImageDataset::getImage(unsigned int id, float *output) const {
+	copySample(elements[id], output);
+}
+
 std::vector<float> ImageDataset::operator[](unsigned int id) const {
-	return data[id];
+	std::vector<float> image(sample_size);
+	getImage(id, &image[0]);
+	return image;
 }
 
 uint8_t ImageDataset::operator()(unsigned int id) const {
-	return labels[id];
+	return getLabel(elements[id]);
 }
 
 ImageDataset::~ImageDataset() {
-
+	freeSamples();
 }
-
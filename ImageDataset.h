@@ -8,25 +8,73 @@
 #ifndef IMAGEDATASET_H_
 #define IMAGEDATASET_H_
 
+#include "IdxFile.h"
+#include "SampleStage.h"
 #include <string>
 #include <vector>
+#include <memory>
 #include <random>
+#include <cstdint>
 
-#define IMAGESIZE 28
+#define SAMPLEALIGNMENT 64
 
+/* Samples and labels from memory-mapped IDX files. Samples stay in the file's format until they are accessed,
+ * then they are converted to float and passed through the stages. The default stages scale bytes to [-0.1, 1.175]
+ * and pad by 2 with -0.1, turning 28x28 MNIST digits into 32x32 inputs.
+ * materialize() converts all samples once into a flat, 64-byte aligned buffer in file order, getSampleStride() floats apart,
+ * getSample() and getSamples() point into it without copying.
+ * Element ids (operator[], operator(), getImage()) index the elements not popped yet, storage indices the position in the file. */
 class ImageDataset {
 private:
-	std::vector<std::vector<float>> data;
-	std::vector<uint8_t> labels;
+	IdxFile image_file;
+	IdxFile label_file;
+	std::vector<std::shared_ptr<SampleStage>> stages;
+	std::vector<unsigned int> sample_shape; //after all stages
+	size_t sample_size = 0;
+	size_t sample_stride = 0; //sample_size rounded up to SAMPLEALIGNMENT
+	std::vector<uint32_t> elements; //storage indices of the elements not popped yet
+	float *samples = nullptr; //materialized samples, sample_stride floats each
 	std::default_random_engine randgen;
+	void updateSampleShape();
+	void convertSample(unsigned int index, float *output) const;
+	void freeSamples();
 public:
 	ImageDataset();
+	ImageDataset(const ImageDataset &) = delete;
+	ImageDataset &operator=(const ImageDataset &) = delete;
+	/* Replaces the preprocessing stages, applied in order. Drops materialized samples. */
+	void setStages(const std::vector<std::shared_ptr<SampleStage>> &stages);
 	void loadImagesFromFile(std::string imagefile);
 	void loadLabelsFromFile(std::string labelfile);
 	std::pair<std::vector<float>, uint8_t> popRandomElementWithLabel();
+	/* Removes a random element without copying it and returns its storage index. */
+	unsigned int popRandomElement();
+	unsigned int getStorageIndex(unsigned int id) const;
+	/* Shape and number of floats of a sample after all stages. */
+	const std::vector<unsigned int> &getSampleShape() const;
+	size_t getSampleSize() const;
+	size_t getSampleStride() const;
+	/* Converts all samples into the sample buffer, returns false if no samples are loaded or the allocation fails.
+	 * The file is read in chunks that are dropped from the page cache right after conversion. */
+	bool materialize();
+	bool isMaterialized() const;
+	/* getSampleSize() floats of the sample at a storage index, nullptr if not materialized. */
+	const float *getSample(unsigned int index) const;
+	/* count consecutive samples starting at storage index first, getSampleStride() floats apart. nullptr if not materialized or out of range. */
+	const float *getSamples(unsigned int first, unsigned int count) const;
+	uint8_t getLabel(unsigned int index) const;
+	/* Writes the sample at a storage index to getSampleSize() floats at output, converting it if not materialized. */
+	void copySample(unsigned int index, float *output) const;
+	/* Raw big-endian data of an element, pointing into the mapped file. */
+	const uint8_t *getRawImage(unsigned int id) const;
+	/* Writes the converted element to getSampleSize() floats at output. */
+	void getImage(unsigned int id, float *output) const;
 	std::vector<float> operator[](unsigned int id) const;
 	uint8_t operator()(unsigned int id) const;
 	unsigned int getSize() const;
+	/* Number of samples in the file, popped ones included. Storage indices range up to this. */
+	unsigned int getNumImages() const;
+	bool hasLabels() const;
 	virtual ~ImageDataset();
 };
 
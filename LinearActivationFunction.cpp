@@ -28,6 +28,14 @@ std::string LinearActivationFunction::getDerivCode() const {
 	return code;
 }
 
+float LinearActivationFunction::compute(float input) const {
+	return input;
+}
+
+float LinearActivationFunction::computeDerivative(float input) const {
+	return 1.0f;
+}
+
 std::string LinearActivationFunction::getName() const {
 	return "LinearActivationFunction";
 }
@@ -18,6 +18,8 @@ private:
 public:
 	virtual std::string getCode() const;
 	virtual std::string getDerivCode() const;
+	virtual float compute(float input) const;
+	virtual float computeDerivative(float input) const;
 	virtual std::string getName() const;
 	LinearActivationFunction();
 	virtual ~LinearActivationFunction();
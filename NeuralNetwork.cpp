@@ -6,21 +6,56 @@
  */
 
 #include "Logger.h"
+#include "OpenCLInterface.h"
 #include <cmath>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "NeuralNetwork.h"
 
+#define MODEL_MAGIC "CLNEURAL"
+#define MODEL_VERSION 1
+#define MODEL_BYTE_ORDER 0x01020304
+#define MODEL_ALIGNMENT 64
+
 namespace clneural {
 
+/* Binary model file: header, one descriptor per layer, the parameter representations of all layers and then the
+ * weights of every layer as raw floats, each blob starting at a multiple of MODEL_ALIGNMENT. Numbers are stored in
+ * the byte order of the writing machine, byte_order tells the reader whether it matches. */
+struct ModelHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t num_layers;
+	uint32_t reserved;
+};
+
+struct ModelLayerDescriptor {
+	uint64_t parameter_offset;
+	uint64_t parameter_length;
+	uint64_t weights_offset;
+	uint64_t num_weights;
+};
+
 NeuralNetwork::NeuralNetwork() {
 }
 
 NeuralNetwork::~NeuralNetwork() {
+	waitForCheckpoint();
 }
 
 bool NeuralNetwork::addLayer(std::shared_ptr<NeuralNetworkLayer> layer) {
 	if ((first_layer == nullptr) && (last_layer == nullptr)) {
+		layer->setInferenceOnly(inference_only);
 		first_layer = layer;
 		last_layer = layer;
 		return true;
@@ -29,12 +64,24 @@ bool NeuralNetwork::addLayer(std::shared_ptr<NeuralNetworkLayer> layer) {
 		Logger::writeLine("NeuralNetwork::addLayer(): Inputs not matching outputs for layer to be added.");
 		return false;
 	}
+	layer->setInferenceOnly(inference_only);
 	last_layer->setNextLayer(layer);
 	layer->setPreviousLayer(last_layer);
 	last_layer = layer;
 	return true;
 }
 
+void NeuralNetwork::setInferenceOnly(bool inference_only) {
+	this->inference_only = inference_only;
+	for (std::shared_ptr<NeuralNetworkLayer> layer = first_layer; layer != nullptr; layer = layer->getNextLayer()) {
+		layer->setInferenceOnly(inference_only);
+	}
+}
+
+bool NeuralNetwork::isInferenceOnly() const {
+	return inference_only;
+}
+
 std::vector<float> NeuralNetwork::getLastOutput() const {
 	if (last_layer == nullptr) {
 		return std::vector<float>();
@@ -42,6 +89,13 @@ std::vector<float> NeuralNetwork::getLastOutput() const {
 	return last_layer->getLastOutput();
 }
 
+ActivationArena::View NeuralNetwork::getLastOutputView() const {
+	if (last_layer == nullptr) {
+		return ActivationArena::View();
+	}
+	return last_layer->getLastOutputView();
+}
+
 void NeuralNetwork::processInput(const std::vector<float> &input) {
 	if (first_layer != nullptr) {
 		first_layer->processAndForwardInput(input);
@@ -52,18 +106,108 @@ float NeuralNetwork::trainNetwork(const std::vector<float> &input, const std::ve
 	if (first_layer == nullptr) {
 		return 0.0f;
 	}
+	if (inference_only) {
+		Logger::writeLine("NeuralNetwork::trainNetwork(): The network is inference-only.");
+		return 0.0f;
+	}
 	processInput(input);
-	std::vector<float> out = getLastOutput();
-	std::vector<float> dif(out.size());
+	ActivationArena::View out = getLastOutputView();
+	output_errors.resize(out.size());
 	float dist = 0.0f;
 	for (unsigned int i = 0; i < out.size(); i++) {
-		dif[i] = desired_output[i] - out[i];
-		dist += dif[i]*dif[i];
+		output_errors[i] = desired_output[i] - out[i];
+		dist += output_errors[i]*output_errors[i];
 	}
-	last_layer->processAndForwardError(dif);
+	last_layer->processAndForwardError(output_errors);
 	return sqrt(dist);
 }
 
+void NeuralNetwork::synchronizeWeights() const {
+	std::shared_ptr<NeuralNetworkLayer> iterator = first_layer;
+	while (iterator != nullptr) {
+		iterator->synchronizeWeights();
+		iterator = iterator->getNextLayer();
+	}
+}
+
+float NeuralNetwork::trainBatch(const std::vector<std::vector<float>> &inputs, const std::vector<std::vector<float>> &desired_outputs) {
+	if ((first_layer == nullptr) || (inputs.size() < 1)) {
+		return 0.0f;
+	}
+	if (inputs.size() != desired_outputs.size()) {
+		Logger::writeLine("NeuralNetwork::trainBatch(): Number of inputs not matching the number of desired outputs.");
+		return 0.0f;
+	}
+	unsigned int batch_size = inputs.size();
+	unsigned int num_inputs = first_layer->getNumInputs();
+	unsigned int num_outputs = last_layer->getNumOutputs();
+	std::vector<float> batch(batch_size * num_inputs);
+	std::vector<float> desired(batch_size * num_outputs);
+	for (unsigned int i = 0; i < batch_size; i++) {
+		if ((inputs[i].size() != num_inputs) || (desired_outputs[i].size() != num_outputs)) {
+			Logger::writeLine("NeuralNetwork::trainBatch(): Invalid input vector length.");
+			return 0.0f;
+		}
+		std::copy(inputs[i].begin(), inputs[i].end(), batch.begin() + i * num_inputs);
+		std::copy(desired_outputs[i].begin(), desired_outputs[i].end(), desired.begin() + i * num_outputs);
+	}
+	return trainBatch(batch, desired, batch_size);
+}
+
+float NeuralNetwork::trainBatch(const std::vector<float> &inputs, const std::vector<float> &desired_outputs, unsigned int batch_size) {
+	if ((first_layer == nullptr) || (batch_size < 1)) {
+		return 0.0f;
+	}
+	if ((inputs.size() != batch_size * first_layer->getNumInputs()) || (desired_outputs.size() != batch_size * last_layer->getNumOutputs())) {
+		Logger::writeLine("NeuralNetwork::trainBatch(): Invalid batch length.");
+		return 0.0f;
+	}
+	return trainBatch(&inputs[0], &desired_outputs[0], batch_size);
+}
+
+float NeuralNetwork::trainBatch(const float *inputs, const float *desired_outputs, unsigned int batch_size) {
+	if ((first_layer == nullptr) || (batch_size < 1)) {
+		return 0.0f;
+	}
+	if (inference_only) {
+		Logger::writeLine("NeuralNetwork::trainBatch(): The network is inference-only.");
+		return 0.0f;
+	}
+	unsigned int num_outputs = last_layer->getNumOutputs();
+	first_layer->processAndForwardBatch(inputs, batch_size);
+	ActivationArena::View out = getLastOutputView();
+	//only grows, the same batch size needs no allocation
+	output_errors.resize(out.size());
+	float *dif = &output_errors[0];
+	float dist = 0.0f;
+	for (unsigned int i = 0; i < batch_size; i++) {
+		float sampledist = 0.0f;
+		for (unsigned int j = 0; j < num_outputs; j++) {
+			dif[i * num_outputs + j] = desired_outputs[i * num_outputs + j] - out[i * num_outputs + j];
+			sampledist += dif[i * num_outputs + j] * dif[i * num_outputs + j];
+		}
+		dist += sqrt(sampledist);
+	}
+	last_layer->processAndForwardBatchError(dif, batch_size);
+	return dist;
+}
+
+std::vector<float> NeuralNetwork::processBatch(const std::vector<float> &inputs, unsigned int batch_size) {
+	if ((first_layer == nullptr) || (batch_size < 1)) {
+		return std::vector<float>();
+	}
+	first_layer->processAndForwardBatch(inputs, batch_size, false);
+	return getLastOutput();
+}
+
+ActivationArena::View NeuralNetwork::processBatch(const float *inputs, unsigned int batch_size) {
+	if ((first_layer == nullptr) || (batch_size < 1)) {
+		return ActivationArena::View();
+	}
+	first_layer->processAndForwardBatch(inputs, batch_size, false);
+	return getLastOutputView();
+}
+
 std::string NeuralNetwork::getStringRepresentation() const {
 	std::string repr;
 	std::shared_ptr<NeuralNetworkLayer> iterator = first_layer;
@@ -90,7 +234,7 @@ bool NeuralNetwork::parseStringRepresentation(std::string repr) {
 			res = false;
 		}
 		lastpos = newpos + 1;
-		newpos = repr.find_first_of('\n', 0);
+		newpos = repr.find_first_of('\n', lastpos);
 	}
 	return res;
 }
@@ -106,16 +250,257 @@ bool NeuralNetwork::saveToFile(std::string filename) const {
 	return true;
 }
 
-bool NeuralNetwork::loadFromFile(std::string filename) {
+bool NeuralNetwork::useDeviceWeights(WeightPlacement placement) const {
+	if (placement == HOST_WEIGHTS) {
+		return false;
+	} else if ((NeuralNetworkLayer::getBackend() != NeuralNetworkLayer::OPENCL) || !OpenCLInterface::getInstance()->isInitialized()) {
+		Logger::writeLine("NeuralNetwork::useDeviceWeights(): No OpenCL device in use, keeping the weights on the host.");
+		return false;
+	}
+	return true;
+}
+
+bool NeuralNetwork::loadFromFile(std::string filename, WeightPlacement placement) {
 	std::ifstream file(filename, std::ios::in);
 	if (!file.is_open()) {
 		Logger::writeLine("NeuralNetwork::loadFromFile(): Unable to open file: " + filename);
 		return false;
 	}
+	char magic[8] = {0};
+	file.read(magic, sizeof(magic));
+	if (file.gcount() == sizeof(magic) && (memcmp(magic, MODEL_MAGIC, sizeof(magic)) == 0)) {
+		file.close();
+		return loadFromBinaryFile(filename, placement);
+	}
+	file.seekg(0);
+	file.clear();
 	std::stringstream content;
 	content << file.rdbuf();
-	parseStringRepresentation(content.str());
+	if (!parseStringRepresentation(content.str())) {
+		return false;
+	}
+	if (useDeviceWeights(placement)) {
+		for (std::shared_ptr<NeuralNetworkLayer> iterator = first_layer; iterator != nullptr; iterator = iterator->getNextLayer()) {
+			const std::vector<float> *weights = iterator->getWeights();
+			if ((weights != nullptr) && !iterator->loadWeightsToDevice(weights->data(), weights->size(), placement == DEVICE_WEIGHTS)) {
+				Logger::writeLine("NeuralNetwork::loadFromFile(): Unable to load the weights to the device: " + filename);
+				return false;
+			}
+		}
+	}
 	return true;
 }
 
+std::string NeuralNetwork::getBinaryRepresentation() const {
+	std::vector<std::string> parameters;
+	std::vector<std::vector<float>> weights;
+	//the weights are copied, weights only held by the device are not brought back to the host
+	for (std::shared_ptr<NeuralNetworkLayer> iterator = first_layer; iterator != nullptr; iterator = iterator->getNextLayer()) {
+		parameters.push_back(iterator->getParameterRepresentation());
+		weights.push_back(std::vector<float>());
+		if (!iterator->copyWeights(weights.back())) {
+			return "";
+		}
+	}
+	ModelHeader header;
+	memcpy(header.magic, MODEL_MAGIC, sizeof(header.magic));
+	header.version = MODEL_VERSION;
+	header.byte_order = MODEL_BYTE_ORDER;
+	header.num_layers = parameters.size();
+	header.reserved = 0;
+	std::vector<ModelLayerDescriptor> descriptors(parameters.size());
+	uint64_t offset = sizeof(ModelHeader) + descriptors.size() * sizeof(ModelLayerDescriptor);
+	for (unsigned int i = 0; i < descriptors.size(); i++) {
+		descriptors[i].parameter_offset = offset;
+		descriptors[i].parameter_length = parameters[i].size();
+		offset += parameters[i].size();
+	}
+	for (unsigned int i = 0; i < descriptors.size(); i++) {
+		offset = (offset + MODEL_ALIGNMENT - 1) / MODEL_ALIGNMENT * MODEL_ALIGNMENT;
+		descriptors[i].weights_offset = offset;
+		descriptors[i].num_weights = weights[i].size();
+		offset += descriptors[i].num_weights * sizeof(float);
+	}
+	//the padding stays zero, everything else is copied to its offset
+	std::string repr(offset, '\0');
+	memcpy(&repr[0], &header, sizeof(header));
+	if (!descriptors.empty()) {
+		memcpy(&repr[sizeof(header)], &descriptors[0], descriptors.size() * sizeof(ModelLayerDescriptor));
+	}
+	for (unsigned int i = 0; i < descriptors.size(); i++) {
+		memcpy(&repr[descriptors[i].parameter_offset], parameters[i].data(), parameters[i].size());
+		if (descriptors[i].num_weights > 0) {
+			memcpy(&repr[descriptors[i].weights_offset], &weights[i][0], descriptors[i].num_weights * sizeof(float));
+		}
+	}
+	return repr;
+}
+
+bool NeuralNetwork::saveToBinaryFile(std::string filename) const {
+	std::string repr = getBinaryRepresentation();
+	if (repr.empty()) {
+		Logger::writeLine("NeuralNetwork::saveToBinaryFile(): Unable to read the weights: " + filename);
+		return false;
+	}
+	std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		Logger::writeLine("NeuralNetwork::saveToBinaryFile(): Unable to open file: " + filename);
+		return false;
+	}
+	file.write(repr.data(), repr.size());
+	file.close();
+	if (file.fail()) {
+		Logger::writeLine("NeuralNetwork::saveToBinaryFile(): Unable to write file: " + filename);
+		return false;
+	}
+	return true;
+}
+
+bool NeuralNetwork::writeCheckpoint(const std::string &repr, std::string filename, unsigned int num_kept) {
+	std::string tmpname = filename + ".tmp";
+	int fd = open(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		Logger::writeLine("NeuralNetwork::writeCheckpoint(): Unable to open file: " + tmpname);
+		return false;
+	}
+	size_t written = 0;
+	while (written < repr.size()) {
+		ssize_t res = write(fd, repr.data() + written, repr.size() - written);
+		if (res < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		written += res;
+	}
+	//the data has to be on disk before the rename makes it visible
+	bool res = (written == repr.size()) && (fsync(fd) == 0);
+	res = (close(fd) == 0) && res;
+	if (!res) {
+		Logger::writeLine("NeuralNetwork::writeCheckpoint(): Unable to write file: " + tmpname);
+		unlink(tmpname.c_str());
+		return false;
+	}
+	//filename.1 is the previous checkpoint, filename.2 the one before and so on, the oldest is overwritten
+	for (unsigned int i = num_kept; i > 2; i--) {
+		std::string older = filename + "." + std::to_string(i - 1);
+		std::string newer = filename + "." + std::to_string(i - 2);
+		if ((rename(newer.c_str(), older.c_str()) != 0) && (errno != ENOENT)) {
+			Logger::writeLine("NeuralNetwork::writeCheckpoint(): Unable to rotate file: " + newer);
+		}
+	}
+	//the current checkpoint gets a second name instead of being moved, so filename always holds a complete model
+	if (num_kept > 1) {
+		std::string previous = filename + ".1";
+		if ((unlink(previous.c_str()) != 0) && (errno != ENOENT)) {
+			Logger::writeLine("NeuralNetwork::writeCheckpoint(): Unable to remove file: " + previous);
+		} else if ((link(filename.c_str(), previous.c_str()) != 0) && (errno != ENOENT)) {
+			Logger::writeLine("NeuralNetwork::writeCheckpoint(): Unable to rotate file: " + filename);
+		}
+	}
+	if (rename(tmpname.c_str(), filename.c_str()) != 0) {
+		Logger::writeLine("NeuralNetwork::writeCheckpoint(): Unable to replace file: " + filename);
+		unlink(tmpname.c_str());
+		return false;
+	}
+	//the renames are only durable once the directory is on disk
+	size_t pos = filename.find_last_of('/');
+	std::string directory = (pos == std::string::npos) ? "." : ((pos == 0) ? "/" : filename.substr(0, pos));
+	int dirfd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+	if ((dirfd < 0) || (fsync(dirfd) != 0)) {
+		Logger::writeLine("NeuralNetwork::writeCheckpoint(): Unable to sync directory: " + directory);
+		res = false;
+	}
+	if (dirfd >= 0) {
+		close(dirfd);
+	}
+	return res;
+}
+
+bool NeuralNetwork::saveCheckpoint(std::string filename, unsigned int num_kept) {
+	std::string repr = getBinaryRepresentation();
+	bool last_res = waitForCheckpoint();
+	if (repr.empty()) {
+		Logger::writeLine("NeuralNetwork::saveCheckpoint(): Unable to read the weights: " + filename);
+		checkpoint_result = false;
+		return last_res;
+	}
+	checkpoint_thread = std::thread([this, filename, num_kept](std::string repr) {
+		checkpoint_result = writeCheckpoint(repr, filename, num_kept);
+	}, std::move(repr));
+	return last_res;
+}
+
+bool NeuralNetwork::waitForCheckpoint() {
+	if (checkpoint_thread.joinable()) {
+		checkpoint_thread.join();
+	}
+	return checkpoint_result;
+}
+
+bool NeuralNetwork::loadFromBinaryFile(std::string filename, WeightPlacement placement) {
+	bool device = useDeviceWeights(placement);
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		Logger::writeLine("NeuralNetwork::loadFromBinaryFile(): Unable to open file: " + filename);
+		return false;
+	}
+	struct stat filestat;
+	void *mapping = MAP_FAILED;
+	if (fstat(fd, &filestat) == 0) {
+		mapping = mmap(NULL, filestat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		Logger::writeLine("NeuralNetwork::loadFromBinaryFile(): Unable to map file: " + filename);
+		return false;
+	}
+	const char *data = (const char *) mapping;
+	uint64_t size = filestat.st_size;
+	ModelHeader header;
+	bool res = true;
+	if (size >= sizeof(ModelHeader)) {
+		memcpy(&header, data, sizeof(ModelHeader));
+	}
+	if ((size < sizeof(ModelHeader)) || (memcmp(header.magic, MODEL_MAGIC, sizeof(header.magic)) != 0)) {
+		Logger::writeLine("NeuralNetwork::loadFromBinaryFile(): Not a binary model file: " + filename);
+		res = false;
+	} else if (header.byte_order != MODEL_BYTE_ORDER) {
+		Logger::writeLine("NeuralNetwork::loadFromBinaryFile(): Model file written with a different byte order: " + filename);
+		res = false;
+	} else if (header.version != MODEL_VERSION) {
+		Logger::writeLine("NeuralNetwork::loadFromBinaryFile(): Unsupported model file version " + std::to_string(header.version) + ": " + filename);
+		res = false;
+	} else if (size < sizeof(ModelHeader) + ((uint64_t) header.num_layers) * sizeof(ModelLayerDescriptor)) {
+		Logger::writeLine("NeuralNetwork::loadFromBinaryFile(): Model file truncated: " + filename);
+		res = false;
+	}
+	for (unsigned int i = 0; res && (i < header.num_layers); i++) {
+		ModelLayerDescriptor descriptor;
+		memcpy(&descriptor, data + sizeof(ModelHeader) + i * sizeof(ModelLayerDescriptor), sizeof(ModelLayerDescriptor));
+		if ((descriptor.parameter_offset > size) || (descriptor.parameter_length > size - descriptor.parameter_offset)
+				|| (descriptor.weights_offset % MODEL_ALIGNMENT != 0) || (descriptor.weights_offset > size)
+				|| (descriptor.num_weights > (size - descriptor.weights_offset) / sizeof(float))) {
+			Logger::writeLine("NeuralNetwork::loadFromBinaryFile(): Invalid layer descriptor " + std::to_string(i) + ": " + filename);
+			res = false;
+			break;
+		}
+		//the blobs are aligned, so the weights are copied straight out of the mapping, into the device buffers if requested
+		std::string parameters(data + descriptor.parameter_offset, descriptor.parameter_length);
+		const float *weights = (const float *) (data + descriptor.weights_offset);
+		std::shared_ptr<NeuralNetworkLayer> layer = NeuralNetworkLayer::createFromParameterRepresentation(parameters, device ? nullptr : weights, descriptor.num_weights);
+		if (layer == nullptr) {
+			Logger::writeLine("NeuralNetwork::loadFromBinaryFile(): Unable to parse layer " + std::to_string(i) + ": " + filename);
+			res = false;
+		} else if (device && !layer->loadWeightsToDevice(weights, descriptor.num_weights, placement == DEVICE_WEIGHTS)) {
+			Logger::writeLine("NeuralNetwork::loadFromBinaryFile(): Unable to load the weights of layer " + std::to_string(i) + " to the device: " + filename);
+			res = false;
+		} else if (!addLayer(layer)) {
+			Logger::writeLine("NeuralNetwork::loadFromBinaryFile(): Unable to add layer " + std::to_string(i) + ": " + filename);
+			res = false;
+		}
+	}
+	munmap(mapping, size);
+	return res;
+}
+
 } /* namespace clneural */
@@ -9,25 +9,69 @@
 #define NEURALNETWORK_H_
 
 #include <memory>
+#include <thread>
 #include "NeuralNetworkLayer.h"
 
 namespace clneural {
 
 class NeuralNetwork {
+public:
+	enum WeightPlacement {
+		HOST_WEIGHTS, //host vectors, uploaded by the first device pass
+		DEVICE_WEIGHTS, //uploaded while loading, the host copy is kept
+		DEVICE_WEIGHTS_ONLY //uploaded while loading, the host copy is only read back when needed
+	};
 private:
 	std::shared_ptr<NeuralNetworkLayer> first_layer = nullptr;
 	std::shared_ptr<NeuralNetworkLayer> last_layer = nullptr;
+	std::vector<float> output_errors; //errors of the last layer, reused by every training step
+	std::thread checkpoint_thread; //writes the last snapshot taken by saveCheckpoint()
+	bool checkpoint_result = true; //result of the last finished checkpoint write
+	bool inference_only = false; //applied to every added layer
+	std::string getBinaryRepresentation() const; //empty if the weights could not be read
+	bool useDeviceWeights(WeightPlacement placement) const;
+	static bool writeCheckpoint(const std::string &repr, std::string filename, unsigned int num_kept);
 
 public:
 	NeuralNetwork();
 	bool addLayer(std::shared_ptr<NeuralNetworkLayer> layer);
+	/* Runs all layers inference-only, see NeuralNetworkLayer::setInferenceOnly(). Set before loading a model to never create
+	 * any training state, layers added later follow the setting. Training is refused until it is switched off again. */
+	void setInferenceOnly(bool inference_only);
+	bool isInferenceOnly() const;
 	std::vector<float> getLastOutput() const;
+	/* The outputs of the last pass in place, valid until the next pass. */
+	ActivationArena::View getLastOutputView() const;
 	void processInput(const std::vector<float> &input);
 	float trainNetwork(const std::vector<float> &input, const std::vector<float> &desired_output);
+	/* Trains with all samples at once, applying one weight update accumulated over the batch. Returns the summed euclidean distance of the outputs. */
+	float trainBatch(const std::vector<std::vector<float>> &inputs, const std::vector<std::vector<float>> &desired_outputs);
+	/* Same with batch_size inputs and desired outputs stored consecutively. */
+	float trainBatch(const std::vector<float> &inputs, const std::vector<float> &desired_outputs, unsigned int batch_size);
+	/* Same without length checks. Once the activations are planned for batch_size, a step allocates nothing on the host. */
+	float trainBatch(const float *inputs, const float *desired_outputs, unsigned int batch_size);
+	/* Forward pass only for batch_size samples stored consecutively in inputs. No netsums or error buffers are set up, so no training may follow. Returns the outputs of all samples. */
+	std::vector<float> processBatch(const std::vector<float> &inputs, unsigned int batch_size);
+	/* Same returning a view of the outputs in place, valid until the next pass. */
+	ActivationArena::View processBatch(const float *inputs, unsigned int batch_size);
+	void synchronizeWeights() const;
 	bool parseStringRepresentation(std::string repr);
 	std::string getStringRepresentation() const;
+	/* Text format, readable but rounded to six decimal places. */
 	bool saveToFile(std::string filename) const;
-	bool loadFromFile(std::string filename);
+	/* Loads text and binary model files. With the device placements the weights are uploaded while loading,
+	 * binary files straight from the mapped file. Without an initialized OpenCL backend they stay on the host. */
+	bool loadFromFile(std::string filename, WeightPlacement placement = HOST_WEIGHTS);
+	/* Versioned binary format with the exact weights as aligned raw float blobs. */
+	bool saveToBinaryFile(std::string filename) const;
+	bool loadFromBinaryFile(std::string filename, WeightPlacement placement = HOST_WEIGHTS);
+	/* Takes a snapshot of all weights in the binary format and writes it on a background thread, blocking only for the copy
+	 * (and for the previous checkpoint if it is still being written). The file is written as filename.tmp and renamed over
+	 * filename, the previous num_kept - 1 checkpoints are kept as filename.1, filename.2, ... Returns false if the previous
+	 * checkpoint failed. */
+	bool saveCheckpoint(std::string filename, unsigned int num_kept = 2);
+	/* Waits until the last checkpoint is on disk, returns whether writing it succeeded. */
+	bool waitForCheckpoint();
 	virtual ~NeuralNetwork();
 };
 
@@ -6,13 +6,26 @@
  */
 
 #include "Logger.h"
+#include "OpenCLInterface.h"
 #include <exception>
+#include <algorithm>
+#include <cstring>
 #include "NeuralNetworkLayer.h"
 
 namespace clneural {
 
 std::unordered_map<std::string, std::shared_ptr<NeuralNetworkLayer> (*)()> *NeuralNetworkLayerRegister::typemap = nullptr;
 
+NeuralNetworkLayer::Backend NeuralNetworkLayer::backend = NeuralNetworkLayer::Backend::OPENCL;
+
+void NeuralNetworkLayer::setBackend(Backend backend) {
+	NeuralNetworkLayer::backend = backend;
+}
+
+NeuralNetworkLayer::Backend NeuralNetworkLayer::getBackend() {
+	return backend;
+}
+
 NeuralNetworkLayer::NeuralNetworkLayer(unsigned int num_inputs, unsigned int num_outputs) :
 	num_inputs(num_inputs),
 	num_outputs(num_outputs)
@@ -35,12 +48,194 @@ unsigned int NeuralNetworkLayer::getNumOutputs() const {
 	return num_outputs;
 }
 
+unsigned int NeuralNetworkLayer::getLastBatchSize() const {
+	return batch_size;
+}
+
+void NeuralNetworkLayer::fetchLastInput() const {
+	if (last_input_on_device) {
+		setProfilingLabel("readback");
+		OpenCLInterface::getInstance()->getMemoryContent(input_memid, (void *) input_activations, num_inputs * batch_size * sizeof(float));
+		last_input_on_device = false;
+	}
+}
+
+void NeuralNetworkLayer::fetchLastOutput() const {
+	if (last_output_on_device) {
+		setProfilingLabel("readback");
+		OpenCLInterface::getInstance()->getMemoryContent(getOutputMemoryId(), (void *) output_activations, num_outputs * batch_size * sizeof(float));
+		last_output_on_device = false;
+	}
+}
+
+ActivationArena::View NeuralNetworkLayer::getLastInputView() const {
+	ActivationArena::View view;
+	if (arena != nullptr) {
+		fetchLastInput();
+		view.values = input_activations;
+		view.num_values = num_inputs * batch_size;
+	}
+	return view;
+}
+
+ActivationArena::View NeuralNetworkLayer::getLastOutputView() const {
+	ActivationArena::View view;
+	if (arena != nullptr) {
+		fetchLastOutput();
+		view.values = output_activations;
+		view.num_values = num_outputs * batch_size;
+	}
+	return view;
+}
+
 std::vector<float> NeuralNetworkLayer::getLastInput() const {
-	return last_input;
+	ActivationArena::View view = getLastInputView();
+	return std::vector<float>(view.begin(), view.end());
 }
 
 std::vector<float> NeuralNetworkLayer::getLastOutput() const {
-	return last_output;
+	ActivationArena::View view = getLastOutputView();
+	return std::vector<float>(view.begin(), view.end());
+}
+
+void NeuralNetworkLayer::planActivations(unsigned int batch_capacity) {
+	NeuralNetworkLayer *first = this;
+	while (first->previous_layer != nullptr) first = first->previous_layer.get();
+	bool inference = true;
+	size_t max_width = first->num_inputs;
+	for (NeuralNetworkLayer *layer = first; layer != nullptr; layer = layer->next_layer.get()) {
+		inference = inference && layer->inference_only;
+		max_width = std::max(max_width, (size_t) layer->num_outputs);
+	}
+	std::shared_ptr<ActivationArena> arena(new ActivationArena());
+	if (inference) {
+		//no error pass follows, every layer overwrites the inputs of its previous layer
+		size_t offsets[2];
+		offsets[0] = arena->reserve(max_width * batch_capacity);
+		offsets[1] = arena->reserve(max_width * batch_capacity);
+		if (!arena->allocate()) {
+			throw new std::runtime_error("NeuralNetworkLayer::planActivations(): Unable to allocate the activations.");
+		}
+		unsigned int region = 0;
+		for (NeuralNetworkLayer *layer = first; layer != nullptr; layer = layer->next_layer.get()) {
+			layer->arena = arena;
+			layer->activation_capacity = batch_capacity;
+			layer->input_activations = arena->getRegion(offsets[region % 2]);
+			layer->output_activations = arena->getRegion(offsets[(region + 1) % 2]);
+			layer->input_errors = nullptr;
+			layer->output_errors = nullptr;
+			layer->netsums = nullptr;
+			layer->derivatives = nullptr;
+			region++;
+		}
+		return;
+	}
+	size_t input_offset = arena->reserve(((size_t) first->num_inputs) * batch_capacity);
+	size_t input_error_offset = arena->reserve(((size_t) first->num_inputs) * batch_capacity);
+	//outputs, output errors, netsums and derivatives of every layer
+	std::vector<size_t> offsets;
+	for (NeuralNetworkLayer *layer = first; layer != nullptr; layer = layer->next_layer.get()) {
+		for (unsigned int i = 0; i < 4; i++) {
+			offsets.push_back(arena->reserve(((size_t) layer->num_outputs) * batch_capacity));
+		}
+	}
+	if (!arena->allocate()) {
+		throw new std::runtime_error("NeuralNetworkLayer::planActivations(): Unable to allocate the activations.");
+	}
+	float *inputs = arena->getRegion(input_offset);
+	float *errors = arena->getRegion(input_error_offset);
+	unsigned int region = 0;
+	for (NeuralNetworkLayer *layer = first; layer != nullptr; layer = layer->next_layer.get()) {
+		layer->arena = arena;
+		layer->activation_capacity = batch_capacity;
+		layer->input_activations = inputs;
+		layer->input_errors = errors;
+		layer->output_activations = arena->getRegion(offsets[region++]);
+		layer->output_errors = arena->getRegion(offsets[region++]);
+		layer->netsums = arena->getRegion(offsets[region++]);
+		layer->derivatives = arena->getRegion(offsets[region++]);
+		inputs = layer->output_activations;
+		errors = layer->output_errors;
+	}
+}
+
+void NeuralNetworkLayer::reserveActivations(unsigned int batch_size) {
+	if (batch_size > activation_capacity) {
+		planActivations(batch_size);
+	}
+}
+
+void NeuralNetworkLayer::setInferenceOnly(bool inference_only) {
+	if (this->inference_only == inference_only) {
+		return;
+	}
+	this->inference_only = inference_only;
+	if (inference_only) {
+		last_pass_training = false;
+		freeTrainingObjects();
+	}
+	planActivations(std::max(activation_capacity, 1U));
+}
+
+bool NeuralNetworkLayer::isInferenceOnly() const {
+	return inference_only;
+}
+
+void NeuralNetworkLayer::freeTrainingObjects() {
+}
+
+int NeuralNetworkLayer::uploadInput(const float *input, unsigned int batch_size, bool training) {
+	return -1;
+}
+
+bool NeuralNetworkLayer::computeDeviceOutput(int memid, unsigned int batch_size, bool training) {
+	return false;
+}
+
+int NeuralNetworkLayer::getOutputMemoryId() const {
+	return -1;
+}
+
+int NeuralNetworkLayer::uploadError(const float *error, unsigned int batch_size) {
+	return -1;
+}
+
+int NeuralNetworkLayer::computeDeviceError(int memid, unsigned int batch_size) {
+	return -1;
+}
+
+void NeuralNetworkLayer::computeHostOutput(const float *input, float *output, unsigned int batch_size, bool training) {
+	if (batch_size != 1) {
+		throw new std::runtime_error("NeuralNetworkLayer::computeHostOutput(): Batches can only be processed on the device.");
+	}
+	std::vector<float> result = computeOutput(std::vector<float>(input, input + num_inputs));
+	if (result.size() != num_outputs) {
+		throw new std::runtime_error("NeuralNetworkLayer::computeHostOutput(): Invalid output vector length.");
+	}
+	std::copy(result.begin(), result.end(), output);
+}
+
+void NeuralNetworkLayer::computeHostError(const float *error, float *previous_error, unsigned int batch_size) {
+	if (batch_size != 1) {
+		throw new std::runtime_error("NeuralNetworkLayer::computeHostError(): Batches can only be processed on the device.");
+	}
+	std::vector<float> result = computeError(std::vector<float>(error, error + num_outputs));
+	if (result.size() != num_inputs) {
+		throw new std::runtime_error("NeuralNetworkLayer::computeHostError(): Invalid error vector length.");
+	}
+	std::copy(result.begin(), result.end(), previous_error);
+}
+
+void NeuralNetworkLayer::synchronizeWeights() const {
+}
+
+void NeuralNetworkLayer::setProfilingLabel(const std::string &pass) const {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (ocl->isProfiling()) {
+		unsigned int position = 0;
+		for (std::shared_ptr<NeuralNetworkLayer> it = previous_layer; it != nullptr; it = it->previous_layer) position++;
+		ocl->setProfilingLabel(std::to_string(position) + " " + getName(), pass);
+	}
 }
 
 std::shared_ptr<NeuralNetworkLayer> NeuralNetworkLayer::getNextLayer() const {
@@ -52,21 +247,129 @@ std::shared_ptr<NeuralNetworkLayer> NeuralNetworkLayer::getPreviousLayer() const
 }
 
 void NeuralNetworkLayer::processAndForwardInput(const std::vector<float> &input) {
-	std::vector<float> output = computeOutput(input);
-	if (output.size() != num_outputs) {
-		throw new std::runtime_error("NeuralNetworkLayer::processAndForwardInput(): Invalid output vector length.");
+	processAndForwardBatch(input, 1, true);
+}
+
+void NeuralNetworkLayer::processAndForwardBatch(const std::vector<float> &inputs, unsigned int batch_size, bool training) {
+	if ((batch_size < 1) || (inputs.size() != num_inputs * batch_size)) {
+		throw new std::runtime_error("NeuralNetworkLayer::processAndForwardBatch(): Invalid input batch length.");
+	}
+	processAndForwardBatch(&inputs[0], batch_size, training);
+}
+
+void NeuralNetworkLayer::processAndForwardBatch(const float *inputs, unsigned int batch_size, bool training) {
+	if (batch_size < 1) {
+		throw new std::runtime_error("NeuralNetworkLayer::processAndForwardBatch(): Invalid input batch length.");
+	}
+	training = training && !inference_only;
+	reserveActivations(batch_size);
+	//the outputs of the previous layer already are the inputs
+	if (inputs != input_activations) {
+		memcpy(input_activations, inputs, num_inputs * batch_size * sizeof(float));
 	}
-	last_output = output;
-	last_input = input;
-	if (next_layer != nullptr) next_layer->processAndForwardInput(output);
+	int memid = -1;
+	if ((backend == Backend::OPENCL) && OpenCLInterface::getInstance()->isInitialized()) {
+		setProfilingLabel("upload");
+		memid = uploadInput(input_activations, batch_size, training);
+	}
+	if (memid < 0) {
+		processAndForwardHostInput(batch_size, training);
+	} else {
+		processAndForwardDeviceInput(memid, batch_size, training);
+		//the whole pass is only enqueued, wait once so the caller may release the input
+		OpenCLInterface::getInstance()->finish();
+	}
+}
+
+void NeuralNetworkLayer::processAndForwardDeviceInput(int memid, unsigned int batch_size, bool training) {
+	training = training && !inference_only;
+	reserveActivations(batch_size);
+	this->batch_size = batch_size;
+	last_pass_training = training;
+	setProfilingLabel("forward");
+	if (!computeDeviceOutput(memid, batch_size, training)) {
+		input_memid = memid;
+		last_input_on_device = true;
+		fetchLastInput();
+		processAndForwardHostInput(batch_size, training);
+		return;
+	}
+	last_pass_on_device = true;
+	last_input_on_device = true;
+	last_output_on_device = true;
+	if (next_layer != nullptr) next_layer->processAndForwardDeviceInput(getOutputMemoryId(), batch_size, training);
+}
+
+void NeuralNetworkLayer::processAndForwardHostInput(unsigned int batch_size, bool training) {
+	computeHostOutput(input_activations, output_activations, batch_size, training);
+	this->batch_size = batch_size;
+	last_pass_training = training;
+	last_pass_on_device = false;
+	last_output_on_device = false;
+	last_input_on_device = false;
+	if (next_layer != nullptr) next_layer->processAndForwardBatch(output_activations, batch_size, training);
 }
 
 void NeuralNetworkLayer::processAndForwardError(const std::vector<float> &error) {
-	std::vector<float> newerror = computeError(error);
-	if (newerror.size() != num_inputs) {
-		throw new std::runtime_error("NeuralNetworkLayer::processAndForwardError(): Invalid error vector length.");
+	processAndForwardBatchError(error, 1);
+}
+
+void NeuralNetworkLayer::processAndForwardBatchError(const std::vector<float> &errors, unsigned int batch_size) {
+	if (errors.size() != num_outputs * batch_size) {
+		throw new std::runtime_error("NeuralNetworkLayer::processAndForwardBatchError(): Error batch not matching the last input batch.");
 	}
-	if (previous_layer != nullptr) previous_layer->processAndForwardError(newerror);
+	processAndForwardBatchError(&errors[0], batch_size);
+}
+
+void NeuralNetworkLayer::processAndForwardBatchError(const float *errors, unsigned int batch_size) {
+	if (inference_only) {
+		throw new std::runtime_error("NeuralNetworkLayer::processAndForwardBatchError(): The layer is inference-only.");
+	}
+	if ((batch_size != this->batch_size) || (batch_size > activation_capacity)) {
+		throw new std::runtime_error("NeuralNetworkLayer::processAndForwardBatchError(): Error batch not matching the last input batch.");
+	}
+	if (!last_pass_training) {
+		throw new std::runtime_error("NeuralNetworkLayer::processAndForwardBatchError(): The last forward pass was not a training pass.");
+	}
+	//the input errors of the next layer already are the output errors
+	if (errors != output_errors) {
+		memcpy(output_errors, errors, num_outputs * batch_size * sizeof(float));
+	}
+	int memid = -1;
+	if (last_pass_on_device) {
+		setProfilingLabel("upload");
+		memid = uploadError(output_errors, batch_size);
+	}
+	if (memid < 0) {
+		processAndForwardHostError(batch_size);
+	} else {
+		processAndForwardDeviceError(memid, batch_size);
+		OpenCLInterface::getInstance()->finish();
+	}
+}
+
+void NeuralNetworkLayer::processAndForwardDeviceError(int memid, unsigned int batch_size) {
+	if (inference_only) {
+		throw new std::runtime_error("NeuralNetworkLayer::processAndForwardDeviceError(): The layer is inference-only.");
+	}
+	if (!last_pass_on_device) {
+		OpenCLInterface::getInstance()->getMemoryContent(memid, (void *) output_errors, num_outputs * batch_size * sizeof(float));
+		processAndForwardHostError(batch_size);
+		return;
+	}
+	setProfilingLabel("error");
+	int newmemid = computeDeviceError(memid, batch_size);
+	if (newmemid < 0) {
+		//the netsums of the forward pass only exist on the device
+		throw new std::runtime_error("NeuralNetworkLayer::processAndForwardDeviceError(): Unable to compute the error on the device.");
+	}
+	if (previous_layer != nullptr) previous_layer->processAndForwardDeviceError(newmemid, batch_size);
+}
+
+void NeuralNetworkLayer::processAndForwardHostError(unsigned int batch_size) {
+	fetchLastInput();
+	computeHostError(output_errors, input_errors, batch_size);
+	if (previous_layer != nullptr) previous_layer->processAndForwardBatchError(input_errors, batch_size);
 }
 
 bool NeuralNetworkLayer::setNextLayer(std::shared_ptr<NeuralNetworkLayer> newNextLayer) {
@@ -77,6 +380,8 @@ bool NeuralNetworkLayer::setNextLayer(std::shared_ptr<NeuralNetworkLayer> newNex
 		return false;
 	}
 	next_layer = newNextLayer;
+	//the new layer shares the arena of the chain from now on
+	planActivations(std::max(activation_capacity, 1U));
 	return true;
 }
 
@@ -95,7 +400,58 @@ std::string NeuralNetworkLayer::getStringRepresentation() const {
 	return getName() + ":" + std::to_string(num_inputs) + ":" + std::to_string(num_outputs) + ":" + getDatastring();
 }
 
+std::string NeuralNetworkLayer::getParameterRepresentation() const {
+	return getName() + ":" + std::to_string(num_inputs) + ":" + std::to_string(num_outputs) + ":" + getParameterString();
+}
+
+std::string NeuralNetworkLayer::getParameterString() const {
+	return getDatastring();
+}
+
+bool NeuralNetworkLayer::parseParameterString(std::string parameters, const float *weights, size_t num_weights) {
+	if (num_weights != 0) {
+		Logger::writeLine("NeuralNetworkLayer::parseParameterString(): " + getName() + " has no weights.");
+		return false;
+	}
+	return parseDatastring(parameters);
+}
+
+bool NeuralNetworkLayer::parseDatastringWithWeights(std::string datastring) {
+	size_t pos = datastring.find_last_of(':');
+	if (pos == std::string::npos) {
+		Logger::writeLine("NeuralNetworkLayer::parseDatastringWithWeights(): No weights in datastring.");
+		return false;
+	}
+	std::vector<float> weights = parseVectorRepresentation<float>(datastring.substr(pos + 1), ';');
+	return parseParameterString(datastring.substr(0, pos), &weights[0], weights.size());
+}
+
+const std::vector<float> *NeuralNetworkLayer::getWeights() const {
+	return nullptr;
+}
+
+bool NeuralNetworkLayer::copyWeights(std::vector<float> &output) const {
+	output.clear();
+	return true;
+}
+
+bool NeuralNetworkLayer::loadWeightsToDevice(const float *weights, size_t num_weights, bool keep_host_copy) {
+	if (num_weights != 0) {
+		Logger::writeLine("NeuralNetworkLayer::loadWeightsToDevice(): " + getName() + " has no weights.");
+		return false;
+	}
+	return true;
+}
+
 std::shared_ptr<NeuralNetworkLayer> NeuralNetworkLayer::createFromStringRepresentation(std::string repr) {
+	return createFromRepresentation(repr, false, nullptr, 0);
+}
+
+std::shared_ptr<NeuralNetworkLayer> NeuralNetworkLayer::createFromParameterRepresentation(std::string repr, const float *weights, size_t num_weights) {
+	return createFromRepresentation(repr, true, weights, num_weights);
+}
+
+std::shared_ptr<NeuralNetworkLayer> NeuralNetworkLayer::createFromRepresentation(std::string repr, bool binary, const float *weights, size_t num_weights) {
 	size_t newpos = repr.find_first_of(':', 0);
 	std::string name = repr.substr(0, newpos);
 	size_t lastpos = newpos + 1;
@@ -107,13 +463,18 @@ std::shared_ptr<NeuralNetworkLayer> NeuralNetworkLayer::createFromStringRepresen
 		newpos = repr.find_first_of(':', lastpos);
 		layer->num_outputs = std::stoi(repr.substr(lastpos, newpos - lastpos));
 		lastpos = newpos + 1;
-		bool res = layer->parseDatastring(repr.substr(lastpos, repr.length() - lastpos));
+		bool res;
+		if (binary) {
+			res = layer->parseParameterString(repr.substr(lastpos, repr.length() - lastpos), weights, num_weights);
+		} else {
+			res = layer->parseDatastring(repr.substr(lastpos, repr.length() - lastpos));
+		}
 		if (!res) {
-			Logger::writeLine("NeuralNetworkLayer::createFromStringRepresentation(): Error while parsing datastring for " + name + ".");
+			Logger::writeLine("NeuralNetworkLayer::createFromRepresentation(): Error while parsing datastring for " + name + ".");
 			return nullptr;
 		}
 	} else {
-		Logger::writeLine("NeuralNetworkLayer::createFromStringRepresentation(): Unable to create a layer for the given class name: " + name);
+		Logger::writeLine("NeuralNetworkLayer::createFromRepresentation(): Unable to create a layer for the given class name: " + name);
 	}
 	return layer;
 }
@@ -12,24 +12,83 @@
 #include <memory>
 #include <unordered_map>
 #include <sstream>
+#include "ActivationArena.h"
 
 namespace clneural {
 
 class NeuralNetworkLayer {
+public:
+	enum Backend {
+		OPENCL, //OpenCL kernels, falling back to NATIVE if no OpenCL device is initialized
+		NATIVE //multithreaded host code, no OpenCL runtime needed
+	};
 private:
+	static Backend backend;
 	std::shared_ptr<NeuralNetworkLayer> next_layer = nullptr;
 	std::shared_ptr<NeuralNetworkLayer> previous_layer = nullptr;
+	mutable bool last_input_on_device = false;
+	mutable bool last_output_on_device = false;
+	std::shared_ptr<ActivationArena> arena = nullptr; //shared by all layers of the chain
+	unsigned int activation_capacity = 0; //samples the arena regions are planned for
+	bool last_pass_training = true; //false if the last forward pass skipped the state needed for backpropagation
+	bool last_pass_on_device = false; //the state of the last forward pass is kept in device buffers
+	bool inference_only = false; //no training state, see setInferenceOnly()
 	static std::shared_ptr<NeuralNetworkLayer> getObjectFromString(std::string name);
+	static std::shared_ptr<NeuralNetworkLayer> createFromRepresentation(std::string repr, bool binary, const float *weights, size_t num_weights);
+	void processAndForwardHostInput(unsigned int batch_size, bool training);
+	void processAndForwardHostError(unsigned int batch_size);
+	/* Plans the arena again from the first layer of the chain if batch_size samples do not fit. */
+	void reserveActivations(unsigned int batch_size);
+	void fetchLastInput() const;
+	void fetchLastOutput() const;
 protected:
 	unsigned int num_inputs = 0;
 	unsigned int num_outputs = 0;
-	std::vector<float> last_input;
-	std::vector<float> last_output;
+	unsigned int batch_size = 1; //samples processed in the last forward pass
+	unsigned int batch_capacity = 0; //samples the per-sample device buffers are allocated for
+	int input_memid = -1; //device buffer bound as input during the last forward pass
+	/* Regions of the arena for activation_capacity samples. The outputs and output errors of a layer are the inputs and
+	 * input errors of the next one, so forwarding does not copy. netsums and derivatives are per output and free for the
+	 * layer to use between its forward and its error pass. */
+	float *input_activations = nullptr;
+	float *output_activations = nullptr;
+	float *input_errors = nullptr;
+	float *output_errors = nullptr;
+	float *netsums = nullptr;
+	float *derivatives = nullptr;
 	virtual std::vector<float> computeOutput(const std::vector<float> &input) = 0;
+	/* Device path: copies a host input batch into the layer's own input buffer and returns its memory id (-1 if not available).
+	 * Without training only the buffers needed for the forward pass are allocated. */
+	virtual int uploadInput(const float *input, unsigned int batch_size, bool training);
+	/* Device path: computes the output from the given device buffer, leaving it in the buffer returned by getOutputMemoryId().
+	 * Without training the netsums needed for backpropagation are not stored. */
+	virtual bool computeDeviceOutput(int memid, unsigned int batch_size, bool training);
+	virtual int getOutputMemoryId() const;
 	virtual std::vector<float> computeError(const std::vector<float> &input) = 0;
+	/* Host path: writes the outputs of a batch to output without OpenCL, with training also the netsums.
+	 * The default only handles single samples via computeOutput(). */
+	virtual void computeHostOutput(const float *input, float *output, unsigned int batch_size, bool training);
+	/* Host path: adapts the weights and writes the error batch for the previous layer to previous_error.
+	 * The default only handles single samples via computeError(). */
+	virtual void computeHostError(const float *error, float *previous_error, unsigned int batch_size);
+	/* Device path: copies a host error batch into the layer's own error buffer and returns its memory id (-1 if not available). */
+	virtual int uploadError(const float *error, unsigned int batch_size);
+	/* Device path: adapts the weights to the error in the given device buffer and returns the memory id of the error for the previous layer (-1 on failure). */
+	virtual int computeDeviceError(int memid, unsigned int batch_size);
+	/* Releases the device buffers and kernels only needed for training, called when the layer becomes inference-only.
+	 * They are created again if the layer is switched back. The default is for layers without training state. */
+	virtual void freeTrainingObjects();
+	/* Labels subsequently enqueued device commands with this layer and the given pass if profiling is enabled. */
+	void setProfilingLabel(const std::string &pass) const;
 	virtual std::string getName() const = 0;
 	virtual std::string getDatastring() const = 0;
 	virtual bool parseDatastring(std::string datastring) = 0;
+	/* Binary model format: the datastring without the weights, which are stored as a raw blob.
+	 * The defaults are for layers without weights and use the whole datastring. */
+	virtual std::string getParameterString() const;
+	virtual bool parseParameterString(std::string parameters, const float *weights, size_t num_weights);
+	/* Splits a datastring ending in the weight list into the parameters and the parsed weights. */
+	bool parseDatastringWithWeights(std::string datastring);
 	template<typename T> std::string getVectorRepresentation(const std::vector<T> &vector, char delim) const {
 		std::string result = "";
 		if (vector.size() > 0) {
@@ -59,6 +118,9 @@ protected:
 		return result;
 	}
 public:
+	/* Selects where all layers compute. Takes effect with the next forward pass. */
+	static void setBackend(Backend backend);
+	static Backend getBackend();
 	NeuralNetworkLayer(unsigned int num_inputs, unsigned int num_outputs);
 	NeuralNetworkLayer() = default;
 	bool setNextLayer(std::shared_ptr<NeuralNetworkLayer> nextLayer);
@@ -67,12 +129,48 @@ public:
 	std::shared_ptr<NeuralNetworkLayer> getPreviousLayer() const;
 	unsigned int getNumInputs() const;
 	unsigned int getNumOutputs() const;
+	/* Inference-only layers run every forward pass without training, only the inference kernels and the buffers of the
+	 * forward pass are created and no netsums are stored. If all layers of the chain are inference-only the arena only
+	 * holds two alternating activation regions, so the inputs and outputs of earlier layers are overwritten by later ones
+	 * and only the outputs of the last layer stay available. Error passes throw. */
+	void setInferenceOnly(bool inference_only);
+	bool isInferenceOnly() const;
+	/* Plans one arena for this layer and all following ones, holding batch_capacity samples.
+	 * Larger batches plan it again, afterwards passes with up to batch_capacity samples allocate nothing. */
+	void planActivations(unsigned int batch_capacity);
 	void processAndForwardInput(const std::vector<float> &input);
+	void processAndForwardBatch(const std::vector<float> &inputs, unsigned int batch_size, bool training = true);
+	/* Same with num_inputs * batch_size floats at inputs. */
+	void processAndForwardBatch(const float *inputs, unsigned int batch_size, bool training = true);
+	void processAndForwardDeviceInput(int memid, unsigned int batch_size = 1, bool training = true);
 	void processAndForwardError(const std::vector<float> &error);
+	void processAndForwardBatchError(const std::vector<float> &errors, unsigned int batch_size);
+	void processAndForwardBatchError(const float *errors, unsigned int batch_size);
+	void processAndForwardDeviceError(int memid, unsigned int batch_size = 1);
+	unsigned int getLastBatchSize() const;
 	std::vector<float> getLastInput() const;
 	std::vector<float> getLastOutput() const;
+	/* The last input and output in the arena without copying them, read back first if they are on the device. */
+	ActivationArena::View getLastInputView() const;
+	ActivationArena::View getLastOutputView() const;
+	/* Copies the weights back from the device if training changed them since the last synchronization. */
+	virtual void synchronizeWeights() const;
 	static std::shared_ptr<NeuralNetworkLayer> createFromStringRepresentation(std::string repr);
 	std::string getStringRepresentation() const;
+	/* Like the string representation but without the weights, see getWeights(). With weights set to nullptr only
+	 * num_weights is checked and the weights have to be passed to loadWeightsToDevice(). */
+	static std::shared_ptr<NeuralNetworkLayer> createFromParameterRepresentation(std::string repr, const float *weights, size_t num_weights);
+	std::string getParameterRepresentation() const;
+	/* Host copy of the weights after synchronizing them, nullptr for layers without weights. */
+	virtual const std::vector<float> *getWeights() const;
+	/* Copies the current weights to output, read from the device if the host copy is outdated or released. Unlike
+	 * getWeights() the host copy is left as it is, so saving does not bring back released weights. Layers without
+	 * weights leave output empty. Returns false if the weights could not be read. */
+	virtual bool copyWeights(std::vector<float> &output) const;
+	/* Creates the device weight buffer from num_weights floats at weights right away instead of with the first device pass.
+	 * Without keep_host_copy the layer drops its host weights and reads them back from the device when they are needed.
+	 * The default is for layers without weights. */
+	virtual bool loadWeightsToDevice(const float *weights, size_t num_weights, bool keep_host_copy);
 	virtual ~NeuralNetworkLayer();
 };
 
@@ -0,0 +1,32 @@
+/*
+ * NormalizeStage.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "NormalizeStage.h"
+
+NormalizeStage::NormalizeStage(float input_min, float input_max, float output_min, float output_max) {
+	this->input_min = input_min;
+	this->output_min = output_min;
+	if (input_max != input_min) {
+		scale = (output_max - output_min) / (input_max - input_min);
+	} else {
+		scale = 0.0f;
+	}
+}
+
+std::vector<unsigned int> NormalizeStage::getOutputShape(const std::vector<unsigned int> &shape) const {
+	return shape;
+}
+
+void NormalizeStage::apply(const std::vector<unsigned int> &shape, const float *input, float *output) const {
+	size_t size = 1;
+	for (unsigned int i = 0; i < shape.size(); i++) size *= shape[i];
+	for (size_t i = 0; i < size; i++) {
+		output[i] = output_min + (input[i] - input_min) * scale;
+	}
+}
+
+NormalizeStage::~NormalizeStage() {
+}
@@ -0,0 +1,25 @@
+/*
+ * NormalizeStage.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef NORMALIZESTAGE_H_
+#define NORMALIZESTAGE_H_
+
+#include "SampleStage.h"
+
+/* Maps [input_min, input_max] linearly onto [output_min, output_max]. */
+class NormalizeStage: public SampleStage {
+private:
+	float input_min = 0.0f;
+	float output_min = 0.0f;
+	float scale = 1.0f;
+public:
+	NormalizeStage(float input_min, float input_max, float output_min, float output_max);
+	virtual std::vector<unsigned int> getOutputShape(const std::vector<unsigned int> &shape) const;
+	virtual void apply(const std::vector<unsigned int> &shape, const float *input, float *output) const;
+	virtual ~NormalizeStage();
+};
+
+#endif /* NORMALIZESTAGE_H_ */
@@ -7,6 +7,19 @@
 
 #include "OpenCLInterface.h"
 #include "Logger.h"
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <cstdint>
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <map>
+#include <tuple>
+
+/* Header of a cached program binary file, followed by the length and content of the full cache key and the binary. */
+static const std::string program_cache_magic = "CLNEURALPRG1";
 
 std::shared_ptr<OpenCLInterface> OpenCLInterface::instance = nullptr;
 
@@ -21,7 +34,11 @@ bool OpenCLInterface::isInitialized() const {
 	return initialized;
 }
 
-OpenCLInterface::OpenCLError OpenCLInterface::initialize(cl_device_type device_type) {
+bool OpenCLInterface::isProfiling() const {
+	return profiling;
+}
+
+OpenCLInterface::OpenCLError OpenCLInterface::initialize(cl_device_type device_type, bool profiling) {
 	if (!initialized) {
 		std::vector<cl::Platform> platforms;
 		cl::Platform::get(&platforms);
@@ -52,16 +69,24 @@ OpenCLInterface::OpenCLError OpenCLInterface::initialize(cl_device_type device_t
 				Logger::writeLine("OpenCLInterface::initialize(): Found " + std::to_string(devices.size()) + " OpenCL devices. Using the first.");
 				printOCLDeviceInfo(devices[0]);
 				device = devices[0];
+				std::string device_name;
+				std::string driver_version;
+				device.getInfo(CL_DEVICE_NAME, &device_name);
+				device.getInfo(CL_DRIVER_VERSION, &driver_version);
+				device_identifier = device_name + "|" + driver_version;
 				devices.resize(1);
 				context = cl::Context(devices);
 				if (error != CL_SUCCESS) {
 					Logger::writeLine("OpenCLInterface::initialize(): Unable to initialize OpenCL context.");
 				} else {
-					queue = cl::CommandQueue(context, device, 0, &error);
+					queue = cl::CommandQueue(context, device, profiling ? CL_QUEUE_PROFILING_ENABLE : 0, &error);
 					if (error != CL_SUCCESS) {
 						Logger::writeLine("OpenCLInterface::initialize(): Unable to initialize OpenCL command queue.");
 					} else {
 						initialized = true;
+						this->profiling = profiling;
+						profiling_owner = getProfilingStringId("host");
+						profiling_pass = getProfilingStringId("transfer");
 						Logger::writeLine("OpenCLInterface::initialize(): OpenCL system successfully initialized.");
 					}
 				}
@@ -145,78 +170,367 @@ OpenCLInterface::OpenCLError OpenCLInterface::freeMemoryObject(int memid) {
 }
 
 OpenCLInterface::OpenCLError OpenCLInterface::getMemoryContent(int memid, void *data, size_t size) const {
+	cl::Event event;
+	OpenCLInterface::OpenCLError err = enqueueReadMemoryContent(memid, data, size, NULL, &event);
+	if (err == OpenCLInterface::OpenCLError::SUCCESS) {
+		event.wait();
+	}
+	return err;
+}
+
+OpenCLInterface::OpenCLError OpenCLInterface::writeMemoryContent(int memid, void *data, size_t size) const {
+	cl::Event event;
+	OpenCLInterface::OpenCLError err = enqueueWriteMemoryContent(memid, data, size, NULL, &event);
+	if (err == OpenCLInterface::OpenCLError::SUCCESS) {
+		event.wait();
+	}
+	return err;
+}
+
+OpenCLInterface::OpenCLError OpenCLInterface::enqueueReadMemoryContent(int memid, void *data, size_t size,
+						const std::vector<cl::Event> *waitlist, cl::Event *event) const {
 	if (!initialized) {
-		Logger::writeLine("OpenCLInterface::getMemoryContent(): OpenCL system was not initialized.");
+		Logger::writeLine("OpenCLInterface::enqueueReadMemoryContent(): OpenCL system was not initialized.");
 		return OpenCLInterface::OpenCLError::NOT_INITIALIZED;
 	} else {
 		if ((memid < memory_objects.size()) && (free_memids.find(memid) == free_memids.end())) {
-			cl_int error = queue.enqueueReadBuffer(memory_objects[memid], true, 0, size, data, NULL, NULL);
+			cl::Event profiling_event;
+			if (profiling && (event == NULL)) event = &profiling_event;
+			cl_int error = queue.enqueueReadBuffer(memory_objects[memid], false, 0, size, data, waitlist, event);
 			if (error != CL_SUCCESS) {
-				Logger::writeLine("OpenCLInterface::getMemoryContent(): Unable to get memory content: " + std::to_string(error));
+				Logger::writeLine("OpenCLInterface::enqueueReadMemoryContent(): Unable to get memory content: " + std::to_string(error));
+				return OpenCLInterface::OpenCLError::BUFFER_ERROR;
 			} else {
+				if (profiling) recordProfilingEvent("read", *event);
 				return OpenCLInterface::OpenCLError::SUCCESS;
 			}
 		} else {
-			Logger::writeLine("OpenCLInterface::getMemoryContent(): Invalid memory id.");
+			Logger::writeLine("OpenCLInterface::enqueueReadMemoryContent(): Invalid memory id.");
 			return OpenCLInterface::OpenCLError::INVALID_MEMORY_ID;
 		}
 	}
 }
 
-OpenCLInterface::OpenCLError OpenCLInterface::writeMemoryContent(int memid, void *data, size_t size) const {
+OpenCLInterface::OpenCLError OpenCLInterface::enqueueWriteMemoryContent(int memid, const void *data, size_t size,
+						const std::vector<cl::Event> *waitlist, cl::Event *event) const {
 	if (!initialized) {
-		Logger::writeLine("OpenCLInterface::writeMemoryContent(): OpenCL system was not initialized.");
+		Logger::writeLine("OpenCLInterface::enqueueWriteMemoryContent(): OpenCL system was not initialized.");
 		return OpenCLInterface::OpenCLError::NOT_INITIALIZED;
 	} else {
 		if ((memid < memory_objects.size()) && (free_memids.find(memid) == free_memids.end())) {
-			cl_int error = queue.enqueueWriteBuffer(memory_objects[memid], true, 0, size, data, NULL, NULL);
+			cl::Event profiling_event;
+			if (profiling && (event == NULL)) event = &profiling_event;
+			cl_int error = queue.enqueueWriteBuffer(memory_objects[memid], false, 0, size, data, waitlist, event);
 			if (error != CL_SUCCESS) {
-				Logger::writeLine("OpenCLInterface::writeMemoryContent(): Unable to write memory content.");
+				Logger::writeLine("OpenCLInterface::enqueueWriteMemoryContent(): Unable to write memory content: " + std::to_string(error));
+				return OpenCLInterface::OpenCLError::BUFFER_ERROR;
 			} else {
+				if (profiling) recordProfilingEvent("write", *event);
 				return OpenCLInterface::OpenCLError::SUCCESS;
 			}
 		} else {
-			Logger::writeLine("OpenCLInterface::writeMemoryContent(): Invalid memory id.");
+			Logger::writeLine("OpenCLInterface::enqueueWriteMemoryContent(): Invalid memory id.");
 			return OpenCLInterface::OpenCLError::INVALID_MEMORY_ID;
 		}
 	}
 }
 
-int OpenCLInterface::createKernelFromSource(std::string code, std::string name) {
+OpenCLInterface::OpenCLError OpenCLInterface::finish() const {
+	if (!initialized) {
+		Logger::writeLine("OpenCLInterface::finish(): OpenCL system was not initialized.");
+		return OpenCLInterface::OpenCLError::NOT_INITIALIZED;
+	}
+	cl_int error = queue.finish();
+	if (error != CL_SUCCESS) {
+		Logger::writeLine("OpenCLInterface::finish(): Unable to finish command queue: " + std::to_string(error));
+		return OpenCLInterface::OpenCLError::KERNEL_ERROR;
+	}
+	if (profiling) resolveProfilingEvents();
+	return OpenCLInterface::OpenCLError::SUCCESS;
+}
+
+unsigned int OpenCLInterface::getProfilingStringId(const std::string &str) const {
+	std::unordered_map<std::string, unsigned int>::const_iterator it = profiling_string_ids.find(str);
+	if (it != profiling_string_ids.end()) {
+		return it->second;
+	}
+	profiling_strings.push_back(str);
+	profiling_string_ids[str] = profiling_strings.size() - 1;
+	return profiling_strings.size() - 1;
+}
+
+void OpenCLInterface::setProfilingLabel(const std::string &owner, const std::string &pass) {
+	if (profiling) {
+		profiling_owner = getProfilingStringId(owner);
+		profiling_pass = getProfilingStringId(pass);
+	}
+}
+
+void OpenCLInterface::recordProfilingEvent(const std::string &name, const cl::Event &event) const {
+	ProfilingRecord record;
+	record.name = getProfilingStringId(name);
+	record.owner = profiling_owner;
+	record.pass = profiling_pass;
+	profiling_records.push_back(record);
+	pending_profiling_events.push_back(std::make_pair(profiling_records.size() - 1, event));
+}
+
+void OpenCLInterface::resolveProfilingEvents() const {
+	//only called once the queue is finished, so all timestamps are available
+	for (unsigned int i = 0; i < pending_profiling_events.size(); i++) {
+		ProfilingRecord &record = profiling_records[pending_profiling_events[i].first];
+		const cl::Event &event = pending_profiling_events[i].second;
+		event.getProfilingInfo(CL_PROFILING_COMMAND_QUEUED, &record.queued);
+		event.getProfilingInfo(CL_PROFILING_COMMAND_START, &record.start);
+		event.getProfilingInfo(CL_PROFILING_COMMAND_END, &record.end);
+	}
+	pending_profiling_events.clear();
+}
+
+void OpenCLInterface::clearProfilingData() {
+	if (profiling) finish();
+	profiling_records.clear();
+}
+
+bool OpenCLInterface::writeProfilingTrace(std::string filename) const {
+	if (!profiling) {
+		Logger::writeLine("OpenCLInterface::writeProfilingTrace(): Profiling was not enabled.");
+		return false;
+	}
+	finish();
+	std::ofstream file(filename, std::ios::out | std::ios::trunc);
+	if (!file.is_open()) {
+		Logger::writeLine("OpenCLInterface::writeProfilingTrace(): Unable to open file: " + filename);
+		return false;
+	}
+	cl_ulong begin = 0;
+	for (unsigned int i = 0; i < profiling_records.size(); i++) {
+		if ((begin == 0) || (profiling_records[i].queued < begin)) begin = profiling_records[i].queued;
+	}
+	std::map<unsigned int, unsigned int> threads; //owner to trace thread id
+	file << "{\"traceEvents\":[";
+	file << std::fixed << std::setprecision(3);
+	bool first = true;
+	for (unsigned int i = 0; i < profiling_records.size(); i++) {
+		const ProfilingRecord &record = profiling_records[i];
+		if (threads.find(record.owner) == threads.end()) {
+			unsigned int tid = threads.size();
+			threads[record.owner] = tid;
+			file << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << tid
+					<< ",\"args\":{\"name\":\"" << profiling_strings[record.owner] << "\"}}";
+			first = false;
+		}
+		file << (first ? "" : ",") << "\n{\"name\":\"" << profiling_strings[record.name] << "\",\"cat\":\"" << profiling_strings[record.pass]
+				<< "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << threads[record.owner]
+				<< ",\"ts\":" << (record.start - begin) / 1000.0 << ",\"dur\":" << (record.end - record.start) / 1000.0
+				<< ",\"args\":{\"pass\":\"" << profiling_strings[record.pass] << "\",\"queue_wait_us\":" << (record.start - record.queued) / 1000.0 << "}}";
+		first = false;
+	}
+	file << "\n]}\n";
+	file.close();
+	return true;
+}
+
+std::string OpenCLInterface::getProfilingSummary() const {
+	if (!profiling) {
+		return "";
+	}
+	finish();
+	//owner and pass in order of first appearance, with count and device time in ns
+	std::vector<std::pair<unsigned int, unsigned int>> order;
+	std::map<std::pair<unsigned int, unsigned int>, std::pair<unsigned long, cl_ulong>> totals;
+	cl_ulong alltime = 0;
+	for (unsigned int i = 0; i < profiling_records.size(); i++) {
+		const ProfilingRecord &record = profiling_records[i];
+		std::pair<unsigned int, unsigned int> key(record.owner, record.pass);
+		if (totals.find(key) == totals.end()) {
+			order.push_back(key);
+			totals[key] = std::make_pair(0ul, (cl_ulong) 0);
+		}
+		totals[key].first++;
+		totals[key].second += record.end - record.start;
+		alltime += record.end - record.start;
+	}
+	std::stringstream table;
+	table << std::left << std::setw(28) << "owner" << std::setw(10) << "pass" << std::right << std::setw(10) << "count"
+			<< std::setw(14) << "total ms" << std::setw(12) << "mean us" << std::setw(8) << "%" << "\n";
+	table << std::fixed;
+	for (unsigned int i = 0; i < order.size(); i++) {
+		std::pair<unsigned long, cl_ulong> total = totals[order[i]];
+		table << std::left << std::setw(28) << profiling_strings[order[i].first] << std::setw(10) << profiling_strings[order[i].second]
+				<< std::right << std::setw(10) << total.first
+				<< std::setw(14) << std::setprecision(3) << total.second / 1.0e6
+				<< std::setw(12) << std::setprecision(2) << total.second / 1.0e3 / total.first
+				<< std::setw(8) << std::setprecision(1) << ((alltime > 0) ? (100.0 * total.second / alltime) : 0.0) << "\n";
+	}
+	return table.str();
+}
+
+bool OpenCLInterface::setProgramCacheDirectory(std::string directory) {
+	if (!directory.empty()) {
+		if ((mkdir(directory.c_str(), 0755) != 0) && (errno != EEXIST)) {
+			Logger::writeLine("OpenCLInterface::setProgramCacheDirectory(): Unable to create directory: " + directory);
+			return false;
+		}
+		if (directory.back() != '/') {
+			directory += "/";
+		}
+	}
+	program_cache_directory = directory;
+	return true;
+}
+
+std::string OpenCLInterface::getProgramCacheKey(const std::string &code, const std::string &options) const {
+	return device_identifier + "|" + options + "|" + code;
+}
+
+std::string OpenCLInterface::getProgramCacheFilename(const std::string &key) const {
+	//64 bit FNV-1a, stable across compilers unlike std::hash
+	uint64_t hash = 14695981039346656037ULL;
+	for (unsigned int i = 0; i < key.size(); i++) {
+		hash ^= (unsigned char) key[i];
+		hash *= 1099511628211ULL;
+	}
+	std::stringstream filename;
+	filename << program_cache_directory << std::hex << std::setw(16) << std::setfill('0') << hash << ".clbin";
+	return filename.str();
+}
+
+bool OpenCLInterface::loadProgramBinary(const std::string &key, const std::string &options, cl::Program &program) const {
+	std::ifstream file(getProgramCacheFilename(key), std::ios::in | std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+	std::string magic(program_cache_magic.size(), '\0');
+	uint64_t keylength = 0;
+	file.read(&magic[0], magic.size());
+	file.read((char *) &keylength, sizeof(uint64_t));
+	if (!file || (magic != program_cache_magic) || (keylength != key.size())) {
+		return false;
+	}
+	//the full key is compared to rule out hash collisions
+	std::string storedkey(keylength, '\0');
+	uint64_t binarylength = 0;
+	file.read(&storedkey[0], keylength);
+	file.read((char *) &binarylength, sizeof(uint64_t));
+	if (!file || (storedkey != key) || (binarylength < 1)) {
+		return false;
+	}
+	std::vector<char> binary(binarylength);
+	file.read(binary.data(), binarylength);
+	if (!file) {
+		Logger::writeLine("OpenCLInterface::loadProgramBinary(): Truncated program binary in cache.");
+		return false;
+	}
+	cl_int error;
+	std::vector<cl_int> binary_status;
+	std::vector<cl::Device> devices(1, device);
+	cl::Program::Binaries binaries(1, std::make_pair((const void *) binary.data(), (size_t) binary.size()));
+	cl::Program cached(context, devices, binaries, &binary_status, &error);
+	if (error != CL_SUCCESS) {
+		Logger::writeLine("OpenCLInterface::loadProgramBinary(): Cached program binary rejected: " + std::to_string(error));
+		return false;
+	}
+	error = cached.build(devices, options.c_str(), NULL, NULL);
+	if (error != CL_SUCCESS) {
+		Logger::writeLine("OpenCLInterface::loadProgramBinary(): Unable to build cached program binary: " + std::to_string(error));
+		return false;
+	}
+	program = cached;
+	return true;
+}
+
+bool OpenCLInterface::storeProgramBinary(const std::string &key, const cl::Program &program) const {
+	size_t binarysize = 0;
+	cl_int error = clGetProgramInfo(program(), CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &binarysize, NULL);
+	if ((error != CL_SUCCESS) || (binarysize < 1)) {
+		Logger::writeLine("OpenCLInterface::storeProgramBinary(): Unable to query program binary size.");
+		return false;
+	}
+	std::vector<char> binary(binarysize);
+	char *binaryptr = binary.data();
+	error = clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(char *), &binaryptr, NULL);
+	if (error != CL_SUCCESS) {
+		Logger::writeLine("OpenCLInterface::storeProgramBinary(): Unable to query program binary: " + std::to_string(error));
+		return false;
+	}
+	//written to a temporary file and renamed, so concurrent processes never read a partial binary
+	std::string filename = getProgramCacheFilename(key);
+	std::string tmpfilename = filename + ".tmp" + std::to_string(getpid());
+	std::ofstream file(tmpfilename, std::ios::out | std::ios::trunc | std::ios::binary);
+	if (!file.is_open()) {
+		Logger::writeLine("OpenCLInterface::storeProgramBinary(): Unable to open file: " + tmpfilename);
+		return false;
+	}
+	uint64_t keylength = key.size();
+	uint64_t binarylength = binary.size();
+	file.write(program_cache_magic.data(), program_cache_magic.size());
+	file.write((const char *) &keylength, sizeof(uint64_t));
+	file.write(key.data(), key.size());
+	file.write((const char *) &binarylength, sizeof(uint64_t));
+	file.write(binary.data(), binary.size());
+	file.close();
+	if (!file || (std::rename(tmpfilename.c_str(), filename.c_str()) != 0)) {
+		Logger::writeLine("OpenCLInterface::storeProgramBinary(): Unable to write file: " + filename);
+		std::remove(tmpfilename.c_str());
+		return false;
+	}
+	return true;
+}
+
+int OpenCLInterface::createKernelFromSource(std::string code, std::string name, std::string options) {
 	if (!initialized) {
 		Logger::writeLine("OpenCLInterface::createKernelFromSource(): OpenCL system was not initialized.");
 		return OpenCLInterface::OpenCLError::NOT_INITIALIZED;
 	} else {
 		cl_int error;
-		std::vector<std::pair<const char *, size_t>> source;
-		source.push_back(std::make_pair(code.c_str(), code.length()));
-		cl::Program program(context, source, &error);
-		if (error != CL_SUCCESS) {
-			Logger::writeLine("OpenCLInterface::createKernelFromSource(): Unable to create program.");
-			return OpenCLInterface::OpenCLError::PROGRAM_ERROR;
-		} else {
-			error = program.build(std::vector<cl::Device>(1, device), NULL, NULL, NULL);
+		cl::Program program;
+		std::string key = getProgramCacheKey(code, options);
+		std::unordered_map<std::string, cl::Program>::const_iterator built = programs.find(key);
+		bool cached = false;
+		if (built != programs.end()) {
+			program = built->second;
+			cached = true;
+		} else if (!program_cache_directory.empty() && loadProgramBinary(key, options, program)) {
+			programs[key] = program;
+			cached = true;
+		}
+		if (!cached) {
+			std::vector<std::pair<const char *, size_t>> source;
+			source.push_back(std::make_pair(code.c_str(), code.length()));
+			program = cl::Program(context, source, &error);
+			if (error != CL_SUCCESS) {
+				Logger::writeLine("OpenCLInterface::createKernelFromSource(): Unable to create program.");
+				return OpenCLInterface::OpenCLError::PROGRAM_ERROR;
+			}
+			error = program.build(std::vector<cl::Device>(1, device), options.c_str(), NULL, NULL);
 			if (error != CL_SUCCESS) {
 				std::string build_log;
 				program.getBuildInfo(device, CL_PROGRAM_BUILD_LOG, &build_log);
 				Logger::writeLine("OpenCLInterface::createKernelFromSource(): Failed to build program: " + build_log);
 				return OpenCLInterface::OpenCLError::COMPILATION_ERROR;
+			}
+			if (!program_cache_directory.empty()) {
+				storeProgramBinary(key, program);
+			}
+			programs[key] = program;
+		}
+		//every call gets its own kernel object, so argument state is never shared between layers
+		cl::Kernel kernel(program, name.c_str(), &error);
+		if (error != CL_SUCCESS) {
+			Logger::writeLine("OpenCLInterface::createKernelFromSource(): Unable to create kernel.");
+			return OpenCLInterface::OpenCLError::KERNEL_ERROR;
+		} else {
+			if (free_kids.size() < 1) {
+				kernel_objects.push_back(kernel);
+				kernel_names.push_back(name);
+				return (kernel_objects.size() - 1);
 			} else {
-				cl::Kernel kernel(program, name.c_str(), &error);
-				if (error != CL_SUCCESS) {
-					Logger::writeLine("OpenCLInterface::createKernelFromSource(): Unable to create kernel.");
-					return OpenCLInterface::OpenCLError::KERNEL_ERROR;
-				} else {
-					if (free_kids.size() < 1) {
-						kernel_objects.push_back(kernel);
-						return (kernel_objects.size() - 1);
-					} else {
-						int kid = *(free_kids.begin());
-						free_kids.erase(free_kids.begin());
-						kernel_objects[kid] = kernel;
-						return kid;
-					}
-				}
+				int kid = *(free_kids.begin());
+				free_kids.erase(free_kids.begin());
+				kernel_objects[kid] = kernel;
+				kernel_names[kid] = name;
+				return kid;
 			}
 		}
 	}
@@ -228,8 +542,10 @@ OpenCLInterface::OpenCLError OpenCLInterface::deleteKernel(int kid) {
 		return OpenCLInterface::OpenCLError::NOT_INITIALIZED;
 	} else {
 		if ((kid < kernel_objects.size()) && (free_kids.find(kid) == free_kids.end())) {
-			if (kid == kernel_objects.size() - 1) kernel_objects.pop_back();
-			else {
+			if (kid == kernel_objects.size() - 1) {
+				kernel_objects.pop_back();
+				kernel_names.pop_back();
+			} else {
 				kernel_objects[kid] = cl::Kernel();
 				free_kids.insert(kid);
 			}
@@ -243,13 +559,29 @@ OpenCLInterface::OpenCLError OpenCLInterface::deleteKernel(int kid) {
 
 OpenCLInterface::OpenCLError OpenCLInterface::callKernel(int kid, OpenCLInterface::Dimension range, const std::vector<int> &memids,
 						const std::vector<std::pair<void *, size_t>> &args) {
+	cl::Event finish;
+	OpenCLInterface::OpenCLError err = enqueueKernel(kid, range, memids, args, NULL, &finish);
+	if (err == OpenCLInterface::OpenCLError::SUCCESS) {
+		finish.wait();
+	}
+	return err;
+}
+
+OpenCLInterface::OpenCLError OpenCLInterface::enqueueKernel(int kid, OpenCLInterface::Dimension range, const std::vector<int> &memids,
+						const std::vector<std::pair<void *, size_t>> &args,
+						const std::vector<cl::Event> *waitlist, cl::Event *event) {
+	return enqueueKernel(kid, range, OpenCLInterface::Dimension(), memids, args, waitlist, event);
+}
+
+OpenCLInterface::OpenCLError OpenCLInterface::enqueueKernel(int kid, OpenCLInterface::Dimension range, OpenCLInterface::Dimension local,
+						const std::vector<int> &memids, const std::vector<std::pair<void *, size_t>> &args,
+						const std::vector<cl::Event> *waitlist, cl::Event *event) {
 	if (!initialized) {
-		Logger::writeLine("OpenCLInterface::callKernel(): OpenCL system was not initialized.");
+		Logger::writeLine("OpenCLInterface::enqueueKernel(): OpenCL system was not initialized.");
 		return OpenCLInterface::OpenCLError::NOT_INITIALIZED;
 	} else {
 		if (kid < kernel_objects.size() && (free_kids.find(kid) == free_kids.end())) {
 			cl::NDRange ndrange;
-			cl::Event finish;
 			if (range.z != 0) {
 				ndrange = cl::NDRange(range.x, range.y, range.z);
 			} else if (range.y != 0) {
@@ -257,30 +589,40 @@ OpenCLInterface::OpenCLError OpenCLInterface::callKernel(int kid, OpenCLInterfac
 			} else if (range.x != 0) {
 				ndrange = cl::NDRange(range.x);
 			} else {
-				Logger::writeLine("OpenCLInterface::callKernel(): NDRange contains no work-items.");
+				Logger::writeLine("OpenCLInterface::enqueueKernel(): NDRange contains no work-items.");
 				return OpenCLInterface::OpenCLError::NO_WORKITEMS;
 			}
+			cl::NDRange localrange = cl::NullRange;
+			if (local.z != 0) {
+				localrange = cl::NDRange(local.x, local.y, local.z);
+			} else if (local.y != 0) {
+				localrange = cl::NDRange(local.x, local.y);
+			} else if (local.x != 0) {
+				localrange = cl::NDRange(local.x);
+			}
 			for (unsigned int i = 0; i < memids.size(); i++) {
 				if ((memids[i] < memory_objects.size()) && (free_memids.find(memids[i]) == free_memids.end())) {
 					kernel_objects[kid].setArg<cl::Buffer>(i, memory_objects[memids[i]]);
 				} else {
-					Logger::writeLine("OpenCLInterface::callKernel(): Invalid memory id in kernel arguments.");
+					Logger::writeLine("OpenCLInterface::enqueueKernel(): Invalid memory id in kernel arguments.");
 					return OpenCLInterface::OpenCLError::INVALID_MEMORY_ID;
 				}
 			}
 			for (unsigned int i = 0; i < args.size(); i++) {
 				kernel_objects[kid].setArg(memids.size() + i, args[i].second, args[i].first);
 			}
-			cl_int error = queue.enqueueNDRangeKernel(kernel_objects[kid], cl::NullRange, ndrange, cl::NullRange, NULL, &finish);
+			cl::Event profiling_event;
+			if (profiling && (event == NULL)) event = &profiling_event;
+			cl_int error = queue.enqueueNDRangeKernel(kernel_objects[kid], cl::NullRange, ndrange, localrange, waitlist, event);
 			if (error != CL_SUCCESS) {
-				Logger::writeLine("OpenCLInterface::callKernel(): Could not enqueue NDRange kernel: " + std::to_string(error));
+				Logger::writeLine("OpenCLInterface::enqueueKernel(): Could not enqueue NDRange kernel: " + std::to_string(error));
 				return OpenCLInterface::OpenCLError::KERNEL_ERROR;
 			} else {
-				cl::WaitForEvents(std::vector<cl::Event>(1, finish));
+				if (profiling) recordProfilingEvent(kernel_names[kid], *event);
 				return OpenCLInterface::OpenCLError::SUCCESS;
 			}
 		} else {
-			Logger::writeLine("OpenCLInterface::callKernel(): Invalid kernel ID.");
+			Logger::writeLine("OpenCLInterface::enqueueKernel(): Invalid kernel ID.");
 			return OpenCLInterface::OpenCLError::INVALID_KERNEL_ID;
 		}
 	}
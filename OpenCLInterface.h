@@ -11,7 +11,9 @@
 #include <CL/cl.hpp>
 #include <memory>
 #include <vector>
+#include <string>
 #include <unordered_set>
+#include <unordered_map>
 
 class OpenCLInterface {
 private:
@@ -23,10 +25,36 @@ private:
 	std::unordered_set<int> free_memids;
 	std::vector<cl::Kernel> kernel_objects;
 	std::unordered_set<int> free_kids;
+	std::unordered_map<std::string, cl::Program> programs; //built programs by cache key, shared by all kernels from the same source
+	std::vector<std::string> kernel_names; //function names by kid, used to label profiling records
+	struct ProfilingRecord {
+		unsigned int name = 0; //ids into profiling_strings
+		unsigned int owner = 0;
+		unsigned int pass = 0;
+		cl_ulong queued = 0; //device timestamps in ns
+		cl_ulong start = 0;
+		cl_ulong end = 0;
+	};
+	bool profiling = false;
+	unsigned int profiling_owner = 0; //label applied to subsequently enqueued commands
+	unsigned int profiling_pass = 0;
+	mutable std::vector<std::string> profiling_strings;
+	mutable std::unordered_map<std::string, unsigned int> profiling_string_ids;
+	mutable std::vector<ProfilingRecord> profiling_records;
+	mutable std::vector<std::pair<size_t, cl::Event>> pending_profiling_events; //record index and event not yet resolved
 	bool initialized = false;
+	std::string program_cache_directory; //empty if program binaries are not cached
+	std::string device_identifier; //device name and driver version, part of the program cache key
 	static std::shared_ptr<OpenCLInterface> instance;
+	std::string getProgramCacheKey(const std::string &code, const std::string &options) const;
+	std::string getProgramCacheFilename(const std::string &key) const;
+	bool loadProgramBinary(const std::string &key, const std::string &options, cl::Program &program) const;
+	bool storeProgramBinary(const std::string &key, const cl::Program &program) const;
 	void printOCLDeviceInfo(const cl::Device &device) const;
 	void printOCLPlatformInfo(const cl::Platform &platform) const;
+	unsigned int getProfilingStringId(const std::string &str) const;
+	void recordProfilingEvent(const std::string &name, const cl::Event &event) const;
+	void resolveProfilingEvents() const;
 public:
 	enum OpenCLError {
 		NO_PLATFORM_FOUND = -1,
@@ -49,16 +77,43 @@ public:
 		size_t z = 0;
 	};
 	static std::shared_ptr<OpenCLInterface> getInstance();
-	OpenCLError initialize(cl_device_type device_type);
+	/* With profiling the queue records timestamps of every kernel launch and buffer transfer. */
+	OpenCLError initialize(cl_device_type device_type, bool profiling = false);
 	bool isInitialized() const;
+	bool isProfiling() const;
+	/* Labels all commands enqueued afterwards with the owning layer and pass. */
+	void setProfilingLabel(const std::string &owner, const std::string &pass);
+	/* Writes all recorded commands as a Chrome trace_event JSON file, one thread per owner. */
+	bool writeProfilingTrace(std::string filename) const;
+	/* Table of device time per owner and pass. */
+	std::string getProfilingSummary() const;
+	void clearProfilingData();
 	int allocateMemoryObject(void *data, size_t size, cl_mem_flags flags = CL_MEM_READ_WRITE);
 	OpenCLError getMemoryContent(int memid, void *data, size_t size) const;
 	OpenCLError writeMemoryContent(int memid, void *data, size_t size) const;
+	/* Non-blocking transfers. data has to stay valid until the returned event has completed. */
+	OpenCLError enqueueReadMemoryContent(int memid, void *data, size_t size,
+						const std::vector<cl::Event> *waitlist = NULL, cl::Event *event = NULL) const;
+	OpenCLError enqueueWriteMemoryContent(int memid, const void *data, size_t size,
+						const std::vector<cl::Event> *waitlist = NULL, cl::Event *event = NULL) const;
 	OpenCLError freeMemoryObject(int memid);
-	int createKernelFromSource(std::string code, std::string name);
+	/* Programs built afterwards are stored in and loaded from this directory. An empty string disables the cache. */
+	bool setProgramCacheDirectory(std::string directory);
+	int createKernelFromSource(std::string code, std::string name, std::string options = "");
 	OpenCLError deleteKernel(int kid);
 	OpenCLError callKernel(int kid, Dimension range, const std::vector<int> &memids,
 						const std::vector<std::pair<void *, size_t>> &args);
+	/* Like callKernel() but returns as soon as the kernel is enqueued. The queue is in-order, so
+	 * the wait list is only needed to depend on events from outside of it. */
+	OpenCLError enqueueKernel(int kid, Dimension range, const std::vector<int> &memids,
+						const std::vector<std::pair<void *, size_t>> &args,
+						const std::vector<cl::Event> *waitlist = NULL, cl::Event *event = NULL);
+	/* Same with a fixed work group size, each range dimension has to be a multiple of it. An empty local range leaves it to the implementation. */
+	OpenCLError enqueueKernel(int kid, Dimension range, Dimension local, const std::vector<int> &memids,
+						const std::vector<std::pair<void *, size_t>> &args,
+						const std::vector<cl::Event> *waitlist = NULL, cl::Event *event = NULL);
+	/* Blocks until all enqueued commands have completed. */
+	OpenCLError finish() const;
 	virtual ~OpenCLInterface();
 };
 
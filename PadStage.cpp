@@ -0,0 +1,48 @@
+/*
+ * PadStage.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "PadStage.h"
+#include <algorithm>
+
+PadStage::PadStage(unsigned int padding, float value) {
+	this->padding = padding;
+	this->value = value;
+}
+
+std::vector<unsigned int> PadStage::getOutputShape(const std::vector<unsigned int> &shape) const {
+	std::vector<unsigned int> output_shape = shape;
+	for (unsigned int i = (shape.size() > 2) ? shape.size() - 2 : 0; i < shape.size(); i++) {
+		output_shape[i] += 2 * padding;
+	}
+	return output_shape;
+}
+
+void PadStage::apply(const std::vector<unsigned int> &shape, const float *input, float *output) const {
+	if (shape.empty()) {
+		return;
+	}
+	size_t width = shape.back();
+	size_t height = 1;
+	size_t planes = 1;
+	if (shape.size() > 1) height = shape[shape.size() - 2];
+	for (unsigned int i = 0; i + 2 < shape.size(); i++) planes *= shape[i];
+	size_t padded_width = width + 2 * padding;
+	//vectors are only padded at both ends, not above and below
+	size_t border_rows = (shape.size() > 1) ? padding : 0;
+	for (size_t p = 0; p < planes; p++) {
+		output = std::fill_n(output, border_rows * padded_width, value);
+		for (size_t y = 0; y < height; y++) {
+			output = std::fill_n(output, padding, value);
+			output = std::copy(input, input + width, output);
+			output = std::fill_n(output, padding, value);
+			input += width;
+		}
+		output = std::fill_n(output, border_rows * padded_width, value);
+	}
+}
+
+PadStage::~PadStage() {
+}
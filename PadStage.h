@@ -0,0 +1,24 @@
+/*
+ * PadStage.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef PADSTAGE_H_
+#define PADSTAGE_H_
+
+#include "SampleStage.h"
+
+/* Adds a border of padding elements on every side of the last two dimensions (only the last one for vectors). */
+class PadStage: public SampleStage {
+private:
+	unsigned int padding = 0;
+	float value = 0.0f;
+public:
+	PadStage(unsigned int padding, float value);
+	virtual std::vector<unsigned int> getOutputShape(const std::vector<unsigned int> &shape) const;
+	virtual void apply(const std::vector<unsigned int> &shape, const float *input, float *output) const;
+	virtual ~PadStage();
+};
+
+#endif /* PADSTAGE_H_ */
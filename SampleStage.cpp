@@ -0,0 +1,13 @@
+/*
+ * SampleStage.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "SampleStage.h"
+
+SampleStage::SampleStage() {
+}
+
+SampleStage::~SampleStage() {
+}
@@ -0,0 +1,24 @@
+/*
+ * SampleStage.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef SAMPLESTAGE_H_
+#define SAMPLESTAGE_H_
+
+#include <vector>
+#include <cstddef>
+
+/* One step of the preprocessing applied to every sample read from a data set file. */
+class SampleStage {
+public:
+	SampleStage();
+	/* Shape of a sample after this stage for the given input shape. */
+	virtual std::vector<unsigned int> getOutputShape(const std::vector<unsigned int> &shape) const = 0;
+	/* Transforms one sample of the given shape, input and output never overlap. */
+	virtual void apply(const std::vector<unsigned int> &shape, const float *input, float *output) const = 0;
+	virtual ~SampleStage();
+};
+
+#endif /* SAMPLESTAGE_H_ */
@@ -6,6 +6,7 @@
  */
 
 #include "SigmoidActivationFunction.h"
+#include <cmath>
 
 namespace clneural {
 
@@ -30,6 +31,14 @@ std::string SigmoidActivationFunction::getDerivCode() const {
 	return code;
 }
 
+float SigmoidActivationFunction::compute(float input) const {
+	return (1.0f/(1.0f + std::exp(-input)));
+}
+
+float SigmoidActivationFunction::computeDerivative(float input) const {
+	return (std::exp(-input)/((1.0f + std::exp(-input)) * (1.0f + std::exp(-input))));
+}
+
 std::string SigmoidActivationFunction::getName() const {
 	return "SigmoidActivationFunction";
 }
@@ -19,6 +19,8 @@ public:
 	SigmoidActivationFunction();
 	virtual std::string getCode() const;
 	virtual std::string getDerivCode() const;
+	virtual float compute(float input) const;
+	virtual float computeDerivative(float input) const;
 	virtual std::string getName() const;
 	virtual ~SigmoidActivationFunction();
 };
@@ -8,59 +8,74 @@
 #include "SubsamplingLayer.h"
 #include "RandomGenerator.h"
 #include "Logger.h"
+#include "ThreadPool.h"
 
 namespace clneural {
 
+/* Compiled with INFERENCE_ONLY defined the netsums are neither taken nor stored. */
 const std::string SubsamplingLayer::fwclcode = "__kernel void computeOutput(__global const float *inputs, __global const float *weights, \n"
-		"__global float *outputs, __global float *netsums,\n"
-		"unsigned int inp_width, unsigned int inp_height, unsigned int filter_width, unsigned int filter_height) {\n"
+		"__global float *outputs,\n"
+		"#ifndef INFERENCE_ONLY\n"
+		"__global float *netsums,\n"
+		"#endif\n"
+		"unsigned int inp_width, unsigned int inp_height, unsigned int filter_width, unsigned int filter_height, unsigned int num_inputs) {\n"
 		"unsigned int output_id = get_global_id(0);\n"
+		"unsigned int sample_id = get_global_id(1);\n"
+		"unsigned int num_outputs = get_global_size(0);\n"
 		"unsigned int output_feature_map_size = ((inp_width + filter_width - 1) / filter_width) * ((inp_height + filter_height - 1) / filter_height);\n"
 		"unsigned int input_feature_map_size = inp_width * inp_height;\n"
 		"unsigned int feature_map_id = output_id / output_feature_map_size;\n"
 		"unsigned int output_x = (output_id % output_feature_map_size) % ((inp_width + filter_width - 1) / filter_width);\n"
 		"unsigned int output_y = (output_id % output_feature_map_size) / ((inp_width + filter_width - 1) / filter_width);\n"
+		"__global const float *sample = inputs + sample_id * num_inputs;\n"
 		"float sum = 0.0f;\n"
-		"for (unsigned int inp_y = output_y * filter_height; inp_y < (output_y + 1) * filter_height && inp_y < inp_width; inp_y++) {\n"
+		"for (unsigned int inp_y = output_y * filter_height; inp_y < (output_y + 1) * filter_height && inp_y < inp_height; inp_y++) {\n"
 		"for (unsigned int inp_x = output_x * filter_width; inp_x < (output_x + 1) * filter_width && inp_x < inp_width; inp_x++) {\n"
-		"sum += inputs[feature_map_id * input_feature_map_size + inp_y * inp_width + inp_x];\n"
+		"sum += sample[feature_map_id * input_feature_map_size + inp_y * inp_width + inp_x];\n"
 		"}\n"
 		"}\n"
 		"sum /= filter_width * filter_height;\n"
-		"netsums[output_id] = sum;\n"
+		"#ifndef INFERENCE_ONLY\n"
+		"netsums[sample_id * num_outputs + output_id] = sum;\n"
+		"#endif\n"
 		"sum *= weights[2 * feature_map_id];\n"
 		"sum += weights[2 * feature_map_id + 1];\n"
-		"outputs[output_id] = activationFunction(sum);\n"
+		"outputs[sample_id * num_outputs + output_id] = activationFunction(sum);\n"
 		"}\n";
 
 const std::string SubsamplingLayer::fberrorclcode = "__kernel void computeNextError(__global const float *error, __global const float *netsums,\n"
 		"__global const float *weights, __global float *nexterror, \n"
-		"unsigned int inp_width, unsigned int inp_height, unsigned int filter_width, unsigned int filter_height) {\n"
+		"unsigned int inp_width, unsigned int inp_height, unsigned int filter_width, unsigned int filter_height, unsigned int num_outputs) {\n"
 		"unsigned int input_id = get_global_id(0);\n"
+		"unsigned int sample_id = get_global_id(1);\n"
+		"unsigned int num_inputs = get_global_size(0);\n"
 		"unsigned int input_feature_map_size = inp_width * inp_height;\n"
 		"unsigned int output_feature_map_size = ((inp_width + filter_width - 1) / filter_width) * ((inp_height + filter_height - 1) / filter_height);\n"
 		"unsigned int feature_map_id = input_id / input_feature_map_size;\n"
 		"unsigned int inp_x = (input_id % input_feature_map_size) % inp_width;\n"
 		"unsigned int inp_y = (input_id % input_feature_map_size) / inp_width;\n"
-		"unsigned int output_id = feature_map_id * output_feature_map_size + (inp_y / filter_height) * ((inp_width + filter_width - 1) / filter_width) + inp_x / filter_width;"
+		"unsigned int output_id = sample_id * num_outputs + feature_map_id * output_feature_map_size + (inp_y / filter_height) * ((inp_width + filter_width - 1) / filter_width) + inp_x / filter_width;"
 		"float delta = activationDerivate(netsums[output_id] * weights[2 * feature_map_id] + weights[2 * feature_map_id + 1]) * error[output_id];"
-		"nexterror[input_id] = weights[2 * feature_map_id] * delta;\n"
+		"nexterror[sample_id * num_inputs + input_id] = weights[2 * feature_map_id] * delta;\n"
 		"}\n";
 
 const std::string SubsamplingLayer::fbweightsclcode = "__kernel void computeWeights(__global const float *error, \n"
 		"__global const float *netsums, __global float *weights, \n"
-		"unsigned int inp_width, unsigned int inp_height, unsigned int filter_width, unsigned int filter_height, float learning_rate) {\n"
+		"unsigned int inp_width, unsigned int inp_height, unsigned int filter_width, unsigned int filter_height, float learning_rate, \n"
+		"unsigned int num_outputs, unsigned int batch_size) {\n"
 		"unsigned int feature_map_id = get_global_id(0);\n"
 		"unsigned int output_feature_map_size = ((inp_width + filter_width - 1)/filter_width) * ((inp_height + filter_height - 1)/filter_height);\n"
 		"float delta = 0.0f;\n"
 		"float delta_bias = 0.0f;\n"
+		"for (unsigned int sample_id = 0; sample_id < batch_size; sample_id++) {\n"
 		"for (unsigned int output_y = 0; output_y < ((inp_height + filter_height - 1)/filter_height); output_y++) {\n"
 		"for (unsigned int output_x = 0; output_x < ((inp_width + filter_width - 1)/filter_width); output_x++) {\n"
-		"unsigned int output_id = feature_map_id * output_feature_map_size + output_y * ((inp_width + filter_width - 1)/filter_width) + output_x;\n"
+		"unsigned int output_id = sample_id * num_outputs + feature_map_id * output_feature_map_size + output_y * ((inp_width + filter_width - 1)/filter_width) + output_x;\n"
 		"delta += learning_rate * error[output_id] * activationDerivate(netsums[output_id] * weights[2 * feature_map_id] + weights[2*feature_map_id + 1]) * netsums[output_id];\n"
 		"delta_bias += learning_rate * error[output_id] * activationDerivate(netsums[output_id] * weights[2 * feature_map_id] + weights[2*feature_map_id + 1]);\n"
 		"}\n"
 		"}\n"
+		"}\n"
 		"weights[2 * feature_map_id] += delta;\n"
 		"weights[2 * feature_map_id + 1] += delta_bias;\n"
 		"}\n";
@@ -81,29 +96,72 @@ SubsamplingLayer::SubsamplingLayer(Dimension input_maps, Dimension filter, unsig
 	}
 }
 
-bool SubsamplingLayer::initializeMemoryObjects(std::shared_ptr<OpenCLInterface> ocl) {
+bool SubsamplingLayer::initializeMemoryObjects(std::shared_ptr<OpenCLInterface> ocl, unsigned int batch_size, bool training) {
+	if (batch_size > batch_capacity) {
+		freeBatchMemoryObjects(ocl);
+		batch_capacity = batch_size;
+	}
 	if (wmemid < 0) {
 		wmemid = ocl->allocateMemoryObject((void *) &weights[0], weights.size() * sizeof(float), CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR);
 	}
 	if (imemid < 0) {
-		imemid = ocl->allocateMemoryObject(NULL, num_inputs * sizeof(float), CL_MEM_READ_WRITE);
+		imemid = ocl->allocateMemoryObject(NULL, num_inputs * batch_capacity * sizeof(float), CL_MEM_READ_WRITE);
 	}
 	if (oememid < 0) {
-		oememid = ocl->allocateMemoryObject(NULL, num_outputs * sizeof(float), CL_MEM_WRITE_ONLY);
+		oememid = ocl->allocateMemoryObject(NULL, num_outputs * batch_capacity * sizeof(float), CL_MEM_READ_WRITE);
+	}
+	if ((wmemid < 0) || (imemid < 0) || (oememid < 0)) {
+		return false;
+	}
+	if (!training) {
+		return true;
+	}
+	if (ememid < 0) {
+		ememid = ocl->allocateMemoryObject(NULL, num_outputs * batch_capacity * sizeof(float), CL_MEM_READ_ONLY);
 	}
 	if (smemid < 0) {
-		smemid = ocl->allocateMemoryObject(NULL, num_outputs * sizeof(float), CL_MEM_READ_WRITE);
+		smemid = ocl->allocateMemoryObject(NULL, num_outputs * batch_capacity * sizeof(float), CL_MEM_READ_WRITE);
 	}
 	if (nememid < 0) {
-		nememid = ocl->allocateMemoryObject(NULL, num_inputs * sizeof(float), CL_MEM_WRITE_ONLY);
+		nememid = ocl->allocateMemoryObject(NULL, num_inputs * batch_capacity * sizeof(float), CL_MEM_READ_WRITE);
 	}
-	if ((wmemid < 0) || (imemid < 0) || (oememid < 0) || (smemid < 0) || (nememid < 0)) {
+	if ((ememid < 0) || (smemid < 0) || (nememid < 0)) {
 		return false;
 	}
 	return true;
 }
 
-bool SubsamplingLayer::initializeKernelObjects(std::shared_ptr<OpenCLInterface> ocl) {
+void SubsamplingLayer::freeBatchMemoryObjects(std::shared_ptr<OpenCLInterface> ocl) {
+	if (imemid >= 0) {
+		ocl->freeMemoryObject(imemid);
+		imemid = -1;
+	}
+	if (oememid >= 0) {
+		ocl->freeMemoryObject(oememid);
+		oememid = -1;
+	}
+	if (ememid >= 0) {
+		ocl->freeMemoryObject(ememid);
+		ememid = -1;
+	}
+	if (smemid >= 0) {
+		ocl->freeMemoryObject(smemid);
+		smemid = -1;
+	}
+	if (nememid >= 0) {
+		ocl->freeMemoryObject(nememid);
+		nememid = -1;
+	}
+}
+
+bool SubsamplingLayer::initializeKernelObjects(std::shared_ptr<OpenCLInterface> ocl, bool training) {
+	if (!training) {
+		if (oikid < 0) {
+			std::string code = "#define INFERENCE_ONLY\n" + act->getCode() + fwclcode;
+			oikid = ocl->createKernelFromSource(code, "computeOutput");
+		}
+		return (oikid >= 0);
+	}
 	if (okid < 0) {
 		std::string code = act->getCode() + fwclcode;
 		okid = ocl->createKernelFromSource(code, "computeOutput");
@@ -122,33 +180,79 @@ bool SubsamplingLayer::initializeKernelObjects(std::shared_ptr<OpenCLInterface>
 	return true;
 }
 
-std::vector<float> SubsamplingLayer::computeOutput(const std::vector<float> &input) {
+int SubsamplingLayer::uploadInput(const float *input, unsigned int batch_size, bool training) {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (!ocl->isInitialized()) {
+		return -1;
+	} else if (!initializeKernelObjects(ocl, training)) {
+		Logger::writeLine("SubsamplingLayer::uploadInput(): Can't initialize kernel.");
+		return -1;
+	} else if (!initializeMemoryObjects(ocl, batch_size, training)) {
+		Logger::writeLine("SubsamplingLayer::uploadInput(): Can't initialize memory objects.");
+		return -1;
+	} else if (ocl->enqueueWriteMemoryContent(imemid, (const void*) input, num_inputs * batch_size * sizeof(float)) != OpenCLInterface::OpenCLError::SUCCESS) {
+		Logger::writeLine("SubsamplingLayer::uploadInput(): Unable to write input to the device.");
+		return -1;
+	}
+	return imemid;
+}
+
+bool SubsamplingLayer::computeDeviceOutput(int memid, unsigned int batch_size, bool training) {
 	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
 	if (ocl->isInitialized()) {
-		if (!initializeKernelObjects(ocl)) {
-			Logger::writeLine("SubsamplingLayer::computeOutput(): Can't initialize kernel. Unable to compute anything.");
-			return input;
-		} else if (!initializeMemoryObjects(ocl)) {
-			Logger::writeLine("SubsamplingLayer::computeOutput(): Can't initialize memory objects. Unable to compute anything.");
-			return input;
+		if (!initializeKernelObjects(ocl, training)) {
+			Logger::writeLine("SubsamplingLayer::computeDeviceOutput(): Can't initialize kernel. Unable to compute anything.");
+			return false;
+		} else if (!initializeMemoryObjects(ocl, batch_size, training)) {
+			Logger::writeLine("SubsamplingLayer::computeDeviceOutput(): Can't initialize memory objects. Unable to compute anything.");
+			return false;
 		} else {
-			std::vector<float> output(num_outputs);
-			ocl->writeMemoryContent(imemid, (void*) &input[0], num_inputs * sizeof(float));
 			OpenCLInterface::Dimension dim;
 			dim.x = num_outputs;
-			std::vector<int> memargs({imemid, wmemid, oememid, smemid});
+			dim.y = batch_size;
+			std::vector<int> memargs({memid, wmemid, oememid, smemid});
 			std::vector<std::pair<void *, size_t>> constargs({std::make_pair((void *) &input_maps.width, sizeof(unsigned int)),
 															std::make_pair((void*) &input_maps.height, sizeof(unsigned int)),
 															std::make_pair((void*) &filter.width, sizeof(unsigned int)),
-															std::make_pair((void*) &filter.height, sizeof(unsigned int))});
-			OpenCLInterface::OpenCLError err = ocl->callKernel(okid, dim, memargs, constargs);
-			if (err != OpenCLInterface::OpenCLError::SUCCESS) {
-				Logger::writeLine("SubsamplingLayer::computeOutput(): Error when calling the OpenCL kernel.");
-				return input;
+															std::make_pair((void*) &filter.height, sizeof(unsigned int)),
+															std::make_pair((void*) &num_inputs, sizeof(unsigned int))});
+			OpenCLInterface::OpenCLError err;
+			if (training) {
+				err = ocl->enqueueKernel(okid, dim, memargs, constargs);
 			} else {
-				ocl->getMemoryContent(oememid, (void *) &output[0], num_outputs * sizeof(float));
-				return output;
+				memargs.pop_back();
+				err = ocl->enqueueKernel(oikid, dim, memargs, constargs);
+			}
+			if (err != OpenCLInterface::OpenCLError::SUCCESS) {
+				Logger::writeLine("SubsamplingLayer::computeDeviceOutput(): Error when calling the OpenCL kernel.");
+				return false;
 			}
+			input_memid = memid;
+			return true;
+		}
+	} else {
+		Logger::writeLine("SubsamplingLayer::computeDeviceOutput(): OpenCLInterface not initialized. Unable to compute anything.");
+		return false;
+	}
+}
+
+int SubsamplingLayer::getOutputMemoryId() const {
+	return oememid;
+}
+
+std::vector<float> SubsamplingLayer::computeOutput(const std::vector<float> &input) {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (ocl->isInitialized()) {
+		int memid = uploadInput(&input[0], 1, true);
+		if (memid < 0) {
+			Logger::writeLine("SubsamplingLayer::computeOutput(): Can't upload input. Unable to compute anything.");
+			return input;
+		} else if (!computeDeviceOutput(memid, 1, true)) {
+			return input;
+		} else {
+			std::vector<float> output(num_outputs);
+			ocl->getMemoryContent(oememid, (void *) &output[0], num_outputs * sizeof(float));
+			return output;
 		}
 	} else {
 		Logger::writeLine("SubsamplingLayer::computeOutput(): OpenCLInterface not initialized. Unable to compute anything.");
@@ -156,42 +260,84 @@ std::vector<float> SubsamplingLayer::computeOutput(const std::vector<float> &inp
 	}
 }
 
-std::vector<float> SubsamplingLayer::computeError(const std::vector<float> &input) {
+int SubsamplingLayer::uploadError(const float *error, unsigned int batch_size) {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (!ocl->isInitialized()) {
+		return -1;
+	} else if (!initializeKernelObjects(ocl)) {
+		Logger::writeLine("SubsamplingLayer::uploadError(): Can't initialize kernel.");
+		return -1;
+	} else if (!initializeMemoryObjects(ocl, batch_size)) {
+		Logger::writeLine("SubsamplingLayer::uploadError(): Can't initialize memory objects.");
+		return -1;
+	} else if (ocl->enqueueWriteMemoryContent(ememid, (const void*) error, num_outputs * batch_size * sizeof(float)) != OpenCLInterface::OpenCLError::SUCCESS) {
+		Logger::writeLine("SubsamplingLayer::uploadError(): Unable to write error to the device.");
+		return -1;
+	}
+	return ememid;
+}
+
+int SubsamplingLayer::computeDeviceError(int memid, unsigned int batch_size) {
 	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
 	if (ocl->isInitialized()) {
 		if (!initializeKernelObjects(ocl)) {
-			Logger::writeLine("SubsamplingLayer::computeError(): Can't initialize kernel. Unable to compute anything.");
-			return input;
-		} else if (!initializeMemoryObjects(ocl)) {
-			Logger::writeLine("SubsamplingLayer::computeError(): Can't initialize memory objects. Unable to compute anything.");
-			return input;
+			Logger::writeLine("SubsamplingLayer::computeDeviceError(): Can't initialize kernel. Unable to compute anything.");
+			return -1;
+		} else if (!initializeMemoryObjects(ocl, batch_size)) {
+			Logger::writeLine("SubsamplingLayer::computeDeviceError(): Can't initialize memory objects. Unable to compute anything.");
+			return -1;
 		} else {
-			std::vector<float> newerror(num_inputs);
-			ocl->writeMemoryContent(oememid, (void*) &input[0], num_outputs * sizeof(float));
 			OpenCLInterface::Dimension dim;
 			dim.x = num_inputs;
-			std::vector<int> memargs({oememid, smemid, wmemid, nememid});
+			dim.y = batch_size;
+			std::vector<int> memargs({memid, smemid, wmemid, nememid});
 			std::vector<std::pair<void *, size_t>> constargs({std::make_pair((void *) &input_maps.width, sizeof(unsigned int)),
 															std::make_pair((void*) &input_maps.height, sizeof(unsigned int)),
 															std::make_pair((void*) &filter.width, sizeof(unsigned int)),
-															std::make_pair((void*) &filter.height, sizeof(unsigned int))});
-			OpenCLInterface::OpenCLError err = ocl->callKernel(fberrorkid, dim, memargs, constargs);
+															std::make_pair((void*) &filter.height, sizeof(unsigned int)),
+															std::make_pair((void*) &num_outputs, sizeof(unsigned int))});
+			OpenCLInterface::OpenCLError err = ocl->enqueueKernel(fberrorkid, dim, memargs, constargs);
 			if (err != OpenCLInterface::OpenCLError::SUCCESS) {
-				Logger::writeLine("SubsamplingLayer::computeError(): Error when calling the OpenCL kernel for next error computation.");
-				return input;
-			} else {
-				ocl->getMemoryContent(nememid, (void *) &newerror[0], num_inputs * sizeof(float));
-				constargs.push_back(std::make_pair((void *) &learning, sizeof(float)));
-				memargs.pop_back();
-				dim.x = num_feature_maps;
-				err = ocl->callKernel(fbweightskid, dim, memargs, constargs);
-				if (err != OpenCLInterface::OpenCLError::SUCCESS) {
-					Logger::writeLine("SubsamplingLayer::computeError(): Error when calling the OpenCL kernel for weights computation.");
-					return input;
-				}
-				ocl->getMemoryContent(wmemid, (void *) &weights[0], weights.size() * sizeof(float));
-				return newerror;
+				Logger::writeLine("SubsamplingLayer::computeDeviceError(): Error when calling the OpenCL kernel for next error computation.");
+				return -1;
 			}
+			constargs.pop_back();
+			constargs.push_back(std::make_pair((void *) &learning, sizeof(float)));
+			constargs.push_back(std::make_pair((void *) &num_outputs, sizeof(unsigned int)));
+			constargs.push_back(std::make_pair((void *) &batch_size, sizeof(unsigned int)));
+			memargs.pop_back();
+			dim.x = num_feature_maps;
+			dim.y = 0;
+			setProfilingLabel("weights");
+			err = ocl->enqueueKernel(fbweightskid, dim, memargs, constargs);
+			if (err != OpenCLInterface::OpenCLError::SUCCESS) {
+				Logger::writeLine("SubsamplingLayer::computeDeviceError(): Error when calling the OpenCL kernel for weights computation.");
+				return -1;
+			}
+			weights_dirty = true;
+			return nememid;
+		}
+	} else {
+		Logger::writeLine("SubsamplingLayer::computeDeviceError(): OpenCLInterface not initialized. Unable to compute anything.");
+		return -1;
+	}
+}
+
+std::vector<float> SubsamplingLayer::computeError(const std::vector<float> &input) {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (ocl->isInitialized()) {
+		int memid = uploadError(&input[0], 1);
+		if (memid < 0) {
+			Logger::writeLine("SubsamplingLayer::computeError(): Can't upload error. Unable to compute anything.");
+			return input;
+		}
+		int errmemid = computeDeviceError(memid, 1);
+		if (errmemid < 0) {
+			return input;
+		} else {
+			std::vector<float> newerror(num_inputs);
+			ocl->getMemoryContent(errmemid, (void *) &newerror[0], num_inputs * sizeof(float));
+			return newerror;
 		}
 	} else {
 		Logger::writeLine("SubsamplingLayer::computeError(): OpenCLInterface not initialized. Unable to compute anything.");
@@ -199,28 +345,175 @@ std::vector<float> SubsamplingLayer::computeError(const std::vector<float> &inpu
 	}
 }
 
+void SubsamplingLayer::computeHostOutput(const float *input, float *output, unsigned int batch_size, bool training) {
+	synchronizeWeights();
+	unsigned int output_width = (input_maps.width + filter.width - 1) / filter.width;
+	unsigned int output_feature_map_size = output_width * ((input_maps.height + filter.height - 1) / filter.height);
+	unsigned int input_feature_map_size = input_maps.width * input_maps.height;
+	//same arithmetic as the computeOutput kernel, one item per (output, sample)
+	ThreadPool::getInstance()->parallelFor(num_outputs * batch_size, [&](unsigned int begin, unsigned int end) {
+		for (unsigned int id = begin; id < end; id++) {
+			unsigned int output_id = id % num_outputs;
+			unsigned int feature_map_id = output_id / output_feature_map_size;
+			unsigned int output_x = (output_id % output_feature_map_size) % output_width;
+			unsigned int output_y = (output_id % output_feature_map_size) / output_width;
+			const float *map = &input[(id / num_outputs) * num_inputs + feature_map_id * input_feature_map_size];
+			float sum = 0.0f;
+			for (unsigned int inp_y = output_y * filter.height; inp_y < (output_y + 1) * filter.height && inp_y < input_maps.height; inp_y++) {
+				for (unsigned int inp_x = output_x * filter.width; inp_x < (output_x + 1) * filter.width && inp_x < input_maps.width; inp_x++) {
+					sum += map[inp_y * input_maps.width + inp_x];
+				}
+			}
+			sum /= filter.width * filter.height;
+			if (training) netsums[id] = sum;
+			sum *= weights[2 * feature_map_id];
+			sum += weights[2 * feature_map_id + 1];
+			output[id] = act->compute(sum);
+		}
+	});
+}
+
+void SubsamplingLayer::computeHostError(const float *error, float *previous_error, unsigned int batch_size) {
+	unsigned int output_width = (input_maps.width + filter.width - 1) / filter.width;
+	unsigned int output_feature_map_size = output_width * ((input_maps.height + filter.height - 1) / filter.height);
+	unsigned int input_feature_map_size = input_maps.width * input_maps.height;
+	float *derivs = derivatives;
+	for (unsigned int i = 0; i < num_outputs * batch_size; i++) {
+		unsigned int feature_map_id = (i % num_outputs) / output_feature_map_size;
+		derivs[i] = act->computeDerivative(netsums[i] * weights[2 * feature_map_id] + weights[2 * feature_map_id + 1]);
+	}
+	//same arithmetic as the computeNextError kernel, one item per (input, sample)
+	ThreadPool::getInstance()->parallelFor(num_inputs * batch_size, [&](unsigned int begin, unsigned int end) {
+		for (unsigned int id = begin; id < end; id++) {
+			unsigned int input_id = id % num_inputs;
+			unsigned int feature_map_id = input_id / input_feature_map_size;
+			unsigned int inp_x = (input_id % input_feature_map_size) % input_maps.width;
+			unsigned int inp_y = (input_id % input_feature_map_size) / input_maps.width;
+			unsigned int output_id = (id / num_inputs) * num_outputs + feature_map_id * output_feature_map_size + (inp_y / filter.height) * output_width + inp_x / filter.width;
+			float delta = derivs[output_id] * error[output_id];
+			previous_error[id] = weights[2 * feature_map_id] * delta;
+		}
+	});
+	//same arithmetic as the computeWeights kernel, after all errors used the old weights
+	for (unsigned int feature_map_id = 0; feature_map_id < num_feature_maps; feature_map_id++) {
+		float delta = 0.0f;
+		float delta_bias = 0.0f;
+		for (unsigned int sample_id = 0; sample_id < batch_size; sample_id++) {
+			for (unsigned int i = 0; i < output_feature_map_size; i++) {
+				unsigned int output_id = sample_id * num_outputs + feature_map_id * output_feature_map_size + i;
+				delta += learning * error[output_id] * derivs[output_id] * netsums[output_id];
+				delta_bias += learning * error[output_id] * derivs[output_id];
+			}
+		}
+		weights[2 * feature_map_id] += delta;
+		weights[2 * feature_map_id + 1] += delta_bias;
+	}
+	if (wmemid >= 0) {
+		//outdated now, recreated from the host weights by the next device pass
+		OpenCLInterface::getInstance()->freeMemoryObject(wmemid);
+		wmemid = -1;
+	}
+}
+
 std::string SubsamplingLayer::getName() const {
 	return "SubsamplingLayer";
 }
 
+void SubsamplingLayer::synchronizeWeights() const {
+	if (released_weights > 0) {
+		weights.resize(released_weights);
+		released_weights = 0;
+		weights_dirty = true;
+	}
+	if (weights_dirty) {
+		std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+		setProfilingLabel("readback");
+		if (ocl->getMemoryContent(wmemid, (void *) &weights[0], weights.size() * sizeof(float)) != OpenCLInterface::OpenCLError::SUCCESS) {
+			Logger::writeLine("SubsamplingLayer::synchronizeWeights(): Unable to read weights from the device.");
+		} else {
+			weights_dirty = false;
+		}
+	}
+}
+
+bool SubsamplingLayer::copyWeights(std::vector<float> &output) const {
+	if ((released_weights == 0) && !weights_dirty) {
+		output = weights;
+		return true;
+	}
+	//read into the caller's buffer, a released host copy stays released
+	output.resize((released_weights > 0) ? released_weights : weights.size());
+	setProfilingLabel("readback");
+	if (OpenCLInterface::getInstance()->getMemoryContent(wmemid, (void *) &output[0], output.size() * sizeof(float)) != OpenCLInterface::OpenCLError::SUCCESS) {
+		Logger::writeLine("SubsamplingLayer::copyWeights(): Unable to read weights from the device.");
+		return false;
+	}
+	return true;
+}
+
 std::string SubsamplingLayer::getDatastring() const {
+	std::vector<float> current;
+	copyWeights(current);
+	return getParameterString() + ":" + getVectorRepresentation<float>(current, ';');
+}
+
+std::string SubsamplingLayer::getParameterString() const {
 	std::string datastring = act->getName() + ":";
 	datastring += std::to_string(learning) + ":" + std::to_string(num_feature_maps) + ":";
 	datastring += std::to_string(input_maps.width) + ":" + std::to_string(input_maps.height) + ":";
-	datastring += std::to_string(filter.width) + ":" + std::to_string(filter.height) + ":";
-	datastring += getVectorRepresentation<float>(weights, ';');
+	datastring += std::to_string(filter.width) + ":" + std::to_string(filter.height);
 	return datastring;
 }
 
+const std::vector<float> *SubsamplingLayer::getWeights() const {
+	synchronizeWeights();
+	return &weights;
+}
+
+bool SubsamplingLayer::loadWeightsToDevice(const float *weights, size_t num_weights, bool keep_host_copy) {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (!ocl->isInitialized()) {
+		Logger::writeLine("SubsamplingLayer::loadWeightsToDevice(): OpenCL system was not initialized.");
+		return false;
+	} else if (num_weights != 2 * num_feature_maps) {
+		Logger::writeLine("SubsamplingLayer::loadWeightsToDevice(): Invalid number of weights.");
+		return false;
+	}
+	if (wmemid >= 0) {
+		ocl->freeMemoryObject(wmemid);
+	}
+	//copied while allocating, the buffer does not use the host memory afterwards
+	wmemid = ocl->allocateMemoryObject((void *) weights, num_weights * sizeof(float), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR);
+	if (wmemid < 0) {
+		Logger::writeLine("SubsamplingLayer::loadWeightsToDevice(): Unable to allocate the weights on the device.");
+		return false;
+	}
+	weights_dirty = false;
+	if (keep_host_copy) {
+		released_weights = 0;
+		if (this->weights.data() != weights) {
+			this->weights.assign(weights, weights + num_weights);
+		}
+	} else {
+		released_weights = num_weights;
+		std::vector<float>().swap(this->weights);
+	}
+	return true;
+}
+
 bool SubsamplingLayer::parseDatastring(std::string datastring) {
-	std::vector<std::string> data = parseVectorRepresentation<std::string> (datastring, ':');
-	if (data.size() != 8) {
-		Logger::writeLine("SubsamplingLayer::parseDatastring(): Invalid number of parameters." + std::to_string(data.size()));
+	return parseDatastringWithWeights(datastring);
+}
+
+bool SubsamplingLayer::parseParameterString(std::string parameters, const float *weights, size_t num_weights) {
+	std::vector<std::string> data = parseVectorRepresentation<std::string> (parameters, ':');
+	if (data.size() != 7) {
+		Logger::writeLine("SubsamplingLayer::parseParameterString(): Invalid number of parameters." + std::to_string(data.size()));
 		return false;
 	} else {
 		act = ActivationFunction::getObjectFromString(data[0]);
 		if (act == nullptr) {
-			Logger::writeLine("SubsamplingLayer::parseDatastring(): Invalid activation function identifier: " + data[0]);
+			Logger::writeLine("SubsamplingLayer::parseParameterString(): Invalid activation function identifier: " + data[0]);
 			return false;
 		} else {
 			learning = std::stof(data[1]);
@@ -231,15 +524,53 @@ bool SubsamplingLayer::parseDatastring(std::string datastring) {
 			filter.width = std::stoul(data[5]);
 			filter.height = std::stoul(data[6]);
 			num_outputs = ((input_maps.width + filter.width - 1) / filter.width) * ((input_maps.height + filter.height - 1) / filter.height) * num_feature_maps;
-			weights = parseVectorRepresentation<float>(data[7], ';');
+			if (num_weights != 2 * num_feature_maps) {
+				Logger::writeLine("SubsamplingLayer::parseParameterString(): Invalid number of weights.");
+				return false;
+			}
+			//without weights they are passed to loadWeightsToDevice() afterwards
+			if (weights != nullptr) {
+				this->weights.assign(weights, weights + num_weights);
+			} else {
+				this->weights.clear();
+			}
+			released_weights = 0;
 		}
 	}
 	return true;
 }
 
+void SubsamplingLayer::freeTrainingObjects() {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	if (ememid >= 0) {
+		ocl->freeMemoryObject(ememid);
+		ememid = -1;
+	}
+	if (smemid >= 0) {
+		ocl->freeMemoryObject(smemid);
+		smemid = -1;
+	}
+	if (nememid >= 0) {
+		ocl->freeMemoryObject(nememid);
+		nememid = -1;
+	}
+	if (okid >= 0) {
+		ocl->deleteKernel(okid);
+		okid = -1;
+	}
+	if (fberrorkid >= 0) {
+		ocl->deleteKernel(fberrorkid);
+		fberrorkid = -1;
+	}
+	if (fbweightskid >= 0) {
+		ocl->deleteKernel(fbweightskid);
+		fbweightskid = -1;
+	}
+}
+
 SubsamplingLayer::~SubsamplingLayer() {
 	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
-	if (wmemid > 0) {
+	if (wmemid >= 0) {
 		ocl->freeMemoryObject(wmemid);
 	}
 	if (imemid > 0) {
@@ -248,6 +579,9 @@ SubsamplingLayer::~SubsamplingLayer() {
 	if (oememid > 0) {
 		ocl->freeMemoryObject(oememid);
 	}
+	if (ememid > 0) {
+		ocl->freeMemoryObject(ememid);
+	}
 	if (smemid > 0) {
 		ocl->freeMemoryObject(smemid);
 	}
@@ -257,6 +591,9 @@ SubsamplingLayer::~SubsamplingLayer() {
 	if (okid > 0) {
 		ocl->deleteKernel(okid);
 	}
+	if (oikid > 0) {
+		ocl->deleteKernel(oikid);
+	}
 }
 
 } /* namespace clneural */
@@ -21,7 +21,9 @@ public:
 		unsigned int height = 0;
 	};
 private:
-	std::vector<float> weights;
+	mutable std::vector<float> weights;
+	mutable bool weights_dirty = false; //device weights changed since the last synchronization
+	mutable size_t released_weights = 0; //number of weights only held by the device, read back on demand
 	float learning = 0.5f;
 	static const std::string fwclcode;
 	static const std::string fberrorclcode;
@@ -30,26 +32,43 @@ private:
 	unsigned int num_feature_maps = 0;
 	int wmemid = -1; //weights
 	int imemid = -1; //inputs
-	int oememid = -1; //outputs and errors from next layer
+	int oememid = -1; //outputs
+	int ememid = -1; //errors from next layer
 	int nememid = -1; //error to previous layer
 	int smemid =-1; //input*weight sums
 	int okid = -1; //kernel for output computation
 	int fberrorkid = -1; //kernel for previous error computation
 	int fbweightskid = -1; //kernel for weight adaption computation
+	int oikid = -1; //kernel for output computation without netsums (inference)
 	Dimension input_maps;
 	Dimension filter;
-	bool initializeMemoryObjects(std::shared_ptr<OpenCLInterface> ocl);
-	bool initializeKernelObjects(std::shared_ptr<OpenCLInterface> ocl);
+	bool initializeMemoryObjects(std::shared_ptr<OpenCLInterface> ocl, unsigned int batch_size = 1, bool training = true);
+	void freeBatchMemoryObjects(std::shared_ptr<OpenCLInterface> ocl);
+	bool initializeKernelObjects(std::shared_ptr<OpenCLInterface> ocl, bool training = true);
 	static const NeuralNetworkLayerRegisterHelper<SubsamplingLayer> reg;
 protected:
 	virtual std::vector<float> computeOutput(const std::vector<float> &input);
 	virtual std::vector<float> computeError(const std::vector<float> &input);
+	virtual void computeHostOutput(const float *input, float *output, unsigned int batch_size, bool training);
+	virtual void computeHostError(const float *error, float *previous_error, unsigned int batch_size);
+	virtual int uploadInput(const float *input, unsigned int batch_size, bool training);
+	virtual bool computeDeviceOutput(int memid, unsigned int batch_size, bool training);
+	virtual int getOutputMemoryId() const;
+	virtual int uploadError(const float *error, unsigned int batch_size);
+	virtual int computeDeviceError(int memid, unsigned int batch_size);
+	virtual void freeTrainingObjects();
 	virtual std::string getName() const;
 	virtual std::string getDatastring() const;
 	virtual bool parseDatastring(std::string datastring);
+	virtual std::string getParameterString() const;
+	virtual bool parseParameterString(std::string parameters, const float *weights, size_t num_weights);
 public:
 	SubsamplingLayer() = default;
 	SubsamplingLayer(Dimension input_maps, Dimension filter, unsigned int num_feature_maps, std::shared_ptr<ActivationFunction> act, float learning);
+	virtual void synchronizeWeights() const;
+	virtual const std::vector<float> *getWeights() const;
+	virtual bool copyWeights(std::vector<float> &output) const;
+	virtual bool loadWeightsToDevice(const float *weights, size_t num_weights, bool keep_host_copy);
 	virtual ~SubsamplingLayer();
 };
 
@@ -6,6 +6,7 @@
  */
 
 #include "TanhActivationFunction.h"
+#include <cmath>
 
 namespace clneural {
 
@@ -30,6 +31,14 @@ std::string TanhActivationFunction::getDerivCode() const {
 	return code;
 }
 
+float TanhActivationFunction::compute(float input) const {
+	return (1.7159f*std::tanh(2.0f/3.0f * input));
+}
+
+float TanhActivationFunction::computeDerivative(float input) const {
+	return (1.7159f * 2.0f/3.0f * (1 - std::tanh(2.0f/3.0f * input) * std::tanh(2.0f/3.0f * input)));
+}
+
 std::string TanhActivationFunction::getName() const {
 	return "TanhActivationFunction";
 }
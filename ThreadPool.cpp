@@ -0,0 +1,106 @@
+/*
+ * ThreadPool.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "ThreadPool.h"
+
+namespace clneural {
+
+std::shared_ptr<ThreadPool> ThreadPool::instance = nullptr;
+
+std::shared_ptr<ThreadPool> ThreadPool::getInstance() {
+	if (instance == nullptr) {
+		instance = std::shared_ptr<ThreadPool>(new ThreadPool(0));
+	}
+	return instance;
+}
+
+void ThreadPool::setNumThreads(unsigned int num_threads) {
+	instance = std::shared_ptr<ThreadPool>(new ThreadPool(num_threads));
+}
+
+ThreadPool::ThreadPool(unsigned int num_threads) : next_item(0) {
+	if (num_threads == 0) {
+		num_threads = std::thread::hardware_concurrency();
+	}
+	//the calling thread takes part in every task, so one thread less is started
+	for (unsigned int i = 1; i < num_threads; i++) {
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+unsigned int ThreadPool::getNumThreads() const {
+	return workers.size() + 1;
+}
+
+void ThreadPool::runChunks() {
+	unsigned int begin = next_item.fetch_add(chunk_size);
+	while (begin < task_size) {
+		unsigned int end = begin + chunk_size;
+		if (end > task_size) end = task_size;
+		task(task_function, begin, end);
+		begin = next_item.fetch_add(chunk_size);
+	}
+}
+
+void ThreadPool::workerLoop() {
+	unsigned long last_generation = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			work_available.wait(lock, [&]() { return stopping || (generation != last_generation); });
+			if (stopping) return;
+			last_generation = generation;
+		}
+		runChunks();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			active_workers--;
+		}
+		work_done.notify_all();
+	}
+}
+
+void ThreadPool::run(unsigned int size, void (*task)(const void *, unsigned int, unsigned int), const void *function) {
+	if (size == 0) {
+		return;
+	}
+	if (workers.empty() || (size == 1)) {
+		task(function, 0, size);
+		return;
+	}
+	std::lock_guard<std::mutex> call_lock(call_mutex);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->task = task;
+		task_function = function;
+		task_size = size;
+		//a few chunks per thread balance uneven work without much contention on next_item
+		chunk_size = size / (4 * getNumThreads());
+		if (chunk_size < 1) chunk_size = 1;
+		next_item = 0;
+		active_workers = workers.size();
+		generation++;
+	}
+	work_available.notify_all();
+	runChunks();
+	std::unique_lock<std::mutex> lock(mutex);
+	work_done.wait(lock, [&]() { return active_workers == 0; });
+	this->task = nullptr;
+	task_function = nullptr;
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	work_available.notify_all();
+	for (unsigned int i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+}
+
+} /* namespace clneural */
@@ -0,0 +1,58 @@
+/*
+ * ThreadPool.h
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace clneural {
+
+class ThreadPool {
+private:
+	ThreadPool(unsigned int num_threads);
+	std::vector<std::thread> workers;
+	std::mutex call_mutex; //serializes concurrent parallelFor() calls
+	std::mutex mutex;
+	std::condition_variable work_available;
+	std::condition_variable work_done;
+	void (*task)(const void *, unsigned int, unsigned int) = nullptr; //calls the function of the current task
+	const void *task_function = nullptr;
+	unsigned int task_size = 0; //number of items of the current task
+	unsigned int chunk_size = 1;
+	std::atomic<unsigned int> next_item;
+	unsigned int active_workers = 0;
+	unsigned long generation = 0; //incremented for every task, wakes up the workers
+	bool stopping = false;
+	static std::shared_ptr<ThreadPool> instance;
+	void workerLoop();
+	void runChunks();
+	void run(unsigned int size, void (*task)(const void *, unsigned int, unsigned int), const void *function);
+	template<typename F> static void callFunction(const void *function, unsigned int begin, unsigned int end) {
+		(*(const F *) function)(begin, end);
+	}
+public:
+	static std::shared_ptr<ThreadPool> getInstance();
+	/* Replaces the shared pool. 0 uses one thread per hardware thread. */
+	static void setNumThreads(unsigned int num_threads);
+	unsigned int getNumThreads() const;
+	/* Calls function(begin, end) for consecutive ranges covering [0, size) on the workers and the calling thread,
+	 * returning when all ranges are done. Must not be called from within function. */
+	template<typename F> void parallelFor(unsigned int size, const F &function) {
+		//the function is only referenced, wrapping it into a std::function could allocate on every call
+		run(size, &callFunction<F>, (const void *) &function);
+	}
+	virtual ~ThreadPool();
+};
+
+} /* namespace clneural */
+
+#endif /* THREADPOOL_H_ */
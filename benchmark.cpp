@@ -0,0 +1,231 @@
+/*
+ * benchmark.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "FullFeedforwardLayer.h"
+#include "ConvolutionalLayer.h"
+#include "SubsamplingLayer.h"
+#include "SigmoidActivationFunction.h"
+#include "TanhActivationFunction.h"
+#include "OpenCLInterface.h"
+#include "RandomGenerator.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <list>
+
+/* Layer microbenchmarks on synthetic data.
+ * Usage: clneural_bench [--native] [--gpu] [--batch N] [--repeat N] [--ff-kernel auto|row|tiled] [--conv-kernel auto|direct|gemm]
+ * Every pass is timed on the host including the upload of its input, the median over all repetitions is reported.
+ * FLOP and byte counts are the minimum the pass needs, not what a kernel actually executes or transfers.
+ * --ff-kernel and --conv-kernel fix the kernels of the fully connected and convolutional layers to compare them on the same shapes.
+ * The backward pass is timed as one, the previous layer error and the weight update run in the same layer call.
+ * With OpenCL the device time per pass (upload, forward, error, weights) is printed from the profiling records, this is the
+ * only place where the weight update is timed on its own. Native runs have no profiling records and cannot split it. */
+
+struct Workload {
+	std::string name;
+	std::shared_ptr<clneural::NeuralNetworkLayer> layer;
+	double forward_flops = 0.0; //per sample
+	double error_flops = 0.0; //previous layer error and weight update, per sample
+	double forward_bytes = 0.0; //per batch
+	double error_bytes = 0.0;
+};
+
+std::vector<float> randomVector(unsigned int size) {
+	std::vector<float> data(size);
+	for (unsigned int i = 0; i < size; i++) {
+		data[i] = clneural::RandomGenerator::getRandomNumber(-1.0f, 1.0f);
+	}
+	return data;
+}
+
+double median(std::vector<double> values) {
+	std::sort(values.begin(), values.end());
+	if (values.size() % 2 == 0) {
+		return (values[values.size()/2 - 1] + values[values.size()/2]) / 2.0;
+	}
+	return values[values.size()/2];
+}
+
+Workload fullFeedforward(unsigned int num_inputs, unsigned int num_outputs, unsigned int batch_size) {
+	Workload w;
+	w.name = "FF " + std::to_string(num_inputs) + "x" + std::to_string(num_outputs);
+	w.layer = std::shared_ptr<clneural::NeuralNetworkLayer>(new clneural::FullFeedforwardLayer(num_inputs, num_outputs,
+			std::shared_ptr<clneural::ActivationFunction>(new clneural::SigmoidActivationFunction()), 0.01f));
+	double weights = (num_inputs + 1.0) * num_outputs;
+	w.forward_flops = 2.0 * weights;
+	w.error_flops = 2.0 * num_inputs * num_outputs + 2.0 * weights;
+	//inputs, weights, outputs and netsums
+	w.forward_bytes = 4.0 * (weights + batch_size * (num_inputs + 2.0 * num_outputs));
+	//error, netsums, inputs and previous error; weights read and written
+	w.error_bytes = 4.0 * (2.0 * weights + batch_size * (2.0 * num_outputs + 2.0 * num_inputs));
+	return w;
+}
+
+Workload convolutional(unsigned int width, unsigned int height, unsigned int filter_size, const std::vector<std::list<unsigned int>> &connections,
+		std::string name, unsigned int batch_size) {
+	Workload w;
+	clneural::ConvolutionalLayer::Dimension input;
+	clneural::ConvolutionalLayer::Dimension filter;
+	input.width = width;
+	input.height = height;
+	filter.width = filter_size;
+	filter.height = filter_size;
+	w.name = name;
+	w.layer = std::shared_ptr<clneural::NeuralNetworkLayer>(new clneural::ConvolutionalLayer(input, filter, connections,
+			std::shared_ptr<clneural::ActivationFunction>(new clneural::SigmoidActivationFunction()), 0.01f));
+	double output_map_size = (width - filter_size + 1.0) * (height - filter_size + 1.0);
+	double num_connections = 0.0;
+	for (unsigned int i = 0; i < connections.size(); i++) {
+		num_connections += connections[i].size();
+	}
+	double weights = num_connections * filter_size * filter_size + connections.size();
+	w.forward_flops = 2.0 * num_connections * filter_size * filter_size * output_map_size;
+	w.error_flops = 2.0 * w.forward_flops;
+	w.forward_bytes = 4.0 * (weights + batch_size * (w.layer->getNumInputs() + 2.0 * w.layer->getNumOutputs()));
+	w.error_bytes = 4.0 * (2.0 * weights + batch_size * (2.0 * w.layer->getNumOutputs() + 2.0 * w.layer->getNumInputs()));
+	return w;
+}
+
+Workload subsampling(unsigned int width, unsigned int height, unsigned int filter_size, unsigned int num_maps, unsigned int batch_size) {
+	Workload w;
+	clneural::SubsamplingLayer::Dimension input;
+	clneural::SubsamplingLayer::Dimension filter;
+	input.width = width;
+	input.height = height;
+	filter.width = filter_size;
+	filter.height = filter_size;
+	w.name = "Sub " + std::to_string(num_maps) + "x" + std::to_string(width) + "x" + std::to_string(height) + "/" + std::to_string(filter_size) + "x" + std::to_string(filter_size);
+	w.layer = std::shared_ptr<clneural::NeuralNetworkLayer>(new clneural::SubsamplingLayer(input, filter, num_maps,
+			std::shared_ptr<clneural::ActivationFunction>(new clneural::TanhActivationFunction()), 0.01f));
+	double num_inputs = w.layer->getNumInputs();
+	double num_outputs = w.layer->getNumOutputs();
+	w.forward_flops = num_inputs + 3.0 * num_outputs;
+	w.error_flops = 2.0 * num_inputs + 6.0 * num_outputs;
+	w.forward_bytes = 4.0 * batch_size * (num_inputs + 2.0 * num_outputs);
+	w.error_bytes = 4.0 * batch_size * (2.0 * num_outputs + num_inputs);
+	return w;
+}
+
+void printHeader() {
+	std::cout << std::left << std::setw(32) << "layer" << std::setw(9) << "pass"
+			<< std::right << std::setw(12) << "median ms" << std::setw(12) << "GFLOP/s" << std::setw(12) << "GB/s" << std::endl;
+}
+
+void printResult(const std::string &name, const std::string &pass, double seconds, double flops, double bytes) {
+	std::cout << std::left << std::setw(32) << name << std::setw(9) << pass << std::right << std::fixed
+			<< std::setw(12) << std::setprecision(3) << seconds * 1.0e3
+			<< std::setw(12) << std::setprecision(2) << flops / seconds / 1.0e9
+			<< std::setw(12) << std::setprecision(2) << bytes / seconds / 1.0e9 << std::endl;
+}
+
+void runWorkload(Workload &w, unsigned int batch_size, unsigned int repeat, bool profiling) {
+	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+	std::vector<float> input = randomVector(w.layer->getNumInputs() * batch_size);
+	std::vector<float> error = randomVector(w.layer->getNumOutputs() * batch_size);
+	std::vector<double> forward_times;
+	std::vector<double> error_times;
+	//the first passes build kernels and allocate buffers
+	for (unsigned int i = 0; i < 2; i++) {
+		w.layer->processAndForwardBatch(input, batch_size);
+		w.layer->processAndForwardBatchError(error, batch_size);
+	}
+	if (profiling) ocl->clearProfilingData();
+	for (unsigned int i = 0; i < repeat; i++) {
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		w.layer->processAndForwardBatch(input, batch_size);
+		std::chrono::steady_clock::time_point middle = std::chrono::steady_clock::now();
+		w.layer->processAndForwardBatchError(error, batch_size);
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		forward_times.push_back(std::chrono::duration<double>(middle - begin).count());
+		error_times.push_back(std::chrono::duration<double>(end - middle).count());
+	}
+	printResult(w.name, "forward", median(forward_times), w.forward_flops * batch_size, w.forward_bytes);
+	printResult(w.name, "backward", median(error_times), w.error_flops * batch_size, w.error_bytes);
+	if (profiling) {
+		std::cout << ocl->getProfilingSummary() << std::endl;
+		printHeader();
+	}
+}
+
+int main(int argc, char **argv) {
+	bool native = false;
+	cl_device_type device_type = CL_DEVICE_TYPE_CPU;
+	unsigned int batch_size = 32;
+	unsigned int repeat = 20;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--native") == 0) {
+			native = true;
+		} else if (strcmp(argv[i], "--gpu") == 0) {
+			device_type = CL_DEVICE_TYPE_GPU;
+		} else if ((strcmp(argv[i], "--batch") == 0) && (i + 1 < argc)) {
+			batch_size = std::max(1, atoi(argv[++i]));
+		} else if ((strcmp(argv[i], "--repeat") == 0) && (i + 1 < argc)) {
+			repeat = std::max(1, atoi(argv[++i]));
+		} else if ((strcmp(argv[i], "--ff-kernel") == 0) && (i + 1 < argc) && (strcmp(argv[i + 1], "auto") == 0)) {
+			clneural::FullFeedforwardLayer::setOutputKernel(clneural::FullFeedforwardLayer::OutputKernel::AUTOMATIC_KERNEL);
+			i++;
+		} else if ((strcmp(argv[i], "--ff-kernel") == 0) && (i + 1 < argc) && (strcmp(argv[i + 1], "row") == 0)) {
+			clneural::FullFeedforwardLayer::setOutputKernel(clneural::FullFeedforwardLayer::OutputKernel::ROW_KERNEL);
+			i++;
+		} else if ((strcmp(argv[i], "--ff-kernel") == 0) && (i + 1 < argc) && (strcmp(argv[i + 1], "tiled") == 0)) {
+			clneural::FullFeedforwardLayer::setOutputKernel(clneural::FullFeedforwardLayer::OutputKernel::TILED_KERNEL);
+			i++;
+		} else if ((strcmp(argv[i], "--conv-kernel") == 0) && (i + 1 < argc) && (strcmp(argv[i + 1], "auto") == 0)) {
+			clneural::ConvolutionalLayer::setConvolutionKernel(clneural::ConvolutionalLayer::ConvolutionKernel::AUTOMATIC_KERNEL);
+			i++;
+		} else if ((strcmp(argv[i], "--conv-kernel") == 0) && (i + 1 < argc) && (strcmp(argv[i + 1], "direct") == 0)) {
+			clneural::ConvolutionalLayer::setConvolutionKernel(clneural::ConvolutionalLayer::ConvolutionKernel::DIRECT_KERNEL);
+			i++;
+		} else if ((strcmp(argv[i], "--conv-kernel") == 0) && (i + 1 < argc) && (strcmp(argv[i + 1], "gemm") == 0)) {
+			clneural::ConvolutionalLayer::setConvolutionKernel(clneural::ConvolutionalLayer::ConvolutionKernel::GEMM_KERNEL);
+			i++;
+		} else {
+			std::cerr << "Usage: " << argv[0] << " [--native] [--gpu] [--batch N] [--repeat N] [--ff-kernel auto|row|tiled] [--conv-kernel auto|direct|gemm]" << std::endl;
+			return 1;
+		}
+	}
+	bool profiling = false;
+	if (native) {
+		clneural::NeuralNetworkLayer::setBackend(clneural::NeuralNetworkLayer::Backend::NATIVE);
+	} else {
+		std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
+		ocl->initialize(device_type, true);
+		ocl->setProgramCacheDirectory("clcache");
+		profiling = ocl->isInitialized();
+	}
+	std::cout << "Backend: " << (profiling ? "OpenCL" : "native") << ", batch size " << batch_size << ", " << repeat << " repetitions" << std::endl;
+	if (profiling) {
+		std::cout << "backward: previous layer error and weight update, split per kernel in the profiling tables" << std::endl;
+	} else {
+		std::cout << "backward: previous layer error and weight update, not timed separately without OpenCL profiling" << std::endl;
+	}
+
+	std::vector<std::list<unsigned int>> c1_connections(6, std::list<unsigned int>({0}));
+	std::vector<std::list<unsigned int>> c3_connections({{0,1,2}, {1,2,3}, {2,3,4}, {3,4,5}, {4,5,0}, {5,0,1},
+			{0,1,2,3}, {1,2,3,4}, {2,3,4,5}, {3,4,5,0}, {4,5,0,1}, {5,0,1,2}, {0,1,3,4}, {1,2,4,5}, {0,2,3,5}, {0,1,2,3,4,5}});
+	std::vector<Workload> workloads;
+	workloads.push_back(fullFeedforward(400, 84, batch_size));
+	workloads.push_back(fullFeedforward(84, 10, batch_size));
+	workloads.push_back(fullFeedforward(1024, 1024, batch_size));
+	workloads.push_back(fullFeedforward(4096, 4096, batch_size));
+	workloads.push_back(fullFeedforward(4096, 10, batch_size));
+	workloads.push_back(convolutional(32, 32, 5, c1_connections, "Conv 32x32/5x5 C1 1->6", batch_size));
+	workloads.push_back(convolutional(14, 14, 5, c3_connections, "Conv 14x14/5x5 C3 6->16", batch_size));
+	workloads.push_back(convolutional(32, 32, 5, c3_connections, "Conv 32x32/5x5 C3 6->16", batch_size));
+	workloads.push_back(subsampling(28, 28, 2, 6, batch_size));
+	workloads.push_back(subsampling(28, 28, 3, 6, batch_size));
+	workloads.push_back(subsampling(10, 10, 2, 16, batch_size));
+
+	printHeader();
+	for (unsigned int i = 0; i < workloads.size(); i++) {
+		runWorkload(workloads[i], batch_size, repeat, profiling);
+	}
+	return 0;
+}
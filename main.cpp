@@ -6,17 +6,22 @@
  */
 
 #include "ImageDataset.h"
+#include "EpochSampler.h"
+#include "BatchPrefetcher.h"
 #include "FullFeedforwardLayer.h"
 #include "ConvolutionalLayer.h"
 #include "SubsamplingLayer.h"
+#include "AugmentationLayer.h"
 #include "NeuralNetwork.h"
 #include "LinearActivationFunction.h"
 #include "SigmoidActivationFunction.h"
 #include "TanhActivationFunction.h"
 #include "OpenCLInterface.h"
 #include "RandomGenerator.h"
+#include "Logger.h"
 #include <iostream>
 #include <ctime>
+#include <cstdlib>
 #include <cmath>
 #include <algorithm>
 
@@ -38,12 +43,11 @@ std::vector<float> xorout(const std::vector<float> &in) {
 	return std::vector<float>({0.0f});
 }
 
-void verifyNetwork(clneural::NeuralNetwork &net) {
-	ImageDataset testset;
-	testset.loadImagesFromFile("t10k-images-idx3-ubyte");
-	testset.loadLabelsFromFile("t10k-labels-idx1-ubyte");
-	std::cout << "Verifying network with " + std::to_string(testset.getSize()) + " images:" << std::endl;
-	unsigned int size = testset.getSize();
+void verifyNetwork(clneural::NeuralNetwork &net, const ImageDataset &testset) {
+	std::cout << "Verifying network with " + std::to_string(testset.getNumImages()) + " images:" << std::endl;
+	unsigned int size = testset.getNumImages();
+	EpochSampler sampler(testset, time(NULL));
+	std::vector<float> input(testset.getSampleSize());
 	clock_t total_begin = clock();
 	float avgmse = 0.0f;
 	float avgedist = 0.0f;
@@ -52,21 +56,24 @@ void verifyNetwork(clneural::NeuralNetwork &net) {
 	float avgtime = 0.0f;
 	unsigned int counter = 1;
 	unsigned int correct_outputs = 0;
-	while (testset.getSize() > 0) {
+	while (sampler.hasNext()) {
 		if ((counter % 1000) == 0) std::cout << "Computing step: " << counter << std::endl;
-		std::pair<std::vector<float>, uint8_t> elem = testset.popRandomElementWithLabel();
+		unsigned int index = sampler.next();
+		const float *sample = testset.getSample(index);
+		input.assign(sample, sample + testset.getSampleSize());
+		uint8_t label = testset.getLabel(index);
 		std::vector<float> desired(10, 0.0f);
-		desired[elem.second] = 1.0f;
+		desired[label] = 1.0f;
 		clock_t begin = clock();
-		net.processInput(elem.first);
+		net.processInput(input);
 		avgtime += ((float) (clock() - begin))/CLOCKS_PER_SEC;
-		std::vector<float> output = net.getLastOutput();
+		clneural::ActivationArena::View output = net.getLastOutputView();
 		float tmpsum = 0.0f;
 		for (unsigned int i = 0; i < output.size(); i++) {
 			tmpsum += (output[i] - desired[i]) * (output[i] - desired[i]);
 		}
 		uint8_t maxresult = (uint8_t) std::distance(output.begin(), std::max_element(output.begin(), output.end()));
-		if (maxresult == elem.second) correct_outputs++;
+		if (maxresult == label) correct_outputs++;
 		float tmpedist = sqrt(tmpsum);
 		float tmpmse = tmpsum/10.0f;
 		if (tmpedist > maxedist) maxedist = tmpedist;
@@ -92,6 +99,11 @@ int main (int argc, char **argv) {
 	ImageDataset d;
 	d.loadImagesFromFile("train-images-idx3-ubyte");
 	d.loadLabelsFromFile("train-labels-idx1-ubyte");
+	d.materialize();
+	ImageDataset testset;
+	testset.loadImagesFromFile("t10k-images-idx3-ubyte");
+	testset.loadLabelsFromFile("t10k-labels-idx1-ubyte");
+	testset.materialize();
 	std::shared_ptr<clneural::ActivationFunction> act(new clneural::SigmoidActivationFunction());
 	std::shared_ptr<clneural::ActivationFunction> act2(new clneural::LinearActivationFunction());
 	std::vector<std::list<unsigned int>> C1_connections(6, std::list<unsigned int>({0}));
@@ -144,6 +156,18 @@ int main (int argc, char **argv) {
 	std::shared_ptr<clneural::NeuralNetworkLayer> N1(new clneural::FullFeedforwardLayer(400, 84, act, training_speed));
 	std::shared_ptr<clneural::NeuralNetworkLayer> N2(new clneural::FullFeedforwardLayer(84, 10, act, training_speed));
 	clneural::NeuralNetwork n;
+	//CLNEURAL_AUGMENT=1 randomly shifts, rotates and distorts the training images in front of C1
+	if (getenv("CLNEURAL_AUGMENT") != NULL) {
+		clneural::AugmentationLayer::Dimension A0_input;
+		clneural::AugmentationLayer::Parameters A0_parameters;
+		A0_input.width = 32;
+		A0_input.height = 32;
+		A0_parameters.max_shift = 2.0f;
+		A0_parameters.max_rotation = 0.15f;
+		A0_parameters.elastic_alpha = 1.5f;
+		A0_parameters.background = -0.1f;
+		n.addLayer(std::shared_ptr<clneural::NeuralNetworkLayer>(new clneural::AugmentationLayer(A0_input, 1, A0_parameters, time(NULL))));
+	}
 	n.addLayer(C1);
 	n.addLayer(S2);
 	n.addLayer(C3);
@@ -153,26 +177,64 @@ int main (int argc, char **argv) {
 
 
 	std::shared_ptr<OpenCLInterface> ocl = OpenCLInterface::getInstance();
-	ocl->initialize(CL_DEVICE_TYPE_CPU);
+	//CLNEURAL_NATIVE=1 computes on the host thread pool instead of OpenCL
+	if (getenv("CLNEURAL_NATIVE") != NULL) {
+		clneural::NeuralNetworkLayer::setBackend(clneural::NeuralNetworkLayer::Backend::NATIVE);
+	}
+	//CLNEURAL_TRACE=<file> records every device command and writes a Chrome trace at the end
+	const char *tracefile = getenv("CLNEURAL_TRACE");
+	ocl->initialize(CL_DEVICE_TYPE_CPU, tracefile != NULL);
+	ocl->setProgramCacheDirectory("clcache");
+
+	//CLNEURAL_EPOCHS=<n> trains n epochs, verifying after each
+	unsigned int epochs = 1;
+	if (getenv("CLNEURAL_EPOCHS") != NULL) {
+		epochs = std::max(1, atoi(getenv("CLNEURAL_EPOCHS")));
+	}
+
+	//CLNEURAL_BATCH=<n> trains mini-batches of n samples with one weight update each
+	unsigned int batch_size = 1;
+	if (getenv("CLNEURAL_BATCH") != NULL) {
+		batch_size = std::max(1, atoi(getenv("CLNEURAL_BATCH")));
+	}
 
 	float dist = 0.0f;
-	for (unsigned int i = 0; i < 60000; i++) {
-		std::pair<std::vector<float>, uint8_t> trainelem = d.popRandomElementWithLabel();
-		std::vector<float> desired(10, 0.0f);
-		desired[trainelem.second] = 1.0f;
-		dist += n.trainNetwork(trainelem.first, desired);
-		std::vector<float> nout = n.getLastOutput();
-		if ((i % 1000) == 0) {
-			std::cout << "TIME: " << ((float) clock())/CLOCKS_PER_SEC << ", STEP:" << (i + 1) << ", MDIST: " << dist/1000.0f << ", OUT: (" << nout[0];
-			for (unsigned int j = 1; j < nout.size(); j++) std::cout << "," << nout[j];
-			std::cout << "), DESIRED: (" << desired[0];
-			for (unsigned int j = 1; j < desired.size(); j++) std::cout << "," << desired[j];
+	unsigned int epoch = 0;
+	unsigned int step = 0;
+	BatchPrefetcher prefetcher(d, batch_size, 10, epochs, time(NULL));
+	const BatchPrefetcher::Batch *batch = nullptr;
+	while ((batch = prefetcher.acquire()) != nullptr) {
+		if (batch->epoch != epoch) {
+			n.saveCheckpoint("conv_images1.net");
+			verifyNetwork(n, testset);
+			epoch = batch->epoch;
+			step = 0;
+		}
+		dist += n.trainBatch(batch->inputs, batch->targets, batch->size);
+		if ((step % 1000) < batch->size) {
+			std::vector<float> nout = n.getLastOutput();
+			std::cout << "TIME: " << ((float) clock())/CLOCKS_PER_SEC << ", EPOCH: " << (epoch + 1) << ", STEP:" << (step + 1) << ", MDIST: " << dist/1000.0f << ", OUT: (" << nout[0];
+			for (unsigned int j = 1; j < 10; j++) std::cout << "," << nout[j];
+			std::cout << "), DESIRED: (" << batch->targets[0];
+			for (unsigned int j = 1; j < 10; j++) std::cout << "," << batch->targets[j];
 			std::cout << ")" << std::endl;
 			dist = 0.0f;
 		}
+		if ((step > 0) && ((step % 10000) < batch->size)) {
+			n.saveCheckpoint("conv_images1.net");
+		}
+		step += batch->size;
+		prefetcher.release();
+	}
+	n.saveCheckpoint("conv_images1.net");
+	verifyNetwork(n, testset);
+	if (!n.waitForCheckpoint()) {
+		Logger::writeLine("main(): Unable to save the network.");
+	}
+	if (tracefile != NULL) {
+		ocl->writeProfilingTrace(tracefile);
+		Logger::writeLineNotime(ocl->getProfilingSummary());
 	}
-	n.saveToFile("conv_images1.net");
-	verifyNetwork(n);
 	return 0;
 }
 